@@ -0,0 +1,169 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#include "acq/kdTree.h"
+#include "acq/normalEstimation.h"
+#include "acq/voxelGrid.h"
+#include "acq/parallel.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace acq {
+
+namespace {
+
+//! Neighbours to look for per point.
+enum { K = 10 };
+
+/** \brief Seconds elapsed since \p start. */
+double getSeconds(std::chrono::steady_clock::time_point const& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+} //...getSeconds()
+
+/** \brief Points on the unit sphere, like a scanned surface.
+ *
+ * \param[in] nPoints   Number of points.
+ * \param[in] clustered Fraction of the points packed into a cap of 1% of the surface.
+ */
+CloudT sampleSphere(int nPoints, double clustered) {
+    std::mt19937 rng(1);
+    std::normal_distribution<double> normal(0., 1.);
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    int const nClustered = static_cast<int>(clustered * nPoints);
+    CloudT cloud(nPoints, 3);
+    for (int row = 0; row != nPoints; ++row) {
+        if (row < nClustered) {
+            // Uniform on the cap z >= 0.98, area is proportional to height on a sphere
+            double const z     = 1. - 0.02 * uniform(rng);
+            double const angle = 2. * std::acos(-1.) * uniform(rng);
+            double const r     = std::sqrt(1. - z * z);
+            cloud.row(row) << r * std::cos(angle), r * std::sin(angle), z;
+        } else {
+            Eigen::RowVector3d const point(normal(rng), normal(rng), normal(rng));
+            cloud.row(row) = point.normalized();
+        }
+    }
+    return cloud;
+} //...sampleSphere()
+
+/** \brief Queries the \ref K nearest neighbours of every indexed point in parallel.
+ *
+ * \tparam _IndexT Concept: acq::KdTreeT or acq::VoxelGridT.
+ *
+ * \return Seconds taken.
+ */
+template <typename _IndexT>
+double timeKnn(_IndexT const& index, unsigned nThreads) {
+    typedef typename _IndexT::Scalar Scalar;
+    std::size_t const n = index.getPoints().size();
+    std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+    parallelChunks(n, getChunkCount(n, nThreads, 1024), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        std::vector<std::size_t> indices (K);
+        std::vector<Scalar>      distsSqr(K);
+        for (std::size_t i = begin; i != end; ++i)
+            index.knnSearch(index.getPoints().point(i), K, indices.data(), distsSqr.data());
+    });
+    return getSeconds(start);
+} //...timeKnn()
+
+/** \brief Prints build and query time of a spatial index on \p cloud, as a table row. */
+template <typename _IndexT, typename _BuildT>
+void benchmarkIndex(std::string const& name, std::string const& cloudName, CloudT const& cloud,
+                    unsigned nThreads, _BuildT const& build) {
+    std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+    std::unique_ptr<_IndexT const> const index(build(cloud));
+    double const buildSeconds = getSeconds(start);
+    double const knnSeconds   = timeKnn(*index, nThreads);
+    std::cout << cloudName << "\t" << cloud.rows() << "\t" << name << "\t"
+              << buildSeconds << "\t" << knnSeconds << "\n";
+} //...benchmarkIndex()
+
+/** \brief Compares the voxel grid with the kd-tree backends over clouds of increasing density. */
+void benchmarkBackends(int nPoints, unsigned nThreads) {
+    std::cout << "# kNN (k = " << K << ") of all points, seconds\n"
+              << "cloud\tpoints\tindex\tbuild\tknn\n";
+
+    std::vector<std::pair<std::string, CloudT> > clouds;
+    for (int divisor : { 64, 8, 1 })
+        clouds.emplace_back("sphere", sampleSphere(nPoints / divisor, 0.));
+    clouds.emplace_back("uneven", sampleSphere(nPoints, 0.9));
+
+    for (std::pair<std::string, CloudT> const& cloud : clouds) {
+        benchmarkIndex<KdTree>("nanoflann", cloud.first, cloud.second, nThreads, [](CloudT const& points) {
+            return new KdTree(points, 10, KdTree::NANOFLANN);
+        });
+        benchmarkIndex<KdTree>("kdtree_simd", cloud.first, cloud.second, nThreads, [](CloudT const& points) {
+            return new KdTree(points, 10, KdTree::SOA_SIMD);
+        });
+        benchmarkIndex<VoxelGrid>("voxelgrid", cloud.first, cloud.second, nThreads, [nThreads](CloudT const& points) {
+            return new VoxelGrid(points, 0., nThreads);
+        });
+    }
+} //...benchmarkBackends()
+
+/** \brief Prints kNN and normal estimation time and memory of one precision, as a table row. */
+template <typename _Scalar>
+void benchmarkScalar(std::string const& name, CloudT const& cloud, unsigned nThreads) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    KdTreeT<_Scalar> const tree(cloud);
+    double const buildSeconds = getSeconds(start);
+
+    KnnIndicesT                           neighbours;
+    typename KdTreeT<_Scalar>::KnnDistsT  distsSqr;
+    start = std::chrono::steady_clock::now();
+    calculateCloudNeighbours(tree, K, neighbours, distsSqr,
+                             std::sqrt(std::numeric_limits<float>::max()) - 1.f, nThreads);
+    double const knnSeconds = getSeconds(start);
+
+    start = std::chrono::steady_clock::now();
+    Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic> const normals =
+        calculateCloudNormals(tree.getPoints(), neighbours, nThreads);
+    double const normalsSeconds = getSeconds(start);
+
+    std::size_t const pointBytes  = tree.getPoints().getMemoryFootprint();
+    std::size_t const distBytes   = distsSqr.size() * sizeof(_Scalar);
+    std::size_t const normalBytes = normals.size()  * sizeof(_Scalar);
+    std::cout << name << "\t" << cloud.rows() << "\t" << buildSeconds << "\t" << knnSeconds << "\t"
+              << normalsSeconds << "\t" << pointBytes / 1e6 << "\t" << distBytes / 1e6 << "\t"
+              << normalBytes / 1e6 << "\n";
+} //...benchmarkScalar()
+
+/** \brief Compares float with double storage for the dense kNN and normal estimation. */
+void benchmarkPrecision(int nPoints, unsigned nThreads) {
+    std::cout << "# Kd-tree kNN (k = " << K << ") and normals of all points, seconds and MB\n"
+              << "scalar\tpoints\tbuild\tknn\tnormals\tpointsMB\tdistsMB\tnormalsMB\n";
+    CloudT const cloud = sampleSphere(nPoints, 0.);
+    benchmarkScalar<float >("float",  cloud, nThreads);
+    benchmarkScalar<double>("double", cloud, nThreads);
+} //...benchmarkPrecision()
+
+} //...ns anonymous
+
+} //...ns acq
+
+/** \brief Times the neighbour search backends, and float against double precision.
+ *
+ * Usage: benchmarkNeighbours [points (default 1048576)] [threads (default 0: hardware concurrency)]
+ */
+int main(int argc, char *argv[]) {
+    int      const nPoints  = argc > 1 ? std::atoi(argv[1]) : 1 << 20;
+    unsigned const nThreads = argc > 2 ? static_cast<unsigned>(std::atoi(argv[2])) : 0u;
+    if (nPoints < 64) {
+        std::cerr << "Usage: benchmarkNeighbours [points >= 64] [threads]\n";
+        return EXIT_FAILURE;
+    }
+
+    acq::benchmarkBackends(nPoints, nThreads);
+    std::cout << "\n";
+    acq::benchmarkPrecision(nPoints, nThreads);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+//
+// Created by bontius on 02/02/17.
+//
+
+#ifndef ACQ_CHANNEL_H
+#define ACQ_CHANNEL_H
+
+#include "Eigen/Core"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace acq {
+
+//! Identifies a state of a channel's contents, see \ref Channel::generation.
+typedef std::uint64_t GenerationT;
+
+//! Bytes of memory buffers keyed by their address, so buffers with several holders are counted once.
+typedef std::unordered_map<void const*, std::size_t> BufferSizesT;
+
+/** \brief Returns a process-wide unique, increasing generation id. */
+inline GenerationT nextGeneration() {
+    static std::atomic<GenerationT> counter(0);
+    return ++counter;
+} //...nextGeneration()
+
+/** \brief Storage of one per-point attribute matrix (points, normals, faces) of a cloud.
+ *
+ * A channel either owns its matrix, or is a read-only view of memory owned by
+ * somebody else (see \ref wrap). Reading always goes through \ref view, which
+ * never copies. Requesting write access to a view copies the external buffer
+ * into owned storage first, so the external memory is never modified.
+ *
+ * Owned matrices are reference-counted and copy-on-write: copying a channel
+ * (and hence a DecoratedCloud) only copies a pointer, the matrix is
+ * duplicated by \ref data when a shared channel is about to be written.
+ * Do not hold on to the reference returned by \ref data across copies of the channel.
+ *
+ * Every modification (or write access) assigns a new \ref generation, which
+ * lets data derived from the channel detect that it became stale.
+ *
+ * \tparam _MatrixT Concept: Eigen::Matrix<> with column-major storage, e.g. acq::CloudT.
+ */
+template <typename _MatrixT>
+class Channel {
+public:
+    //! Owned matrix type.
+    typedef _MatrixT                      MatrixT;
+    //! Element type.
+    typedef typename MatrixT::Scalar      Scalar;
+    //! Row and column index type.
+    typedef typename MatrixT::Index       Index;
+    //! Read-only, copy-free view type.
+    typedef Eigen::Map<MatrixT const>     ConstMapT;
+
+    /** \brief Default constructor creating an empty, owning channel. */
+    Channel() : _external(nullptr), _rows(0), _cols(0), _generation(0) {}
+
+    /** \brief Constructor copying \p data into owned storage. */
+    explicit Channel(MatrixT const& data)
+        : _data(std::make_shared<MatrixT>(data)), _external(nullptr), _rows(0), _cols(0),
+          _generation(nextGeneration()) {}
+
+    /** \brief Constructor taking over the storage of \p data without copying. */
+    explicit Channel(MatrixT&& data)
+        : _data(std::make_shared<MatrixT>(std::move(data))), _external(nullptr), _rows(0), _cols(0),
+          _generation(nextGeneration()) {}
+
+    /** \brief Copy \p data into owned storage, dropping any external view. */
+    void set(MatrixT const& data) { _data = std::make_shared<MatrixT>(data); unwrap(); touch(); }
+
+    /** \brief Take over the storage of \p data, dropping any external view. */
+    void set(MatrixT&& data) { _data = std::make_shared<MatrixT>(std::move(data)); unwrap(); touch(); }
+
+    /** \brief Share the immutable matrix \p data (e.g. from a cache), it is copied before the first write. */
+    void share(std::shared_ptr<MatrixT const> const& data) {
+        // Safe, data() only writes to a matrix nobody else references
+        _data = std::const_pointer_cast<MatrixT>(data);
+        unwrap();
+        touch();
+    }
+
+    /** \brief Reference the external buffer of \p data without copying.
+     *
+     * The memory behind \p data must stay valid as long as this channel,
+     * or any copy of it, is reading it.
+     */
+    void wrap(ConstMapT const& data) {
+        _data.reset();
+        _external = data.size() ? data.data() : nullptr;
+        _rows     = data.rows();
+        _cols     = data.cols();
+        touch();
+    }
+
+    /** \brief Read-only view of the channel, pointing either to owned or to external memory. */
+    ConstMapT view() const {
+        if (isView())
+            return ConstMapT(_external, _rows, _cols);
+        else if (_data)
+            return ConstMapT(_data->data(), _data->rows(), _data->cols());
+        else // vectors keep their fixed dimension even when empty
+            return ConstMapT(nullptr, MatrixT::RowsAtCompileTime == 1 ? 1 : 0,
+                                      MatrixT::ColsAtCompileTime == 1 ? 1 : 0);
+    }
+
+    /** \brief Writable matrix exclusively owned by this channel.
+     *
+     * Copies an external buffer, or a matrix shared with other channels,
+     * into private storage first (copy-on-write).
+     */
+    MatrixT& data() {
+        if (isView()) {
+            _data = std::make_shared<MatrixT>(view());
+            unwrap();
+        } else if (!_data) {
+            _data = std::make_shared<MatrixT>();
+        } else if (_data.use_count() > 1) {
+            _data = std::make_shared<MatrixT>(*_data);
+        }
+        // Caller may write
+        touch();
+        return *_data;
+    }
+
+    /** \brief Move the matrix out of the channel leaving the channel empty. */
+    MatrixT release() {
+        MatrixT out(std::move(data()));
+        _data.reset();
+        return out;
+    }
+
+    /** \brief Identifier of the current contents, changes on every modification, kept by copies. */
+    GenerationT generation() const { return _generation; }
+
+    /** \brief Check, if the channel references external memory. */
+    bool isView() const { return _external != nullptr; }
+
+    /** \brief Check, if the owned matrix is referenced by other channels as well. */
+    bool isShared() const { return _data && _data.use_count() > 1; }
+
+    /** \brief Check, if this channel and \p other read the very same memory. */
+    bool sharesStorageWith(Channel const& other) const {
+        return size() && view().data() == other.view().data();
+    }
+
+    /** \brief Number of rows (points, normals or faces). */
+    Index rows() const { return isView() ? _rows : (_data ? _data->rows() : 0); }
+
+    /** \brief Number of stored coefficients. */
+    Index size() const { return isView() ? _rows * _cols : (_data ? _data->size() : 0); }
+
+    /** \brief Bytes of memory owned (possibly shared, but not wrapped) by the channel. */
+    std::size_t ownedBytes() const { return isView() ? 0 : static_cast<std::size_t>(size()) * sizeof(Scalar); }
+
+    /** \brief Adds the owned matrix to \p buffers, keyed by its storage, so copies sharing it add it once. */
+    void collectBuffers(BufferSizesT& buffers) const {
+        if (!isView() && _data && _data->size())
+            buffers[_data.get()] = ownedBytes();
+    }
+
+protected:
+    /** \brief Forget the external buffer. */
+    void unwrap() { _external = nullptr; _rows = _cols = 0; }
+
+    /** \brief Mark contents modified. */
+    void touch() { _generation = nextGeneration(); }
+
+    std::shared_ptr<MatrixT> _data;       //!< Owned, possibly shared storage, null while in view mode.
+    Scalar const*            _external;   //!< External buffer in view mode, nullptr otherwise.
+    Index                    _rows;       //!< Row count of \ref _external.
+    Index                    _cols;       //!< Column count of \ref _external.
+    GenerationT              _generation; //!< Changes on every modification, see \ref generation.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...class Channel
+
+} //...ns acq
+
+#endif //ACQ_CHANNEL_H
@@ -0,0 +1,44 @@
+//
+// Created by bontius on 08/02/17.
+//
+
+#ifndef ACQ_CLOUDIO_H
+#define ACQ_CLOUDIO_H
+
+#include "acq/decoratedCloud.h"
+
+#include <string>
+
+namespace acq {
+
+/** \brief Writes points, faces, normals, original order with its point count, labels
+ *         and sensor grid size of \p cloud to a raw binary file.
+ *
+ * The format is private to acq (e.g. for caching, see CloudManager),
+ * not meant for exchange between machines.
+ *
+ * \param[in] path  Output file path, overwritten if exists.
+ * \param[in] cloud Cloud to store.
+ *
+ * \return True on success.
+ */
+bool
+writeCloudBinary(
+    std::string    const& path,
+    DecoratedCloud const& cloud);
+
+/** \brief Reads a cloud written by \ref writeCloudBinary.
+ *
+ * \param[in ] path  Input file path.
+ * \param[out] cloud Receives points, faces and normals, left untouched on failure.
+ *
+ * \return True on success.
+ */
+bool
+readCloudBinary(
+    std::string    const& path,
+    DecoratedCloud      & cloud);
+
+} //...ns acq
+
+#endif //ACQ_CLOUDIO_H
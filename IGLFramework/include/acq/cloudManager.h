@@ -6,27 +6,227 @@
 #define ACQ_CLOUDMANAGER_H
 
 #include "acq/decoratedCloud.h"
-#include <vector>
+#include "acq/registration.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
 
 namespace acq {
 
-/** \brief Small class to keep track of multiple point clouds. */
+class ThreadPool;
+
+/** \brief Small class to keep track of multiple point clouds.
+ *
+ * All methods are safe to call from multiple threads. Reads share a lock,
+ * writes take it exclusively. Every write to a cloud increments its version,
+ * which lets background work detect that its input changed in the meantime
+ * (see \ref Handle, \ref commitCloud and \ref submitJob).
+ *
+ * The reference returning \ref getCloud methods are kept for single threaded
+ * (GUI) use: the reference itself stays valid when clouds are added, but
+ * reading or writing through it is not synchronized with other threads.
+ * Background code should work on \ref getSnapshot copies, which are cheap,
+ * since \ref DecoratedCloud channels are copy-on-write.
+ *
+ * With a memory budget set (\ref setMemoryBudget), the least recently used
+ * clouds are spilled to binary files in the cache directory whenever the
+ * resident clouds exceed the budget, and read back transparently on their
+ * next access. References obtained from \ref getCloud and \ref emplaceCloud
+ * pin their cloud in memory, pinned clouds are never spilled. Hand each
+ * reference back by \ref releaseCloud when done with it.
+ */
 class CloudManager {
 public:
+    //! Version counter type, incremented on every write to a cloud.
+    typedef std::uint64_t VersionT;
+
+    /** \brief Versioned reference to a cloud at a point in time. */
+    struct Handle {
+        int      index;   //!< Index of the cloud in the manager.
+        VersionT version; //!< Version of the cloud when the handle was taken.
+    };
+
+    /** \brief Operation run by \ref submitJob on a private copy of a cloud. */
+    typedef std::function<void(DecoratedCloud&)> JobT;
+
+    /** \brief Default constructor, worker threads are only started by the first \ref submitJob. */
+    CloudManager();
+
+    /** \brief Waits for all running jobs to finish. */
+    ~CloudManager();
+
     /** \brief Append a cloud to the list of clouds. */
     void addCloud(DecoratedCloud const& cloud);
 
+    /** \brief Append a cloud to the list of clouds, taking over its storage. */
+    void addCloud(DecoratedCloud&& cloud);
+
+    /** \brief Construct a cloud in place at the end of the list of clouds.
+     *
+     * \param[in] args Forwarded to a constructor of \ref DecoratedCloud,
+     *                 pass rvalues (std::move) to avoid copying the matrices.
+     *
+     * \return Reference to the stored cloud, pinned until \ref releaseCloud.
+     */
+    template <typename... _ArgsT>
+    DecoratedCloud& emplaceCloud(_ArgsT&&... args);
+
     /** \brief Overwrite a cloud at a specific index. */
     void setCloud(DecoratedCloud const& cloud, int index);
 
-    /** \brief Get cloud with specific index. */
+    /** \brief Overwrite a cloud at a specific index, taking over its storage. */
+    void setCloud(DecoratedCloud&& cloud, int index);
+
+    /** \brief Get cloud with specific index, counts as a write (increments the version).
+     *         The cloud stays in memory until the reference is released by \ref releaseCloud. */
     DecoratedCloud& getCloud(int index);
 
-    /** \brief Get cloud with specific index (const version). */
+    /** \brief Get cloud with specific index (const version), pinned until \ref releaseCloud. */
     DecoratedCloud const& getCloud(int index) const;
 
+    /** \brief Unpin the cloud at \p index, once per reference obtained from \ref getCloud or \ref emplaceCloud.
+     *         The reference may not be used afterwards, as the cloud may be spilled. */
+    void releaseCloud(int index) const;
+
+    /** \brief Number of clouds stored. */
+    int getCloudCount() const;
+
+    /** \brief Current version of the cloud at \p index. */
+    VersionT getVersion(int index) const;
+
+    /** \brief Versioned handle to the current state of the cloud at \p index. */
+    Handle getHandle(int index) const;
+
+    /** \brief Copy of the cloud at \p index sharing all matrices with the stored one.
+     *
+     * \param[in ] index  Index of cloud to copy.
+     * \param[out] handle Optional, receives the version the copy was taken at.
+     */
+    DecoratedCloud getSnapshot(int index, Handle* handle = nullptr) const;
+
+    /** \brief Atomically replace the cloud \p handle refers to, if it was not modified since.
+     *
+     * \param[in] handle Handle obtained together with the snapshot \p cloud was derived from.
+     * \param[in] cloud  New contents of the cloud.
+     *
+     * \return True, if stored, false, if the cloud changed after \p handle was taken.
+     */
+    bool commitCloud(Handle const& handle, DecoratedCloud&& cloud);
+
+    /** \brief Run \p job in the background on a snapshot of the cloud at \p index,
+     *         and commit the result, if the cloud was not modified meanwhile.
+     *
+     * \param[in] index Index of cloud to work on.
+     * \param[in] job   Operation modifying its argument in place, e.g. estimating normals.
+     *
+     * \return Future becoming true when the result was committed, false when it was discarded.
+     */
+    std::future<bool> submitJob(int index, JobT job);
+
+    /** \brief Rigidly aligns the cloud at \p sourceIndex to the cloud at \p targetIndex
+     *         by point-to-plane ICP (see \ref registerPointToPlane).
+     *
+     * The kd-tree of the target, and its estimated normals if it has none, are
+     * built on a snapshot without holding the lock, and handed to the cache of
+     * the stored target cloud, if it did not change meanwhile. They are reused
+     * by later registrations until the target changes.
+     * Neither cloud is modified.
+     *
+     * \param[in] sourceIndex Index of the cloud to move.
+     * \param[in] targetIndex Index of the cloud to align to.
+     * \param[in] initial     Initial guess of the transform.
+     * \param[in] params      Iterations, rejection and subsampling options.
+     *
+     * \return Transform taking the source to the target, with per-iteration residuals and timing.
+     */
+    IcpResult registerClouds(
+        int                    sourceIndex,
+        int                    targetIndex,
+        Eigen::Matrix4d const& initial = Eigen::Matrix4d::Identity(),
+        IcpParams       const& params  = IcpParams()) const;
+
+    /** \brief Limit the memory of resident clouds to \p bytes, 0 means unlimited (default). */
+    void setMemoryBudget(std::size_t bytes);
+
+    /** \brief Current memory budget in bytes, 0 if unlimited. */
+    std::size_t getMemoryBudget() const;
+
+    /** \brief Bytes of matrices and cached derived data held by resident (not spilled) clouds,
+     *         each buffer counted once. */
+    std::size_t getMemoryUsage() const;
+
+    /** \brief Directory to spill clouds to, defaults to the working directory. */
+    void setCacheDirectory(std::string const& directory);
+
+    /** \brief Check, if the cloud at \p index currently lives on disk. */
+    bool isSpilled(int index) const;
+
 protected:
-    std::vector<DecoratedCloud> _clouds; //!< List of clouds possibly with normals and faces.
+    /** \brief A stored cloud with its version. */
+    struct Entry {
+        Entry() : version(0), spilled(false), cachedVersion(0), lastUse(0), pins(0) {}
+        Entry(Entry&& other)
+            : cloud(std::move(other.cloud)), version(other.version), spilled(other.spilled),
+              cachePath(std::move(other.cachePath)), cachedVersion(other.cachedVersion),
+              lastUse(other.lastUse.load()), pins(other.pins.load()) {}
+
+        DecoratedCloud                     cloud;         //!< Stored cloud, empty while spilled.
+        VersionT                           version;       //!< Incremented on every write.
+        bool                               spilled;       //!< True, if \ref cloud lives in \ref cachePath.
+        std::string                        cachePath;     //!< Spill file, empty if never spilled.
+        VersionT                           cachedVersion; //!< Version of the cloud stored in \ref cachePath.
+        mutable std::atomic<std::uint64_t> lastUse;       //!< Access timestamp for LRU eviction.
+        mutable std::atomic<int>           pins;          //!< Outstanding references, never spilled while positive.
+
+        // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    }; //...struct Entry
+
+    /** \brief Make sure slot \p index exists, warns if empty clouds have to be created. Needs writer lock. */
+    void reserveSlot(int index);
+
+    /** \brief Entry at \p index, throws if no such entry. Needs reader lock. */
+    Entry& entryAt(int index) const;
+
+    /** \brief Mark \p entry as most recently used. Needs reader lock. */
+    void touch(Entry const& entry) const;
+
+    /** \brief Entry at \p index, read back from disk if spilled, and marked used. Needs writer lock. */
+    Entry& residentEntryAt(int index) const;
+
+    /** \brief Update bookkeeping after the cloud at \p index was replaced. Needs writer lock. */
+    void onWrite(int index);
+
+    /** \brief Bytes held by resident clouds, buffers shared between clouds counted once. Needs reader lock. */
+    std::size_t residentBytes() const;
+
+    /** \brief Spill least recently used clouds except \p keepIndex until within budget. Needs writer lock. */
+    void enforceBudget(int keepIndex) const;
+
+    /** \brief Write the cloud at \p index to its cache file and free it. Needs writer lock. */
+    bool spill(int index) const;
+
+    // Spilling and loading do not change the logical contents, hence mutable
+    mutable std::deque<Entry>          _clouds;    //!< List of clouds possibly with normals and faces.
+    mutable std::shared_timed_mutex    _mutex;     //!< Guards \ref _clouds, shared by readers, exclusive for writers.
+    mutable std::atomic<std::uint64_t> _clock;     //!< Source of \ref Entry::lastUse timestamps.
+    std::size_t                        _budget;    //!< Memory budget in bytes, 0 if unlimited.
+    std::string                        _cacheDir;  //!< Directory of spill files.
+    std::string                        _cacheTag;  //!< Random prefix of spill files of this manager.
+    std::once_flag                     _poolStart; //!< Starts \ref _workers once.
+    std::unique_ptr<ThreadPool>        _workers;   //!< Runs jobs, declared last to finish them before the clouds go.
+
+private:
+    CloudManager(CloudManager const&) = delete;
+    CloudManager& operator=(CloudManager const&) = delete;
 
 public:
     // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
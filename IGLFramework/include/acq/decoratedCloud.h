@@ -6,54 +6,294 @@
 #define ACQ_DECORATEDCLOUD_H
 
 #include "acq/typedefs.h"
+#include "acq/channel.h"
+#include "acq/derivedCache.h"
+#include "acq/features.h"
+#include "acq/kdTree.h"
+
+#include <memory>
+#include <vector>
 
 namespace acq {
 
-/** \brief Simple class to keep track of points normals and faces for a point cloud or mesh. */
+/** \brief Simple class to keep track of points normals and faces for a point cloud or mesh.
+ *
+ * Constructors and setters take their matrices by value or rvalue reference,
+ * so callers can hand over (std::move) freshly read data without copying it.
+ * The wrap* methods reference externally owned buffers instead ("view mode"),
+ * getters always return copy-free read-only views.
+ *
+ * Channels are copy-on-write (see \ref Channel): copies of a cloud, e.g.
+ * snapshots or variants with different normals, share all unchanged matrices,
+ * and a matrix is only duplicated when one of the copies writes to it.
+ *
+ * Derived data (kd-tree, neighbourhoods, estimated normals) is computed on
+ * first request and cached, keyed by its parameters. Cached items are
+ * recomputed automatically once the channel they depend on was modified.
+ */
 class DecoratedCloud {
 public:
     /** \brief Default constructor leaving fields empty. */
-    explicit DecoratedCloud() {}
+    explicit DecoratedCloud() : _gridWidth(0), _gridHeight(0), _nOriginal(0) {}
 
     /** \brief Constructor filling point information only. */
-    explicit DecoratedCloud(CloudT const& vertices);
+    explicit DecoratedCloud(CloudT vertices);
 
     /** \brief Constructor filling point and face information. */
-    explicit DecoratedCloud(CloudT const& vertices, FacesT const& faces);
+    explicit DecoratedCloud(CloudT vertices, FacesT faces);
 
     /** \brief Constructor filling point and normal information. */
-    explicit DecoratedCloud(CloudT const& vertices, NormalsT const& normals);
+    explicit DecoratedCloud(CloudT vertices, NormalsT normals);
 
     /** \brief Constructor filling point, face and normal information. */
-    explicit DecoratedCloud(CloudT const& vertices, FacesT const& faces, NormalsT const& normals);
+    explicit DecoratedCloud(CloudT vertices, FacesT faces, NormalsT normals);
 
     /** \brief Getter for point cloud. */
-    CloudT const& getVertices() const { return _vertices; }
+    CloudConstMapT getVertices() const { return _vertices.view(); }
     /** \brief Setter for point cloud. */
-    void setVertices(CloudT const& vertices) { _vertices = vertices; }
+    void setVertices(CloudT const& vertices) { _vertices.set(vertices); }
+    /** \brief Setter for point cloud, taking over the storage of \p vertices. */
+    void setVertices(CloudT&& vertices) { _vertices.set(std::move(vertices)); }
+    /** \brief Reference externally owned points without copying. */
+    void wrapVertices(CloudConstMapT const& vertices) { _vertices.wrap(vertices); }
     /** \brief Check, if any points stored. */
     bool hasVertices() const { return static_cast<bool>(_vertices.size()); }
 
     /** \brief Getter for face indices list. */
-    FacesT const& getFaces() const { return _faces; }
+    FacesConstMapT getFaces() const { return _faces.view(); }
     /** \brief Setter for face indices list. */
-    void setFaces(FacesT const& faces) { _faces = faces; }
+    void setFaces(FacesT const& faces) { _faces.set(faces); }
+    /** \brief Setter for face indices list, taking over the storage of \p faces. */
+    void setFaces(FacesT&& faces) { _faces.set(std::move(faces)); }
+    /** \brief Reference externally owned face indices without copying. */
+    void wrapFaces(FacesConstMapT const& faces) { _faces.wrap(faces); }
     /** \brief Check, if any faces stored. */
     bool hasFaces() const { return static_cast<bool>(_faces.size()); }
 
-    /** \brief Getter for normals. */
-    NormalsT      & getNormals() { return _normals; }
+    /** \brief Getter for normals, copies wrapped external normals to owned storage first. */
+    NormalsT      & getNormals() { return _normals.data(); }
     /** \brief Getter for normals (const version). */
-    NormalsT const& getNormals() const { return _normals; }
+    NormalsConstMapT getNormals() const { return _normals.view(); }
     /** \brief Setter for normals. */
-    void setNormals(NormalsT const& normals) { _normals = normals; }
+    void setNormals(NormalsT const& normals) { _normals.set(normals); }
+    /** \brief Setter for normals, taking over the storage of \p normals. */
+    void setNormals(NormalsT&& normals) { _normals.set(std::move(normals)); }
+    /** \brief Reference externally owned normals without copying. */
+    void wrapNormals(NormalsConstMapT const& normals) { _normals.wrap(normals); }
     /** \brief Check, if any normals stored. */
     bool hasNormals() const { return static_cast<bool>(_normals.size()); }
 
+    /** \brief Getter for point labels, e.g. from \ref detectPrimitives. */
+    LabelsConstMapT getLabels() const { return _labels.view(); }
+    /** \brief Setter for point labels, one per point, -1 for unlabelled points. */
+    void setLabels(LabelsT labels) { _labels.set(std::move(labels)); }
+    /** \brief Check, if any labels stored. */
+    bool hasLabels() const { return static_cast<bool>(_labels.size()); }
+
+    /** \brief Check, if points are stored in the same memory as the points of \p other. */
+    bool sharesVerticesWith(DecoratedCloud const& other) const { return _vertices.sharesStorageWith(other._vertices); }
+    /** \brief Check, if faces are stored in the same memory as the faces of \p other. */
+    bool sharesFacesWith(DecoratedCloud const& other) const { return _faces.sharesStorageWith(other._faces); }
+    /** \brief Check, if normals are stored in the same memory as the normals of \p other. */
+    bool sharesNormalsWith(DecoratedCloud const& other) const { return _normals.sharesStorageWith(other._normals); }
+
+    /** \brief Check, if any channel references external memory. */
+    bool isView() const { return _vertices.isView() || _faces.isView() || _normals.isView(); }
+
+    /** \brief Adds the owned channel matrices and cached derived data to \p buffers, keyed by their storage.
+     *
+     * Buffers shared with other clouds or between channel and cache have the same key, so a union over clouds
+     * counts each of them once.
+     */
+    void collectBuffers(BufferSizesT& buffers) const {
+        _vertices.collectBuffers(buffers);
+        _faces   .collectBuffers(buffers);
+        _normals .collectBuffers(buffers);
+        _order   .collectBuffers(buffers);
+        _labels  .collectBuffers(buffers);
+        _cache   .collectBuffers(buffers);
+    }
+
+    /** \brief Bytes of owned matrix memory and cached derived data, buffers shared with other clouds are included. */
+    std::size_t getMemoryFootprint() const {
+        BufferSizesT buffers;
+        collectBuffers(buffers);
+        std::size_t bytes = 0;
+        for (BufferSizesT::value_type const& buffer : buffers)
+            bytes += buffer.second;
+        return bytes;
+    }
+
+    /** \brief Mark the points as an organized cloud of a depth frame,
+     *         point i being the sample of pixel (i / \p width, i % \p width).
+     *
+     * Invalid pixels hold non-finite coordinates. Call with 0 x 0 to unmark.
+     */
+    void setGridSize(int width, int height) { _gridWidth = width; _gridHeight = height; }
+    /** \brief Number of pixel columns of the sensor grid, 0 if unorganized. */
+    int getGridWidth() const { return _gridWidth; }
+    /** \brief Number of pixel rows of the sensor grid, 0 if unorganized. */
+    int getGridHeight() const { return _gridHeight; }
+    /** \brief Check, if the points are organized in a sensor grid matching their count. */
+    bool isOrganized() const {
+        return _gridWidth > 0 && static_cast<Eigen::Index>(_gridWidth) * _gridHeight == _vertices.rows();
+    }
+
+    /** \brief Reorder points (and normals and labels), renumbering faces accordingly.
+     *
+     * Reordered points are no longer organized, the grid size is reset.
+     *
+     * \param[in] order Entry i is the current row of the point to move to row i.
+     */
+    void reorder(PermutationT const& order);
+
+    /** \brief Sort points along the Z-order curve (see \ref calculateMortonOrder),
+     *         so that points close in space are close in memory.
+     *
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     */
+    void reorderMorton(unsigned nThreads = 0);
+
+    /** \brief Drop the points not flagged in \p keep, with their normals, labels and the faces using them.
+     *
+     * Remaining points keep their relative order, faces are renumbered, the
+     * grid size is reset. \ref getOriginalOrder keeps the original row of each
+     * remaining point, \ref getOriginalPointCount the number of rows to restore to.
+     *
+     * \param[in] keep     N flags, nonzero to keep the point in that row,
+     *                     e.g. from \ref findStatisticalInliers or \ref findRadiusInliers.
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     *
+     * \return The number of points removed.
+     */
+    std::size_t keepPoints(std::vector<char> const& keep, unsigned nThreads = 0);
+
+    /** \brief Drop points far from their \p k nearest neighbours (see \ref findStatisticalInliers).
+     *
+     * \return The number of points removed.
+     */
+    std::size_t removeStatisticalOutliers(int k, double stdDevMul = 1., unsigned nThreads = 0, int maxLeafs = 10);
+
+    /** \brief Drop points with less than \p minNeighbours neighbours closer than \p radius
+     *         (see \ref findRadiusInliers).
+     *
+     * \return The number of points removed.
+     */
+    std::size_t removeRadiusOutliers(double radius, int minNeighbours, unsigned nThreads = 0, int maxLeafs = 10);
+
+    /** \brief Original row of each point, accumulated over all \ref reorder and \ref keepPoints calls,
+     *         empty if never reordered. Use with \ref restoreRows to map results back.
+     */
+    PermutationConstMapT getOriginalOrder() const { return _order.view(); }
+    /** \brief Setter for the original order, e.g. when reading a reordered cloud.
+     *
+     * \param[in] order         Original row of each point.
+     * \param[in] originalCount Number of points before any were removed, -1: no points removed.
+     */
+    void setOriginalOrder(PermutationT order, int originalCount = -1) {
+        _nOriginal = originalCount < 0 ? static_cast<int>(order.size()) : originalCount;
+        _order.set(std::move(order));
+    }
+    /** \brief Number of points before \ref keepPoints removed any, the row count of the original order. */
+    int getOriginalPointCount() const { return isReordered() ? _nOriginal : static_cast<int>(_vertices.rows()); }
+    /** \brief Check, if points were reordered. */
+    bool isReordered() const { return static_cast<bool>(_order.size()); }
+
+    /** \brief Kd-tree of the points, cached until the points change.
+     *
+     * \param[in] maxLeafs Maximum number of points in a leaf node.
+     */
+    std::shared_ptr<KdTree const> getKdTree(int maxLeafs = 10) const;
+
+    /** \brief Closest points of this cloud to the points of another cloud
+     *         (see \ref KdTreeT::batchKnnSearch), using the cached kd-tree.
+     *
+     * \param[in ] queries  M x 3 matrix containing query points in rows, e.g. \ref getVertices of another cloud.
+     * \param[in ] k        How many neighbours to look for.
+     * \param[out] indices  M x k, rows of this cloud closest to each query, closest first.
+     * \param[out] distsSqr M x k, squared distances of \p indices.
+     * \param[in ] maxLeafs Maximum number of points in a leaf node of the kd-tree.
+     */
+    void findNearestPoints(
+        CloudConstRefT   const& queries,
+        int                     k,
+        KnnIndicesT           & indices,
+        KdTree::KnnDistsT     & distsSqr,
+        int                     maxLeafs = 10) const;
+
+    /** \brief Neighbours of all points (see \ref calculateCloudNeighbours),
+     *         cached per parameter set until the points change.
+     */
+    std::shared_ptr<NeighboursT const> getNeighbours(int k, float maxDist, int maxLeafs = 10) const;
+
+    /** \brief Neighbours along face edges (see \ref calculateCloudNeighboursFromFaces),
+     *         cached until the faces change.
+     */
+    std::shared_ptr<NeighboursT const> getFaceNeighbours() const;
+
+    /** \brief Unoriented normals estimated from \ref getNeighbours (see \ref calculateCloudNormals),
+     *         cached per parameter set until the points change.
+     */
+    std::shared_ptr<NormalsT const> getEstimatedNormals(int k, float maxDist, int maxLeafs = 10) const;
+
+    /** \brief Replace normals by \ref getEstimatedNormals, sharing the cached matrix until written. */
+    void estimateNormals(int k, float maxDist, int maxLeafs = 10);
+
+    /** \brief Neighbours of all points from pixel windows of an organized cloud
+     *         (see \ref calculateOrganizedNeighbours), cached per parameter set until the points change.
+     */
+    std::shared_ptr<KnnIndicesT const> getWindowNeighbours(int windowRadius, float maxDist) const;
+
+    /** \brief Unoriented normals of an organized cloud from integral images
+     *         (see \ref calculateOrganizedNormals), cached per window size until the points change.
+     */
+    std::shared_ptr<NormalsT const> getOrganizedNormals(int windowRadius) const;
+
+    /** \brief Replace normals by \ref getOrganizedNormals, sharing the cached matrix until written. */
+    void estimateOrganizedNormals(int windowRadius);
+
+    /** \brief Fast point feature histograms (see \ref calculateFpfhFeatures) from the \p k nearest neighbours,
+     *         cached per parameter set until the points or normals change.
+     *
+     * Uses the normals of the cloud, or normals estimated from the same neighbours if it has none.
+     *
+     * \param[in] k        How many neighbours to describe a point by, the point itself excluded.
+     * \param[in] maxLeafs Maximum number of points in a leaf node of the kd-tree.
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     */
+    std::shared_ptr<FeaturesT const> getFpfhFeatures(int k, int maxLeafs = 10, unsigned nThreads = 0) const;
+
+    /** \brief Drop all cached derived data. */
+    void clearDerivedCache() { _cache.clear(); }
+
+    /** \brief Take over derived data cached by \p other, a copy of this cloud, that this cloud lacks.
+     *
+     * Items carry the generation of the channels they were derived from,
+     * so items derived from data this cloud does not hold are never found.
+     */
+    void adoptDerivedCache(DecoratedCloud const& other) { _cache.merge(other._cache); }
+
 protected:
-    CloudT   _vertices; //!< Point cloud, N x 3 matrix where N is the number of points.
-    FacesT   _faces;    //!< Faces stored as rows of vertex indices (referring to \ref _vertices).
-    NormalsT _normals;  //!< Per-vertex normals, associated with \ref _vertices by row ID.
+    Channel<CloudT>       _vertices;   //!< Point cloud, N x 3 matrix where N is the number of points.
+    Channel<FacesT>       _faces;      //!< Faces stored as rows of vertex indices (referring to \ref _vertices).
+    Channel<NormalsT>     _normals;    //!< Per-vertex normals, associated with \ref _vertices by row ID.
+    Channel<PermutationT> _order;      //!< Original row of each point, empty if never reordered.
+    Channel<LabelsT>      _labels;     //!< Per-vertex labels, associated with \ref _vertices by row ID.
+    int                   _gridWidth;  //!< Pixel columns of the sensor grid, 0 if unorganized.
+    int                   _gridHeight; //!< Pixel rows of the sensor grid, 0 if unorganized.
+    int                   _nOriginal;  //!< Points before any were removed, valid if reordered.
+    mutable DerivedCache  _cache;      //!< Data derived from the channels.
+
+    /** \brief Kinds of derived data in \ref _cache. */
+    enum DerivedKind {
+        KD_TREE = 0,       //!< KdTree of \ref _vertices.
+        NEIGHBOURS,        //!< kNN of \ref _vertices.
+        FACE_NEIGHBOURS,   //!< Edge neighbourhood from \ref _faces.
+        NORMALS,           //!< Estimated from \ref _vertices.
+        WINDOW_NEIGHBOURS, //!< Pixel windows of organized \ref _vertices.
+        ORGANIZED_NORMALS, //!< Integral image normals of organized \ref _vertices.
+        FPFH_FEATURES      //!< Descriptors of \ref _vertices and \ref _normals.
+    };
 
 public:
     // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
@@ -0,0 +1,100 @@
+//
+// Created by bontius on 10/02/17.
+//
+
+#ifndef ACQ_DERIVEDCACHE_H
+#define ACQ_DERIVEDCACHE_H
+
+#include "acq/channel.h" // GenerationT
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace acq {
+
+/** \brief Thread-safe store of data derived from the channels of a cloud
+ *         (kd-trees, neighbourhoods, estimated normals...).
+ *
+ * Items are keyed by their kind and parameters, and tagged with the
+ * generation of the channel they were computed from. A lookup with a
+ * different generation misses, and storing a new generation of a kind drops
+ * all stale items of that kind. A copy of a cache starts out with the same,
+ * shared items, and is independent of the original afterwards.
+ */
+class DerivedCache {
+public:
+    //! Kind of item and its parameters: { kind, k, maxDist, maxLeafs }.
+    typedef std::tuple<int, int, float, int> KeyT;
+
+    /** \brief Default constructor creating an empty cache. */
+    DerivedCache() {}
+
+    /** \brief Copy constructor sharing the items of \p other. */
+    DerivedCache(DerivedCache const& other);
+
+    /** \brief Move constructor taking over the items of \p other. */
+    DerivedCache(DerivedCache&& other);
+
+    /** \brief Assignment sharing the items of \p other. */
+    DerivedCache& operator=(DerivedCache const& other);
+
+    /** \brief Assignment taking over the items of \p other. */
+    DerivedCache& operator=(DerivedCache&& other);
+
+    /** \brief Look up an item.
+     *
+     * \tparam _ValueT Type the item was stored with.
+     *
+     * \param[in] key        Kind and parameters of the item.
+     * \param[in] generation Generation of the channel the item has to be derived from.
+     *
+     * \return The item, or null, if not cached or stale.
+     */
+    template <typename _ValueT>
+    std::shared_ptr<_ValueT const>
+    find(KeyT const& key, GenerationT generation) const;
+
+    /** \brief Store an item, replacing stale items of the same kind.
+     *
+     * \param[in] key        Kind and parameters of the item.
+     * \param[in] generation Generation of the channel the item was derived from.
+     * \param[in] value      Item to store.
+     * \param[in] bytes      Estimated memory held by \p value, see \ref collectBuffers.
+     */
+    template <typename _ValueT>
+    void
+    store(KeyT const& key, GenerationT generation, std::shared_ptr<_ValueT const> const& value,
+          std::size_t bytes = 0);
+
+    /** \brief Adopt the items of \p other this cache lacks, e.g. computed on a copy of the cloud.
+     *
+     * Items of a kind this cache holds from a newer generation are skipped, and
+     * held items of a kind \p other has newer ones of are dropped, as by \ref store.
+     * Adopted items are shared with \p other.
+     */
+    void merge(DerivedCache const& other);
+
+    /** \brief Drop all items. */
+    void clear();
+
+    /** \brief Adds the items to \p buffers keyed by their address, so items shared by copies of the cache add once. */
+    void collectBuffers(BufferSizesT& buffers) const;
+
+protected:
+    /** \brief A stored item with the generation it was derived from. */
+    struct Item {
+        GenerationT                 generation; //!< Generation of the source channel.
+        std::shared_ptr<void const> value;      //!< Type-erased item.
+        std::size_t                 bytes;      //!< Estimated memory held by \ref value.
+    };
+
+    std::map<KeyT, Item> _items; //!< Stored items.
+    mutable std::mutex   _mutex; //!< Guards \ref _items.
+}; //...class DerivedCache
+
+} //...ns acq
+
+#endif //ACQ_DERIVEDCACHE_H
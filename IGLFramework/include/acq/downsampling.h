@@ -0,0 +1,40 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#ifndef ACQ_DOWNSAMPLING_H
+#define ACQ_DOWNSAMPLING_H
+
+#include "acq/typedefs.h"
+#include "acq/decoratedCloud.h"
+
+namespace acq {
+
+/** \brief Reduces a cloud to one point per occupied cell of a uniform grid.
+ *
+ * Points are binned by the Z-order code (see \ref calculateMortonCode) of
+ * their cell, radix sorted by it (see \ref sortKeys), and every run of equal
+ * codes is averaged into one point, its normals aligned to the first normal
+ * of the cell, summed and normalized. Sorting is stable, so each cell sums its
+ * points in their original order and the result does not depend on \p nThreads.
+ * Reduced points are in Z-order of their cells, so close in memory when close in space.
+ *
+ * Faces are dropped. Non-finite points are left out.
+ *
+ * \param[in ] cloud       Cloud to reduce, with or without normals.
+ * \param[in ] cellSize    Side length of the cells, the grid starts at the minimum corner of the cloud.
+ * \param[out] cellOfPoint N, row of the reduced point each point was merged into, -1 for non-finite points.
+ * \param[in ] nThreads    Threads to use, 0: hardware concurrency.
+ *
+ * \return One point per occupied cell, with averaged normals if \p cloud has normals.
+ */
+DecoratedCloud
+downsampleVoxelGrid(
+    DecoratedCloud  const& cloud,
+    double          const  cellSize,
+    Eigen::VectorXi      & cellOfPoint,
+    unsigned        const  nThreads = 0);
+
+} //...ns acq
+
+#endif //ACQ_DOWNSAMPLING_H
@@ -0,0 +1,145 @@
+//
+// Created by bontius on 16/02/17.
+//
+
+#ifndef ACQ_DYNAMICKDTREE_H
+#define ACQ_DYNAMICKDTREE_H
+
+#include "acq/typedefs.h"
+#include "acq/soaKdTree.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace acq {
+
+/** \brief Kd-tree forest accepting point insertions and removals between queries.
+ *
+ * Logarithmic method (Bentley and Saxe): new points collect in a small buffer
+ * scanned linearly, a full buffer is merged with the occupied smallest levels
+ * into the first level that fits, level i holding up to 2^i buffers of points
+ * in a static \ref SoaKdTreeT. Every point is rebuilt at most once per level,
+ * so an insertion costs amortized O(log N) tree builds of its point instead of
+ * rebuilding the whole index.
+ *
+ * Removed points are flagged and skipped by queries, a level is rebuilt
+ * without them once half of its points are removed.
+ *
+ * Points get consecutive ids in insertion order, ids are never reused.
+ *
+ * \tparam _Scalar Floating point type points are stored and compared in, float or double.
+ */
+template <typename _Scalar>
+class DynamicKdTreeT {
+public:
+    //! Floating point type
+    typedef _Scalar Scalar;
+    //! Point dimensions
+    enum { Dim = 3 };
+
+    /** \brief Empty index.
+     *
+     * \param[in] maxLeafs Maximum number of points in a leaf node of the level trees.
+     */
+    explicit DynamicKdTreeT(int maxLeafs = 10);
+
+    /** \brief Index of the rows of \p cloud, with ids 0..N-1. */
+    template <typename _Derived>
+    explicit DynamicKdTreeT(Eigen::MatrixBase<_Derived> const& cloud, int maxLeafs = 10)
+        : DynamicKdTreeT(maxLeafs) { insert(cloud); }
+
+    /** \brief Adds the rows of \p cloud, e.g. a new scan frame.
+     *
+     * \param[in] cloud N x 3 matrix containing points in rows, of any floating point type.
+     *
+     * \return Id of the first added point, the others follow consecutively.
+     */
+    template <typename _Derived>
+    std::size_t insert(Eigen::MatrixBase<_Derived> const& cloud) {
+        std::size_t const firstId = _removed.size();
+        for (int row = 0; row != cloud.rows(); ++row)
+            for (int d = 0; d != Dim; ++d)
+                _coords.push_back(static_cast<Scalar>(cloud(row, d)));
+        addIds(firstId, cloud.rows());
+        return firstId;
+    } //...insert()
+
+    /** \brief Removes point \p id from the index.
+     *
+     * \return False, if \p id is unknown or was already removed.
+     */
+    bool remove(std::size_t id);
+
+    /** \brief Find the \p k nearest neighbours of \p query among the points not removed.
+     *
+     * \param[in ] query     Pointer to 3 contiguous coordinates.
+     * \param[in ] k         How many neighbours to look for.
+     * \param[out] indices   At least \p k long, receives ids of neighbours, closest first.
+     * \param[out] distsSqr  At least \p k long, receives squared distances of neighbours.
+     *
+     * \return The number of neighbours found, less than \p k only for small clouds.
+     */
+    std::size_t
+    knnSearch(
+        Scalar const* query,
+        int           k,
+        std::size_t * indices,
+        Scalar      * distsSqr) const;
+
+    /** \brief Coordinates of point \p id, removed points keep theirs. */
+    Scalar const* point(std::size_t id) const { return _coords.data() + Dim * id; }
+
+    /** \brief True, if point \p id was removed. */
+    bool isRemoved(std::size_t id) const { return _removed[id]; }
+
+    /** \brief Number of ids handed out, removed points included. */
+    std::size_t getIdCount() const { return _removed.size(); }
+
+    /** \brief Number of points indexed, removed points excluded. */
+    int size() const { return static_cast<int>(_size); }
+
+    /** \brief Number of static trees currently built. */
+    int getTreeCount() const;
+
+protected:
+    /** \brief A static tree and the ids of its points. */
+    struct Level {
+        Level() : nRemoved(0) {}
+
+        SoaKdTreeT<Scalar>       tree;     //!< Tree over the points, reporting their ids.
+        std::vector<std::size_t> ids;      //!< Ids of the points of the tree.
+        std::size_t              nRemoved; //!< Number of \ref ids removed since the build.
+    }; //...struct Level
+
+    /** \brief Registers \p count points from \p firstId in the buffer, merging, if it is full. */
+    void addIds(std::size_t firstId, std::size_t count);
+
+    /** \brief Moves the buffer and the occupied levels below the first one that fits into that level. */
+    void flushBuffer();
+
+    /** \brief Builds \p level on \p ids. */
+    void buildLevel(int level, std::vector<std::size_t>&& ids);
+
+    /** \brief Appends the ids of the points not removed from \p level to \p ids. */
+    void gatherLevel(int level, std::vector<std::size_t>& ids) const;
+
+    /** \brief Maximum number of points of \p level. */
+    std::size_t getLevelCapacity(int level) const;
+
+    std::vector<Scalar>      _coords;   //!< Coordinates of all points ever inserted, 3 per id.
+    std::vector<bool>        _removed;  //!< Removal flag of each id.
+    std::vector<int>         _levelOf;  //!< Level of each id, -1 in the buffer.
+    std::vector<std::size_t> _buffer;   //!< Ids of recently inserted points, scanned linearly.
+    std::vector<Level>       _levels;   //!< Static trees, level i holds up to 2^i buffers.
+    std::size_t              _size;     //!< Number of points not removed.
+    int                      _maxLeafs; //!< Leaf size of the level trees.
+}; //...class DynamicKdTreeT
+
+//! Double precision dynamic kd-tree, matching \ref CloudT.
+typedef DynamicKdTreeT<CloudT::Scalar> DynamicKdTree;
+//! Single precision dynamic kd-tree.
+typedef DynamicKdTreeT<float>          DynamicKdTreeF;
+
+} //...ns acq
+
+#endif //ACQ_DYNAMICKDTREE_H
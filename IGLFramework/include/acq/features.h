@@ -0,0 +1,86 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#ifndef ACQ_FEATURES_H
+#define ACQ_FEATURES_H
+
+#include "acq/typedefs.h"
+#include "acq/kdTree.h"
+
+#include <vector>
+
+namespace acq {
+
+/** \addtogroup Features
+ *  @{
+ *
+ * Fast point feature histograms (Rusu et al., "Fast Point Feature Histograms
+ * (FPFH) for 3D Registration"): the angles between the normal of a point and
+ * the normals of its neighbours, relative to the lines connecting them, are
+ * binned into three histograms. Each point first bins its own neighbours only
+ * (simplified features, SPFH), then adds the distance weighted simplified
+ * features of its neighbours, so every pair of points is looked at once.
+ */
+
+//! Bins per angle histogram.
+enum { FpfhBins = 11 };
+//! Length of a descriptor: the three angle histograms concatenated.
+enum { FpfhDim = 3 * FpfhBins };
+
+//! Descriptors of points in rows.
+typedef Eigen::Matrix<float, Eigen::Dynamic, FpfhDim, Eigen::RowMajor> FeaturesT;
+
+/** \brief Simplified point feature histograms of all points, from their neighbours only.
+ *
+ * \param[in] cloud      N x 3 matrix containing points in rows.
+ * \param[in] normals    N x 3 normals of \p cloud.
+ * \param[in] neighbours N x k neighbour ids, -1 entries are ignored, see \ref calculateCloudNeighbours.
+ * \param[in] nThreads   Threads to use, 0: hardware concurrency.
+ *
+ * \return N x \ref FpfhDim histograms, each of the three summing to 100, zero without neighbours.
+ */
+FeaturesT
+calculateSpfhFeatures(
+    CloudConstRefT   const& cloud,
+    NormalsConstRefT const& normals,
+    KnnIndicesT      const& neighbours,
+    unsigned         const  nThreads = 0);
+
+/** \brief Fast point feature histograms of all points.
+ *
+ * \param[in] cloud      N x 3 matrix containing points in rows.
+ * \param[in] normals    N x 3 normals of \p cloud.
+ * \param[in] neighbours N x k neighbour ids, -1 entries are ignored, see \ref calculateCloudNeighbours.
+ * \param[in] distsSqr   N x k squared distances of \p neighbours.
+ * \param[in] nThreads   Threads to use, 0: hardware concurrency.
+ *
+ * \return N x \ref FpfhDim descriptors.
+ */
+FeaturesT
+calculateFpfhFeatures(
+    CloudConstRefT    const& cloud,
+    NormalsConstRefT  const& normals,
+    KnnIndicesT       const& neighbours,
+    KdTree::KnnDistsT const& distsSqr,
+    unsigned          const  nThreads = 0);
+
+/** \brief Closest target descriptor of every source descriptor, looked up in a kd-tree over the target descriptors.
+ *
+ * \param[in] source   Descriptors to find partners for.
+ * \param[in] target   Descriptors to choose from.
+ * \param[in] nThreads Threads to use, 0: hardware concurrency.
+ *
+ * \return Row of \p target closest to each row of \p source, -1 if \p target is empty.
+ */
+std::vector<int>
+matchFeatures(
+    FeaturesT const& source,
+    FeaturesT const& target,
+    unsigned  const  nThreads = 0);
+
+/** @} (Features) */
+
+} //...ns acq
+
+#endif //ACQ_FEATURES_H
@@ -7,8 +7,20 @@
 
 #include "acq/cloudManager.h"
 
+#include <utility>
+
 namespace acq {
 
+template <typename... _ArgsT>
+DecoratedCloud& CloudManager::emplaceCloud(_ArgsT&&... args) {
+    std::unique_lock<std::shared_timed_mutex> lock(_mutex);
+    _clouds.emplace_back();
+    _clouds.back().cloud = DecoratedCloud(std::forward<_ArgsT>(args)...);
+    onWrite(static_cast<int>(_clouds.size()) - 1);
+    ++_clouds.back().pins;
+    return _clouds.back().cloud;
+} //...CloudManager::emplaceCloud()
+
 } //...ns acq
 
 #endif //ACQ_CLOUDMANAGER_HPP
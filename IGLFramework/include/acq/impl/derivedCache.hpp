@@ -0,0 +1,44 @@
+//
+// Created by bontius on 10/02/17.
+//
+
+#ifndef ACQ_DERIVEDCACHE_HPP
+#define ACQ_DERIVEDCACHE_HPP
+
+#include "acq/derivedCache.h"
+
+namespace acq {
+
+template <typename _ValueT>
+std::shared_ptr<_ValueT const>
+DerivedCache::find(KeyT const& key, GenerationT generation) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::map<KeyT, Item>::const_iterator const it = _items.find(key);
+    if (it == _items.end() || it->second.generation != generation)
+        return std::shared_ptr<_ValueT const>();
+    return std::static_pointer_cast<_ValueT const>(it->second.value);
+} //...DerivedCache::find()
+
+template <typename _ValueT>
+void
+DerivedCache::store(KeyT const& key, GenerationT generation, std::shared_ptr<_ValueT const> const& value,
+                    std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Drop items of the same kind derived from other generations
+    for (std::map<KeyT, Item>::iterator it = _items.begin(); it != _items.end(); ) {
+        if (std::get<0>(it->first) == std::get<0>(key) && it->second.generation != generation)
+            it = _items.erase(it);
+        else
+            ++it;
+    }
+
+    Item &item = _items[key];
+    item.generation = generation;
+    item.value      = value;
+    item.bytes      = bytes;
+} //...DerivedCache::store()
+
+} //...ns acq
+
+#endif //ACQ_DERIVEDCACHE_HPP
@@ -6,17 +6,23 @@
 #define ACQ_NORMALESTIMATION_HPP
 
 #include "acq/normalEstimation.h"
+#include "acq/parallel.h"
 
 #include "Eigen/Eigenvalues"        // SelfAdjointEigenSolver
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <queue>
+#include <set>
+#include <vector>
 
 namespace acq {
 
 template <typename _NeighbourIdListT>
 Eigen::Matrix <typename CloudT::Scalar, 3, 1>
 calculatePointNormal(
-    CloudT            const& cloud, // N x 3
+    CloudConstRefT    const& cloud, // N x 3
     int               const  pointIndex,
     _NeighbourIdListT const& neighbourIndices
 ) {
@@ -69,6 +75,452 @@ calculatePointNormal(
 
 } // calculatePointNormal()
 
+template <typename _Scalar, typename _NeighbourIdListT>
+Eigen::Matrix <_Scalar, 3, 1>
+calculatePointNormal(
+    PointStorageT<_Scalar> const& points,
+    int                    const  pointIndex,
+    _NeighbourIdListT      const& neighbourIndices
+) {
+    //! Accumulation type, double even for float storage
+    typedef double AccumT;
+    //! 3x3 matrix type
+    typedef Eigen::Matrix<AccumT, 3, 3> Matrix3;
+    //! 4x4 matrix type
+    typedef Eigen::Matrix<AccumT, 4, 4> Matrix4;
+
+    Matrix3 cov;
+    if (points.isPadded()) {
+        // Whole 4-wide points, the zero padding keeps the 4th row and column 0
+        Matrix4 cov4(Matrix4::Zero());
+        auto const point = points.getPaddedPoint(pointIndex);
+        for (auto const neighbourIndex : neighbourIndices) {
+            // Skip, if first neighbour is same point
+            if (pointIndex == static_cast<int>(neighbourIndex))
+                continue;
+            // Difference in storage precision (small, local), products in double
+            Eigen::Matrix<AccumT, 4, 1> const vToNeighbour =
+                (points.getPaddedPoint(neighbourIndex) - point).template cast<AccumT>();
+            cov4.noalias() += vToNeighbour * vToNeighbour.transpose();
+        } //...For neighbours
+        cov = cov4.template topLeftCorner<3, 3>();
+    } else {
+        cov.setZero();
+        auto const point = points.getPoint(pointIndex);
+        for (auto const neighbourIndex : neighbourIndices) {
+            // Skip, if first neighbour is same point
+            if (pointIndex == static_cast<int>(neighbourIndex))
+                continue;
+            Eigen::Matrix<AccumT, 3, 1> const vToNeighbour =
+                (points.getPoint(neighbourIndex) - point).template cast<AccumT>();
+            cov.noalias() += vToNeighbour * vToNeighbour.transpose();
+        } //...For neighbours
+    } //...if padded
+
+    // Solve for neighbourhood smallest eigen value,
+    // eigenvalues are sorted in increasing order
+    Eigen::SelfAdjointEigenSolver <Matrix3> es(cov);
+
+    // Return smallest eigen vector
+    return es.eigenvectors()
+             .col(0)
+             .normalized()
+             .template cast<_Scalar>();
+} // calculatePointNormal()
+
+namespace detail {
+
+/** \brief Neighbour lookup loop shared by the spatial indices.
+ *
+ * \tparam _IndexT     Concept: acq::KdTreeT or acq::VoxelGridT.
+ * \tparam _SearchArgs Trailing arguments of _IndexT::knnSearch, e.g. acq::KnnSearchParams.
+ */
+template <typename _IndexT, typename... _SearchArgs>
+NeighboursT
+calculateIndexNeighbours(
+    _IndexT     const&    cloudIndex,
+    int         const     k,
+    float       const     maxDist,
+    _SearchArgs const&... searchArgs
+) {
+    //! Floating point type of the index
+    typedef typename _IndexT::Scalar _Scalar;
+
+    // Indexed points, contiguous in memory
+    PointStorageT<_Scalar> const& points = cloudIndex.getPoints();
+
+    // Squared max distance
+    _Scalar const maxDistSqr = maxDist * maxDist;
+
+    // Neighbour indices
+    std::vector<size_t > neighbourIndices(k);
+    std::vector<_Scalar> distsSqr(k);
+
+    // Associative list of neighbours: { pointId => [neighbourId_0, nId_1, ... nId_k-1] }
+    NeighboursT neighbours;
+    // For each point, store normal
+    for (int pointId = 0; pointId != points.size(); ++pointId) {
+        // Find neighbours of point in "pointId"-th row
+        size_t const nFound =
+            cloudIndex.knnSearch(
+                /* Query point Scalar[3] pointer: */ points.point(pointId),
+                /*    How many neighbours to use: */ k,
+                /*             [out] Neighbour ids: */ &neighbourIndices[0],
+                /*   [out] Squared neighbour dists: */ &distsSqr[0],
+                /*     Index specific parameters: */ searchArgs...
+            );
+
+        // Filter neighbours by squared distance
+        NeighboursT::mapped_type currNeighbours;
+        for (size_t i = 0; i != nFound; ++i) {
+            // if not same point and close enough
+            if ((neighbourIndices[i] != static_cast<size_t>(pointId)) &&
+                (distsSqr        [i] <  maxDistSqr))
+                currNeighbours.insert(neighbourIndices[i]);
+        }
+
+        // Store list of neighbours
+        std::pair<NeighboursT::iterator, bool> const success =
+            neighbours.insert(
+                std::make_pair(
+                    pointId,
+                    currNeighbours
+                )
+            );
+
+        if (!success.second)
+            std::cerr << "Could not store neighbours of point " << pointId
+                      << ", already inserted?\n";
+
+    } //...for all points
+
+    // return estimated normals
+    return neighbours;
+} //...calculateIndexNeighbours()
+
+} //...ns detail
+
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    KdTreeT<_Scalar> const& cloudIndex,
+    int              const  k,
+    float            const  maxDist,
+    KnnSearchParams  const& searchParams
+) {
+    if (!searchParams.isExact() || k <= 0)
+        return detail::calculateIndexNeighbours(cloudIndex, k, maxDist, searchParams);
+
+    // Exact: all points are queries, answer them leaf by leaf
+    int const nPoints = cloudIndex.size();
+    std::vector<size_t > neighbourIndices(static_cast<size_t>(nPoints) * k);
+    std::vector<_Scalar> distsSqr        (static_cast<size_t>(nPoints) * k);
+    std::vector<size_t > counts          (nPoints);
+    cloudIndex.allKnnSearch(k, neighbourIndices.data(), distsSqr.data(), counts.data());
+
+    // Squared max distance
+    _Scalar const maxDistSqr = maxDist * maxDist;
+
+    // Associative list of neighbours: { pointId => [neighbourId_0, nId_1, ... nId_k-1] }
+    NeighboursT neighbours;
+    for (int pointId = 0; pointId != nPoints; ++pointId) {
+        size_t  const* const ids   = &neighbourIndices[static_cast<size_t>(pointId) * k];
+        _Scalar const* const dists = &distsSqr        [static_cast<size_t>(pointId) * k];
+
+        // Filter neighbours by squared distance, ids come sorted, so insert at the end
+        NeighboursT::mapped_type& currNeighbours =
+            neighbours.emplace_hint(neighbours.end(), pointId, NeighboursT::mapped_type())->second;
+        for (size_t i = 0; i != counts[pointId]; ++i) {
+            // if not same point and close enough
+            if ((ids[i] != static_cast<size_t>(pointId)) &&
+                (dists[i] < maxDistSqr))
+                currNeighbours.insert(ids[i]);
+        }
+    } //...for all points
+
+    return neighbours;
+} //...calculateCloudNeighbours()
+
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    VoxelGridT<_Scalar> const& cloudIndex,
+    int                 const  k,
+    float               const  maxDist
+) {
+    return detail::calculateIndexNeighbours(cloudIndex, k, maxDist);
+} //...calculateCloudNeighbours()
+
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    DynamicKdTreeT<_Scalar> const& cloudIndex,
+    int                     const  k,
+    float                   const  maxDist
+) {
+    // Squared max distance
+    _Scalar const maxDistSqr = maxDist * maxDist;
+
+    // Neighbour indices
+    std::vector<size_t > neighbourIndices(k);
+    std::vector<_Scalar> distsSqr(k);
+
+    // Associative list of neighbours: { pointId => [neighbourId_0, nId_1, ... nId_k-1] }
+    NeighboursT neighbours;
+    for (size_t pointId = 0; pointId != cloudIndex.getIdCount(); ++pointId) {
+        if (cloudIndex.isRemoved(pointId))
+            continue;
+
+        size_t const nFound =
+            cloudIndex.knnSearch(
+                /* Query point Scalar[3] pointer: */ cloudIndex.point(pointId),
+                /*    How many neighbours to use: */ k,
+                /*             [out] Neighbour ids: */ &neighbourIndices[0],
+                /*   [out] Squared neighbour dists: */ &distsSqr[0]
+            );
+
+        // Filter neighbours by squared distance, ids come sorted, so insert at the end
+        NeighboursT::mapped_type& currNeighbours =
+            neighbours.emplace_hint(neighbours.end(), pointId, NeighboursT::mapped_type())->second;
+        for (size_t i = 0; i != nFound; ++i) {
+            // if not same point and close enough
+            if ((neighbourIndices[i] != pointId   ) &&
+                (distsSqr        [i] <  maxDistSqr))
+                currNeighbours.insert(neighbourIndices[i]);
+        }
+    } //...for all points
+
+    return neighbours;
+} //...calculateCloudNeighbours()
+
+template <typename _Scalar>
+Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic>
+calculateCloudNormals(
+    PointStorageT<_Scalar> const& points,
+    NeighboursT            const& neighbours
+) {
+    // Output normals: N x 3
+    Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic> normals(points.size(), 3);
+
+    // For each point, store normal
+    for (int pointId = 0; pointId != points.size(); ++pointId) {
+        // Estimate vertex normal from neighbourhood indices and cloud
+        normals.row(pointId) =
+            calculatePointNormal(
+                /*        PointCloud: */ points,
+                /*      ID of vertex: */ pointId,
+                /* Ids of neighbours: */ neighbours.at(pointId)
+            );
+    } //...for all points
+
+    // Return estimated normals
+    return normals;
+} //...calculateCloudNormals()
+
+namespace detail {
+
+/** \brief Neighbour ids in a row of a \ref KnnIndicesT as a range,
+ *         of compile-time length, unless \p _K is Eigen::Dynamic.
+ */
+template <int _K>
+struct NeighbourRow {
+    NeighbourRow(int const* ids, int count) : ids(ids), count(count) {}
+
+    int const* begin() const { return ids; }
+    int const* end()   const { return ids + (_K == Eigen::Dynamic ? count : _K); }
+
+    int const* ids;   //!< First id.
+    int        count; //!< Number of ids, if _K is Eigen::Dynamic.
+}; //...struct NeighbourRow
+
+/** \brief Fills dense neighbour matrices from the self-join, \p _K is k or Eigen::Dynamic. */
+template <int _K, typename _Scalar>
+void
+fillNeighbourMatrix(
+    KdTreeT<_Scalar>                     const& cloudIndex,
+    int                                  const  k,
+    KnnIndicesT                               & neighbours,
+    typename KdTreeT<_Scalar>::KnnDistsT      & distsSqr,
+    float                                const  maxDist,
+    unsigned                             const  nThreads
+) {
+    //! Compile-time k, or -1
+    enum { K = _K };
+
+    _Scalar const maxDistSqr = maxDist * maxDist;
+    int     const cols       = K == Eigen::Dynamic ? k : K;
+    // Query one more, the point finds itself
+    cloudIndex.allKnnSearch(cols + 1,
+        [&neighbours, &distsSqr, maxDistSqr, cols](std::size_t pointId, std::size_t nFound,
+                                                   std::size_t const* ids, _Scalar const* dists) {
+            // Copy all but the point itself, until too far
+            int    * const rowIds   = neighbours.row(pointId).data();
+            _Scalar* const rowDists = distsSqr.row(pointId).data();
+            int col = 0;
+            for (std::size_t i = 0; i != nFound && col != cols; ++i) {
+                if (ids[i] == pointId)
+                    continue;
+                if (dists[i] >= maxDistSqr)
+                    break;
+                rowIds  [col] = static_cast<int>(ids[i]);
+                rowDists[col] = dists[i];
+                ++col;
+            }
+            for (; col != cols; ++col) {
+                rowIds  [col] = -1;
+                rowDists[col] = std::numeric_limits<_Scalar>::infinity();
+            }
+        },
+        nThreads);
+} //...fillNeighbourMatrix()
+
+/** \brief Estimates normals from a dense neighbour matrix, \p _K is its width or Eigen::Dynamic. */
+template <int _K, typename _Scalar>
+void
+fillNormals(
+    PointStorageT<_Scalar>                                 const& points,
+    KnnIndicesT                                            const& neighbours,
+    Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic>      & normals,
+    unsigned                                               const  nThreads
+) {
+    std::size_t const nPoints = points.size();
+    int         const k       = static_cast<int>(neighbours.cols());
+    parallelChunks(nPoints, getChunkCount(nPoints, nThreads, 1024),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (std::size_t pointId = begin; pointId != end; ++pointId) {
+                int const* const ids = neighbours.row(pointId).data();
+                if (!k || ids[k - 1] >= 0) {
+                    // Full row, length known at compile time for specialized k
+                    normals.row(pointId) = calculatePointNormal(points, pointId, NeighbourRow<_K>(ids, k));
+                } else {
+                    // Filtered neighbours are at the end
+                    int const count = static_cast<int>(std::find(ids, ids + k, -1) - ids);
+                    normals.row(pointId) = calculatePointNormal(points, pointId, NeighbourRow<Eigen::Dynamic>(ids, count));
+                }
+            } //...for points
+        }
+    );
+} //...fillNormals()
+
+} //...ns detail
+
+template <typename _Scalar>
+void
+calculateCloudNeighbours(
+    KdTreeT<_Scalar>                     const& cloudIndex,
+    int                                  const  k,
+    KnnIndicesT                               & neighbours,
+    typename KdTreeT<_Scalar>::KnnDistsT      & distsSqr,
+    float                                const  maxDist,
+    unsigned                             const  nThreads
+) {
+    neighbours.resize(cloudIndex.size(), std::max(0, k));
+    distsSqr  .resize(cloudIndex.size(), std::max(0, k));
+    switch (k) {
+        case  8: detail::fillNeighbourMatrix< 8>(cloudIndex, k, neighbours, distsSqr, maxDist, nThreads); break;
+        case 10: detail::fillNeighbourMatrix<10>(cloudIndex, k, neighbours, distsSqr, maxDist, nThreads); break;
+        case 16: detail::fillNeighbourMatrix<16>(cloudIndex, k, neighbours, distsSqr, maxDist, nThreads); break;
+        case 32: detail::fillNeighbourMatrix<32>(cloudIndex, k, neighbours, distsSqr, maxDist, nThreads); break;
+        default:
+            if (k > 0)
+                detail::fillNeighbourMatrix<Eigen::Dynamic>(cloudIndex, k, neighbours, distsSqr, maxDist, nThreads);
+            break;
+    }
+} //...calculateCloudNeighbours()
+
+template <typename _Scalar>
+Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic>
+calculateCloudNormals(
+    PointStorageT<_Scalar> const& points,
+    KnnIndicesT            const& neighbours,
+    unsigned               const  nThreads
+) {
+    // Output normals: N x 3
+    Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic> normals(points.size(), 3);
+    switch (neighbours.cols()) {
+        case  8: detail::fillNormals< 8>(points, neighbours, normals, nThreads); break;
+        case 10: detail::fillNormals<10>(points, neighbours, normals, nThreads); break;
+        case 16: detail::fillNormals<16>(points, neighbours, normals, nThreads); break;
+        case 32: detail::fillNormals<32>(points, neighbours, normals, nThreads); break;
+        default: detail::fillNormals<Eigen::Dynamic>(points, neighbours, normals, nThreads); break;
+    }
+    return normals;
+} //...calculateCloudNormals()
+
+template <typename _NormalsT>
+int
+orientCloudNormals(
+    NeighboursT const& neighbours,
+    _NormalsT        & normals
+) {
+    if (!normals.rows()) {
+        std::cerr << "[orientCloudNormals] No normals to work on...\n";
+        return -1;
+    }
+
+    // List of points to visit
+    std::queue<int> queue;
+    // Quick-lookup unique container of already visited points
+    std::set<int> visited;
+
+    // Count changes
+    int nFlips = 0;
+
+    while (visited.size() != static_cast<std::size_t>(normals.rows())) {
+        // Traverse a connected component
+        if (queue.empty()) {
+            if (!visited.size()) {
+                // Initialize queue with one random point
+                queue.push(rand() % normals.rows()); // TODO: pick point with low curvature
+            } else {
+                // Expand queue with first unvisited point
+                for (int i = 0; i != normals.rows() && queue.empty(); ++i) {
+                    // if unvisited, use
+                    if (visited.find(i) == visited.end())
+                        queue.push(i); // enqueue
+                } //...for each point
+            } //...next component
+
+            // Set visited
+            visited.insert(queue.front());
+        } //...if queue empty
+
+        // While points to visit exist
+        while (!queue.empty()) {
+            // Read next point from queue
+            int const pointId = queue.front();
+            // Remove point from queue
+            queue.pop();
+
+            // Fetch neighbours
+            NeighboursT::const_iterator const iter = neighbours.find(pointId);
+            // Check, if any neighbours
+            if (iter == neighbours.end()) {
+                //std::cerr << "Could not find neighbours of point " << pointId << "\n";
+                continue;
+            }
+
+            for (int const neighbourId : iter->second) {
+                // If unvisited
+                if (visited.find(neighbourId) == visited.end()) {
+                    // Enqueue for next level
+                    queue.push(neighbourId);
+                    // Mark visited
+                    visited.insert(neighbourId);
+
+                    // Flip neighbour normal, if not same direction as precursor point
+                    if (normals.row(pointId).dot(normals.row(neighbourId)) < 0.f) {
+                        normals.row(neighbourId) *= -1.f;
+                        ++nFlips;
+                    }
+                } //...if neighbour unvisited
+            } //...for each neighbour of point
+        } //...while points in queue
+    }
+
+    return nFlips;
+} //...orientCloudNormals()
+
 template <typename _FacesT>
 NeighboursT
 calculateCloudNeighboursFromFaces(
@@ -0,0 +1,53 @@
+//
+// Created by bontius on 14/02/17.
+//
+
+#ifndef ACQ_SPATIALORDER_HPP
+#define ACQ_SPATIALORDER_HPP
+
+#include "acq/spatialOrder.h"
+
+namespace acq {
+
+template <typename _MatrixT>
+_MatrixT
+permuteRows(
+    _MatrixT     const& matrix,
+    PermutationT const& order
+) {
+    _MatrixT permuted(order.size(), matrix.cols());
+    for (int row = 0; row != order.size(); ++row)
+        permuted.row(row) = matrix.row(order(row));
+    return permuted;
+} //...permuteRows()
+
+template <typename _MatrixT>
+_MatrixT
+restoreRows(
+    _MatrixT     const& matrix,
+    PermutationT const& order
+) {
+    _MatrixT restored(order.size(), matrix.cols());
+    for (int row = 0; row != order.size(); ++row)
+        restored.row(order(row)) = matrix.row(row);
+    return restored;
+} //...restoreRows()
+
+template <typename _MatrixT>
+_MatrixT
+restoreRows(
+    _MatrixT                  const& matrix,
+    PermutationT              const& order,
+    int                              originalCount,
+    typename _MatrixT::Scalar        fillValue
+) {
+    // Rows of points removed after reordering keep the fill value
+    _MatrixT restored(_MatrixT::Constant(originalCount, matrix.cols(), fillValue));
+    for (int row = 0; row != order.size(); ++row)
+        restored.row(order(row)) = matrix.row(row);
+    return restored;
+} //...restoreRows()
+
+} //...ns acq
+
+#endif //ACQ_SPATIALORDER_HPP
@@ -0,0 +1,39 @@
+//
+// Created by bontius on 06/02/17.
+//
+
+#ifndef ACQ_THREADPOOL_HPP
+#define ACQ_THREADPOOL_HPP
+
+#include "acq/threadPool.h"
+
+#include <memory>
+#include <stdexcept>
+
+namespace acq {
+
+template <typename _FunctorT>
+std::future<typename std::result_of<_FunctorT()>::type>
+ThreadPool::submit(_FunctorT&& task) {
+    //! Return type of task
+    typedef typename std::result_of<_FunctorT()>::type ResultT;
+
+    // std::function needs copyable targets, so share the move-only packaged task
+    std::shared_ptr<std::packaged_task<ResultT()> > const packagedTask =
+        std::make_shared<std::packaged_task<ResultT()> >(std::forward<_FunctorT>(task));
+    std::future<ResultT> result = packagedTask->get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop)
+            throw std::runtime_error("[ThreadPool::submit] Pool already stopped");
+        _tasks.push([packagedTask]() { (*packagedTask)(); });
+    }
+    _wakeUp.notify_one();
+
+    return result;
+} //...ThreadPool::submit()
+
+} //...ns acq
+
+#endif //ACQ_THREADPOOL_HPP
@@ -0,0 +1,100 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#ifndef ACQ_INCREMENTALNORMALS_H
+#define ACQ_INCREMENTALNORMALS_H
+
+#include "acq/typedefs.h"
+#include "acq/dynamicKdTree.h"
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace acq {
+
+/** \brief Oriented normals of a cloud kept up to date while points are moved.
+ *
+ * Keeps the kNN of every point (\ref getNeighbours) and their reverse: the
+ * points having a point as neighbour (\ref getReverseNeighbours). When points
+ * move (\ref update), only the neighbourhoods they leave or enter are searched
+ * again, in a \ref DynamicKdTreeT the moved points are reinserted into, and
+ * only the normals of those points are recomputed and reoriented, so edits
+ * cost time proportional to the edited region instead of the cloud size.
+ *
+ * Neighbourhoods a moved point enters are found among the points closest to
+ * its new position, which misses points it is a neighbour of without being
+ * close to them itself, e.g. isolated outliers.
+ */
+class IncrementalNormals {
+public:
+    /** \brief Estimates neighbours and consistently oriented normals of all points.
+     *
+     * \param[in] cloud    N x 3 matrix containing points in rows.
+     * \param[in] k        How many neighbours to estimate normals from, the point itself excluded.
+     * \param[in] maxDist  Maximum distance between vertex and neighbour.
+     * \param[in] nThreads Threads to use for the initial estimation, 0: hardware concurrency.
+     */
+    IncrementalNormals(
+        CloudConstRefT const& cloud,
+        int            const  k,
+        float          const  maxDist  = std::sqrt(std::numeric_limits<float>::max()) - 1.f,
+        unsigned       const  nThreads = 0);
+
+    /** \brief Moves points and updates the normals affected.
+     *
+     * \param[in] pointIds  Ids (rows) of the points moved, without duplicates.
+     * \param[in] positions New positions of \p pointIds in rows.
+     *
+     * \return The number of normals recomputed.
+     */
+    std::size_t update(std::vector<int> const& pointIds, CloudConstRefT const& positions);
+
+    /** \brief Current positions of the points. */
+    CloudT const& getPoints() const { return _points; }
+
+    /** \brief Current normals, oriented consistently along neighbourhoods. */
+    NormalsT const& getNormals() const { return _normals; }
+
+    /** \brief N x k neighbour ids, -1 in place of neighbours not closer than maxDist. */
+    KnnIndicesT const& getNeighbours() const { return _neighbours; }
+
+    /** \brief Ids of the points having \p pointId in their row of \ref getNeighbours, unordered. */
+    std::vector<int> const& getReverseNeighbours(int pointId) const { return _reverse[pointId]; }
+
+protected:
+    /** \brief Searches the neighbours of \p pointId again and updates the reverse lists. */
+    void updateNeighbours(int pointId);
+
+    /** \brief Estimates the normal of \p pointId from its current neighbours. */
+    void updateNormal(int pointId);
+
+    /** \brief Orients the normals of \p region consistently with the points around it,
+     *         by breadth-first search starting next to them. Components not touching
+     *         other points keep the side of their previous normals \p previous.
+     *
+     * Expects \ref _mark set for exactly the points of \p region, and clears it.
+     */
+    void orientRegion(std::vector<int> const& region, NormalsT const& previous);
+
+    /** \brief Calls \p visit(id) for the neighbours and reverse neighbours of \p pointId. */
+    template <typename _VisitorT>
+    void forEachLinked(int pointId, _VisitorT const& visit) const;
+
+    int                            _k;          //!< Neighbours per point.
+    double                         _maxDistSqr; //!< Squared maximum neighbour distance.
+    CloudT                         _points;     //!< Current positions.
+    NormalsT                       _normals;    //!< Current normals.
+    KnnIndicesT                    _neighbours; //!< kNN of each point, -1 padded.
+    std::vector<std::vector<int> > _reverse;    //!< Points having each point as neighbour.
+    DynamicKdTree                  _tree;       //!< Current positions, moved points reinserted.
+    std::vector<std::size_t>       _treeIds;    //!< Tree id of each point.
+    std::vector<int>               _pointIds;   //!< Point of each tree id, -1 if removed.
+    std::vector<char>              _mark;       //!< Scratch flags of affected points, all 0 between updates.
+}; //...class IncrementalNormals
+
+} //...ns acq
+
+#endif //ACQ_INCREMENTALNORMALS_H
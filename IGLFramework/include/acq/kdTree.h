@@ -0,0 +1,210 @@
+//
+// Created by bontius on 10/02/17.
+//
+
+#ifndef ACQ_KDTREE_H
+#define ACQ_KDTREE_H
+
+#include "acq/typedefs.h"
+#include "acq/pointStorage.h"
+#include "acq/soaKdTree.h"
+
+#include <cstddef>
+#include <memory>
+
+namespace acq {
+
+/** \brief Accuracy and speed of approximate kNN queries, see \ref KdTreeT::measureRecall. */
+struct KnnRecallStats {
+    KnnRecallStats() : recall(0.), meanDistRatio(1.), maxDistRatio(1.), exactSeconds(0.), approxSeconds(0.), nQueries(0) {}
+
+    /** \brief Exact query time over approximate query time. */
+    double getSpeedup() const { return approxSeconds > 0. ? exactSeconds / approxSeconds : 1.; }
+
+    double recall;        //!< Fraction of the exact neighbours also found approximately.
+    double meanDistRatio; //!< Mean of approximate over exact distance of the farthest neighbour.
+    double maxDistRatio;  //!< Largest ratio of approximate over exact distance of the farthest neighbour.
+    double exactSeconds;  //!< Time spent on exact queries.
+    double approxSeconds; //!< Time spent on approximate queries.
+    int    nQueries;      //!< Number of points queried.
+}; //...struct KnnRecallStats
+
+/** \brief Kd-tree over the points of a cloud for nearest neighbour lookups.
+ *
+ * Searches either with the SIMD leaf scanning \ref SoaKdTreeT (default), or with
+ * nanoflann, which is not exposed to includers. The tree keeps its own
+ * row-major copy of the points (\ref PointStorageT), so queries and distance
+ * evaluations read contiguous coordinates, and the source cloud may change
+ * or go away after construction.
+ *
+ * \tparam _Scalar Floating point type points are stored and compared in,
+ *                 instantiated for float and double.
+ */
+template <typename _Scalar>
+class KdTreeT {
+public:
+    //! Floating point type
+    typedef _Scalar Scalar;
+    //! Storage type of the indexed points
+    typedef PointStorageT<Scalar> PointStorageType;
+    //! Squared neighbour distances of query points in rows, infinite where fewer neighbours were found.
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> KnnDistsT;
+
+    /** \brief Search structure implementations. */
+    enum Backend {
+        SOA_SIMD = 0, //!< \ref SoaKdTreeT, leaves scanned in SIMD lanes.
+        NANOFLANN     //!< nanoflann::KDTreeSingleIndexAdaptor, point by point.
+    };
+
+    /** \brief Builds the tree.
+     *
+     * \param[in] cloud    N x 3 matrix containing points in rows, of any floating point type,
+     *                     copied to padded row-major storage of \ref Scalar.
+     * \param[in] maxLeafs Maximum number of points in a leaf node.
+     * \param[in] backend  Search structure to build.
+     */
+    template <typename _Derived>
+    explicit KdTreeT(Eigen::MatrixBase<_Derived> const& cloud, int maxLeafs = 10, Backend backend = SOA_SIMD)
+        : KdTreeT(PointStorageType(cloud), maxLeafs, backend) {}
+
+    /** \brief Builds the tree with options, see \ref KdTreeBuildParams.
+     *
+     * \param[in] cloud    N x 3 matrix containing points in rows, of any floating point type.
+     * \param[in] params   Leaf size, build threads and split heuristic,
+     *                     only the leaf size applies to \ref NANOFLANN.
+     * \param[in] backend  Search structure to build.
+     */
+    template <typename _Derived>
+    KdTreeT(Eigen::MatrixBase<_Derived> const& cloud, KdTreeBuildParams const& params, Backend backend = SOA_SIMD)
+        : KdTreeT(PointStorageType(cloud), params, backend) {}
+
+    /** \brief Builds the tree taking over already converted points.
+     *
+     * \param[in] points   Row-major points, padded or not.
+     * \param[in] maxLeafs Maximum number of points in a leaf node.
+     * \param[in] backend  Search structure to build.
+     */
+    explicit KdTreeT(PointStorageType&& points, int maxLeafs = 10, Backend backend = SOA_SIMD);
+
+    /** \brief Builds the tree with options taking over already converted points. */
+    KdTreeT(PointStorageType&& points, KdTreeBuildParams const& params, Backend backend = SOA_SIMD);
+
+    /** \brief Destructor, needed for the opaque implementation. */
+    ~KdTreeT();
+
+    /** \brief Find the \p k nearest neighbours of \p query.
+     *
+     * \param[in ] query     Pointer to 3 contiguous coordinates.
+     * \param[in ] k         How many neighbours to look for.
+     * \param[out] indices   At least \p k long, receives row ids of neighbours, closest first.
+     * \param[out] distsSqr  At least \p k long, receives squared distances of neighbours.
+     * \param[in ] params    Approximation options, exact by default,
+     *                       only \ref KnnSearchParams::eps applies to \ref NANOFLANN.
+     *
+     * \return The number of neighbours found, less than \p k only for small clouds.
+     */
+    std::size_t
+    knnSearch(
+        Scalar          const* query,
+        int                    k,
+        std::size_t          * indices,
+        Scalar               * distsSqr,
+        KnnSearchParams const& params = KnnSearchParams()) const;
+
+    /** \brief Finds the \p k nearest indexed points of each row of \p queries, e.g. of another cloud.
+     *
+     * Queries are processed in Z-order (see \ref calculateMortonOrder), so that
+     * consecutive queries descend to the same nodes, and in parallel.
+     *
+     * \param[in ] queries  M x 3 matrix containing query points in rows.
+     * \param[in ] k        How many neighbours to look for.
+     * \param[out] indices  M x k, row i receives the neighbours of query i, closest first, -1 if not found.
+     * \param[out] distsSqr M x k, squared distances of \p indices, infinite if not found.
+     * \param[in ] params   Approximation options, exact by default.
+     * \param[in ] nThreads Threads to use, 0: hardware concurrency.
+     */
+    void
+    batchKnnSearch(
+        CloudConstRefT  const& queries,
+        int                    k,
+        KnnIndicesT          & indices,
+        KnnDistsT            & distsSqr,
+        KnnSearchParams const& params   = KnnSearchParams(),
+        unsigned               nThreads = 0) const;
+
+    /** \brief Finds the \p k nearest neighbours of every indexed point, see \ref SoaKdTreeT::allKnnSearch.
+     *
+     * \param[in ] k        How many neighbours to look for, the point itself included.
+     * \param[out] indices  N x k row-major, row i receives the neighbours of point i, closest first.
+     * \param[out] distsSqr N x k row-major, squared distances of \p indices.
+     * \param[out] counts   N long, number of neighbours found for each point.
+     * \param[in ] nThreads Threads to use, 0: hardware concurrency, only used by \ref SOA_SIMD.
+     */
+    void
+    allKnnSearch(
+        int           k,
+        std::size_t * indices,
+        Scalar      * distsSqr,
+        std::size_t * counts,
+        unsigned      nThreads = 0) const;
+
+    /** \brief Self-join handing the neighbours of each point to \p sink, see \ref SoaKdTreeT::allKnnSearch.
+     *
+     * \param[in] k        How many neighbours to look for, the point itself included.
+     * \param[in] sink     Called once per point, possibly concurrently.
+     * \param[in] nThreads Threads to use, 0: hardware concurrency, only used by \ref SOA_SIMD.
+     */
+    void
+    allKnnSearch(
+        int                                          k,
+        typename SoaKdTreeT<Scalar>::KnnSinkT const& sink,
+        unsigned                                     nThreads = 0) const;
+
+    /** \brief Compares approximate with exact queries on a sample of the indexed points.
+     *
+     * \param[in] k        How many neighbours to look for.
+     * \param[in] params   Approximation options to evaluate.
+     * \param[in] nQueries Number of points to query, spread evenly over the cloud.
+     *
+     * \return Recall, distance error and timings of the sample.
+     */
+    KnnRecallStats
+    measureRecall(
+        int                    k,
+        KnnSearchParams const& params,
+        int                    nQueries = 1000) const;
+
+    /** \brief The points the tree was built on, in row-major order. */
+    PointStorageType const& getPoints() const;
+
+    /** \brief Number of points indexed. */
+    int size() const;
+
+    /** \brief Bytes allocated by the tree, its copy of the points included. */
+    std::size_t getMemoryFootprint() const;
+
+    /** \brief Maximum leaf size the tree was built with. */
+    int getMaxLeafs() const { return _maxLeafs; }
+
+    /** \brief Search structure in use. */
+    Backend getBackend() const { return _backend; }
+
+protected:
+    struct Impl;                     //!< Search structure and points.
+    std::unique_ptr<Impl> _impl;     //!< Opaque implementation.
+    int                   _maxLeafs; //!< Maximum number of points in a leaf.
+    Backend               _backend;  //!< Search structure in use.
+
+private:
+    KdTreeT(KdTreeT const&) = delete;
+    KdTreeT& operator=(KdTreeT const&) = delete;
+}; //...class KdTreeT
+
+//! Double precision kd-tree, matching \ref CloudT.
+typedef KdTreeT<CloudT::Scalar> KdTree;
+//! Single precision kd-tree, half the memory traffic.
+typedef KdTreeT<float>          KdTreeF;
+
+} //...ns acq
+
+#endif //ACQ_KDTREE_H
@@ -0,0 +1,68 @@
+//
+// Created by bontius on 15/02/17.
+//
+
+#ifndef ACQ_KNNRESULT_H
+#define ACQ_KNNRESULT_H
+
+#include <cstddef>
+#include <limits>
+
+namespace acq {
+
+/** \brief Sorted list of the \p k best neighbours found so far, written to caller owned arrays.
+ *
+ * Shared by the spatial indices (\ref SoaKdTreeT, \ref VoxelGridT).
+ *
+ * \tparam _Scalar Floating point type of the squared distances.
+ */
+template <typename _Scalar>
+struct KnnResultT {
+    //! Floating point type
+    typedef _Scalar Scalar;
+
+    KnnResultT(int k, std::size_t* indices, Scalar* distsSqr)
+        : k(k), count(0), indices(indices), distsSqr(distsSqr) {}
+
+    /** \brief True, once \p k neighbours are stored. */
+    inline bool full() const { return count == k; }
+
+    /** \brief Squared distance a point has to beat to be added. */
+    inline Scalar worst() const {
+        return count < k ? std::numeric_limits<Scalar>::max() : distsSqr[k - 1];
+    }
+
+    /** \brief True, if a point belongs in the list: closer than the worst one, or as close
+     *         with a smaller index. Breaking ties by index makes results independent of
+     *         the order points are visited in.
+     */
+    inline bool accepts(Scalar distSqr, std::size_t index) const {
+        return count < k || distSqr < distsSqr[k - 1] || (distSqr == distsSqr[k - 1] && index < indices[k - 1]);
+    }
+
+    /** \brief Insert keeping the list sorted by distance then index, drops the last, if full. */
+    inline void add(Scalar distSqr, std::size_t index) {
+        int i = count;
+        for (; i > 0 && (distsSqr[i - 1] > distSqr || (distsSqr[i - 1] == distSqr && indices[i - 1] > index)); --i) {
+            if (i < k) {
+                distsSqr[i] = distsSqr[i - 1];
+                indices [i] = indices [i - 1];
+            }
+        }
+        if (i < k) {
+            distsSqr[i] = distSqr;
+            indices [i] = index;
+        }
+        if (count < k)
+            ++count;
+    } //...add()
+
+    int          k;        //!< Capacity.
+    int          count;    //!< Number of neighbours stored.
+    std::size_t* indices;  //!< Output indices, closest first.
+    Scalar     * distsSqr; //!< Output squared distances, increasing.
+}; //...struct KnnResultT
+
+} //...ns acq
+
+#endif //ACQ_KNNRESULT_H
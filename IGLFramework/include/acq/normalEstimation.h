@@ -6,6 +6,9 @@
 #define ACQ_NORMALESTIMATION_H
 
 #include "acq/typedefs.h"
+#include "acq/kdTree.h"
+#include "acq/voxelGrid.h"
+#include "acq/dynamicKdTree.h"
 #include <limits.h>
 #include <vector>
 
@@ -27,10 +30,37 @@ namespace acq {
 template <typename _NeighbourIdListT>
 Eigen::Matrix <typename CloudT::Scalar, 3, 1>
 calculatePointNormal(
-    CloudT            const& cloud,
+    CloudConstRefT    const& cloud,
     int               const  pointIndex,
     _NeighbourIdListT const& neighbourIndices);
 
+/** \brief Estimates the normal of a single point
+ *         given its ID and the ID of its neighbours.
+ *
+ * Reads contiguous (and if padded, 4-wide) points, prefer this in loops.
+ * The covariance is accumulated in double precision regardless of \p _Scalar.
+ *
+ * \tparam _Scalar Storage precision of the points, float or double.
+ *
+ * \param[in] points            Row-major points.
+ * \param[in] pointIndex        Index of point.
+ * \param[in] neighbourIndices  List of indices of neighbours.
+ *
+ * \return A 3D vector that is the normal of point with ID \p pointIndex.
+ */
+template <typename _Scalar, typename _NeighbourIdListT>
+Eigen::Matrix <_Scalar, 3, 1>
+calculatePointNormal(
+    PointStorageT<_Scalar> const& points,
+    int                    const  pointIndex,
+    _NeighbourIdListT      const& neighbourIndices);
+
+
+/** \brief Spatial index types to look up neighbours with. */
+enum SpatialIndexType {
+    KD_TREE_INDEX = 0, //!< \ref KdTreeT, adapts to any density.
+    VOXEL_GRID_INDEX   //!< \ref VoxelGridT, faster on dense, evenly sampled clouds.
+};
 
 /** \brief Estimates the neighbours of all points in cloud
  *         returning \p k neighbours max each.
@@ -43,11 +73,135 @@ calculatePointNormal(
  */
 NeighboursT
 calculateCloudNeighbours(
-    CloudT               const& cloud,
+    CloudConstRefT       const& cloud,
     int                  const  k,
     float                const  maxDist = std::sqrt(std::numeric_limits<float>::max()) - 1.f,
     int                  const  maxLeafs = 10);
 
+/** \brief Estimates the neighbours of all points in cloud
+ *         returning \p k neighbours max each, with control over the tree construction and search.
+ *
+ * \param[in] cloud        N x 3 matrix containing points in rows.
+ * \param[in] k            How many neighbours too look for in point.
+ * \param[in] maxDist      Maximum distance between vertex and neighbour.
+ * \param[in] buildParams  Leaf size, build threads and split heuristic of the kd-tree.
+ * \param[in] searchParams Approximate search options, pick them with \ref KdTreeT::measureRecall.
+ *
+ * \return An associative container with the varying length lists of neighbours.
+ */
+NeighboursT
+calculateCloudNeighbours(
+    CloudConstRefT       const& cloud,
+    int                  const  k,
+    float                const  maxDist,
+    KdTreeBuildParams    const& buildParams,
+    KnnSearchParams      const& searchParams = KnnSearchParams());
+
+/** \brief Estimates the neighbours of all points in cloud
+ *         returning \p k neighbours max each, using the spatial index of choice.
+ *
+ * The voxel grid picks its cell size from the point density.
+ *
+ * \param[in] cloud     N x 3 matrix containing points in rows.
+ * \param[in] k         How many neighbours too look for in point.
+ * \param[in] maxDist   Maximum distance between vertex and neighbour.
+ * \param[in] indexType Spatial index to build.
+ *
+ * \return An associative container with the varying length lists of neighbours.
+ */
+NeighboursT
+calculateCloudNeighbours(
+    CloudConstRefT       const& cloud,
+    int                  const  k,
+    float                const  maxDist,
+    SpatialIndexType     const  indexType);
+
+/** \brief Estimates the neighbours of all points indexed by a prebuilt tree
+ *         returning \p k neighbours max each.
+ *
+ * \tparam _Scalar Precision of the tree, float or double.
+ *
+ * \param[in] cloudIndex   Kd-tree built on the cloud to process.
+ * \param[in] k            How many neighbours too look for in point.
+ * \param[in] maxDist      Maximum distance between vertex and neighbour.
+ * \param[in] searchParams Approximate search options, exact by default.
+ *
+ * \return An associative container with the varying length lists of neighbours.
+ */
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    KdTreeT<_Scalar>     const& cloudIndex,
+    int                  const  k,
+    float                const  maxDist = std::sqrt(std::numeric_limits<float>::max()) - 1.f,
+    KnnSearchParams      const& searchParams = KnnSearchParams());
+
+/** \brief Estimates exactly \p k neighbours of all points indexed by a prebuilt tree
+ *         into dense matrices, in parallel.
+ *
+ * Cheaper to fill and read than \ref NeighboursT. Rows are filled straight from
+ * the leaf-batched self-join (\ref KdTreeT::allKnnSearch), common \p k
+ * (8, 10, 16, 32) with the row width known at compile time.
+ *
+ * \tparam _Scalar Precision of the tree, float or double.
+ *
+ * \param[in ] cloudIndex Kd-tree built on the cloud to process.
+ * \param[in ] k          How many neighbours to look for, the point itself excluded.
+ * \param[out] neighbours N x k, neighbour ids of point i in row i, closest first,
+ *                        -1 in place of neighbours not closer than \p maxDist.
+ * \param[out] distsSqr   N x k, squared distances of \p neighbours, infinite in place of -1 ids.
+ * \param[in ] maxDist    Maximum distance between vertex and neighbour.
+ * \param[in ] nThreads   Threads to use, 0: hardware concurrency.
+ */
+template <typename _Scalar>
+void
+calculateCloudNeighbours(
+    KdTreeT<_Scalar>                     const& cloudIndex,
+    int                                  const  k,
+    KnnIndicesT                               & neighbours,
+    typename KdTreeT<_Scalar>::KnnDistsT      & distsSqr,
+    float                                const  maxDist  = std::sqrt(std::numeric_limits<float>::max()) - 1.f,
+    unsigned                             const  nThreads = 0);
+
+/** \brief Estimates the neighbours of all points indexed by a prebuilt voxel grid
+ *         returning \p k neighbours max each.
+ *
+ * \tparam _Scalar Precision of the grid, float or double.
+ *
+ * \param[in] cloudIndex Voxel grid built on the cloud to process.
+ * \param[in] k          How many neighbours too look for in point.
+ * \param[in] maxDist    Maximum distance between vertex and neighbour.
+ *
+ * \return An associative container with the varying length lists of neighbours.
+ */
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    VoxelGridT<_Scalar>  const& cloudIndex,
+    int                  const  k,
+    float                const  maxDist = std::sqrt(std::numeric_limits<float>::max()) - 1.f);
+
+/** \brief Estimates the neighbours of the points in a dynamic kd-tree
+ *         returning \p k neighbours max each.
+ *
+ * Use for clouds growing frame by frame, the tree is updated by insertion
+ * instead of being rebuilt. Removed points are left out.
+ *
+ * \tparam _Scalar Precision of the tree, float or double.
+ *
+ * \param[in] cloudIndex Dynamic kd-tree holding the cloud to process.
+ * \param[in] k          How many neighbours too look for in point.
+ * \param[in] maxDist    Maximum distance between vertex and neighbour.
+ *
+ * \return An associative container with the varying length lists of neighbours, keyed by point id.
+ */
+template <typename _Scalar>
+NeighboursT
+calculateCloudNeighbours(
+    DynamicKdTreeT<_Scalar> const& cloudIndex,
+    int                     const  k,
+    float                   const  maxDist = std::sqrt(std::numeric_limits<float>::max()) - 1.f);
+
 /** \brief Estimates the normals of all points in cloud using \p k neighbours max each.
  *
  * \param[in] cloud      Input pointcloud, N x 3, N 3D points in rows.
@@ -57,21 +211,59 @@ calculateCloudNeighbours(
  */
 NormalsT
 calculateCloudNormals(
-    CloudT               const& cloud,
+    CloudConstRefT       const& cloud,
     NeighboursT          const& neighbours);
 
+/** \brief Estimates the normals of all points in row-major storage using precomputed neighbours.
+ *
+ * \tparam _Scalar Precision of the points and the returned normals, float or double.
+ *
+ * \param[in] points     Input points, e.g. \ref KdTreeT::getPoints.
+ * \param[in] neighbours Precomputed lists of neighbour Ids.
+ *
+ * \return N x 3 3D normals, the normals of \p points.
+ */
+template <typename _Scalar>
+Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic>
+calculateCloudNormals(
+    PointStorageT<_Scalar> const& points,
+    NeighboursT            const& neighbours);
+
+/** \brief Estimates the normals of all points in row-major storage using a dense neighbour matrix, in parallel.
+ *
+ * Common neighbour counts (8, 10, 16, 32 columns) are specialized with the
+ * covariance loop unrolled.
+ *
+ * \tparam _Scalar Precision of the points and the returned normals, float or double.
+ *
+ * \param[in] points     Input points, e.g. \ref KdTreeT::getPoints.
+ * \param[in] neighbours N x k neighbour ids, -1 entries are ignored, see \ref calculateCloudNeighbours.
+ * \param[in] nThreads   Threads to use, 0: hardware concurrency.
+ *
+ * \return N x 3 3D normals, the normals of \p points.
+ */
+template <typename _Scalar>
+Eigen::Matrix<_Scalar, Eigen::Dynamic, Eigen::Dynamic>
+calculateCloudNormals(
+    PointStorageT<_Scalar> const& points,
+    KnnIndicesT            const& neighbours,
+    unsigned               const  nThreads = 0);
+
 /** \brief Breadth-first-search to orient normals consistently
  *         using the provided neighbourhood information.
  *
+ * \tparam _NormalsT Concept: acq::NormalsT or acq::NormalsFT.
+ *
  * \param[in]     neighbours A directed list of neighbour indices.
  * \param[in,out] normals    The normals to possibly flip.
  *
  * \return The number of normals flipped.
  */
+template <typename _NormalsT>
 int
 orientCloudNormals(
     NeighboursT const& neighbours,
-    NormalsT         & normals);
+    _NormalsT        & normals);
 
 /** \brief Traverses faces and records neighbourhood information using face edges.
  *
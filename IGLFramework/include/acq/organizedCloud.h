@@ -0,0 +1,78 @@
+//
+// Created by bontius on 17/02/17.
+//
+
+#ifndef ACQ_ORGANIZEDCLOUD_H
+#define ACQ_ORGANIZEDCLOUD_H
+
+#include "acq/typedefs.h"
+
+#include <cmath>
+#include <limits>
+
+namespace acq {
+
+/** \addtogroup OrganizedCloud
+ *  @{
+ *
+ * Organized clouds come from depth frames: point i is the sample of pixel
+ * (i / width, i % width) of a width x height sensor grid, pixels without a
+ * measurement hold non-finite coordinates. Neighbourhoods are pixel windows,
+ * so no spatial index is needed.
+ */
+
+/** \brief Neighbours of all points from the (2 * \p windowRadius + 1)^2 pixel windows around them.
+ *
+ * \param[in] cloud        width * height x 3 matrix, points in pixel order.
+ * \param[in] width        Number of pixel columns of the sensor grid.
+ * \param[in] height       Number of pixel rows of the sensor grid.
+ * \param[in] windowRadius Half side length of the windows in pixels.
+ * \param[in] maxDist      Maximum distance between vertex and neighbour, cuts windows at depth discontinuities.
+ * \param[in] nThreads     Threads to use, 0: hardware concurrency.
+ *
+ * \return N x ((2 * \p windowRadius + 1)^2 - 1) neighbour ids in window order,
+ *         padded with -1 after the valid ones (invalid pixels, too far, outside the grid).
+ *         Rows of invalid points are all -1.
+ */
+KnnIndicesT
+calculateOrganizedNeighbours(
+    CloudConstRefT const& cloud,
+    int            const  width,
+    int            const  height,
+    int            const  windowRadius,
+    float          const  maxDist  = std::sqrt(std::numeric_limits<float>::max()) - 1.f,
+    unsigned       const  nThreads = 0);
+
+/** \brief Estimates the normals of all points from the pixel windows around them
+ *         using integral images of the point moments.
+ *
+ * Sums of the coordinates and of their pairwise products are summed up over
+ * the grid once, then the covariance of any window is read from four corners
+ * of each sum, so the cost is linear in the number of pixels and independent
+ * of \p windowRadius. Invalid pixels are left out of the sums.
+ *
+ * Unlike \ref calculateOrganizedNeighbours windows are not cut at depth
+ * discontinuities, normals along object silhouettes are smoothed.
+ *
+ * \param[in] cloud        width * height x 3 matrix, points in pixel order.
+ * \param[in] width        Number of pixel columns of the sensor grid.
+ * \param[in] height       Number of pixel rows of the sensor grid.
+ * \param[in] windowRadius Half side length of the windows in pixels.
+ * \param[in] nThreads     Threads to use, 0: hardware concurrency.
+ *
+ * \return N x 3 unoriented normals, non-finite for invalid points and for
+ *         windows with less than 3 valid points.
+ */
+NormalsT
+calculateOrganizedNormals(
+    CloudConstRefT const& cloud,
+    int            const  width,
+    int            const  height,
+    int            const  windowRadius,
+    unsigned       const  nThreads = 0);
+
+/** @} (OrganizedCloud) */
+
+} //...ns acq
+
+#endif //ACQ_ORGANIZEDCLOUD_H
@@ -0,0 +1,58 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#ifndef ACQ_OUTLIERREMOVAL_H
+#define ACQ_OUTLIERREMOVAL_H
+
+#include "acq/typedefs.h"
+#include "acq/kdTree.h"
+
+#include <vector>
+
+namespace acq {
+
+/** \addtogroup OutlierRemoval
+ *  @{
+ *
+ * Filters read the squared neighbour distances of the dense kNN
+ * (see \ref calculateCloudNeighbours), and flag the points to keep,
+ * e.g. for \ref DecoratedCloud::keepPoints.
+ */
+
+/** \brief Flags points whose mean distance to their neighbours is not larger than
+ *         \p stdDevMul standard deviations above the mean over all points.
+ *
+ * \param[in] distsSqr  N x k squared neighbour distances, infinite where no neighbour was found.
+ * \param[in] stdDevMul Allowed deviation from the mean in standard deviations.
+ * \param[in] nThreads  Threads to use, 0: hardware concurrency.
+ *
+ * \return N flags, 1 for inliers, 0 for outliers and points without neighbours.
+ */
+std::vector<char>
+findStatisticalInliers(
+    KdTree::KnnDistsT const& distsSqr,
+    double            const  stdDevMul = 1.,
+    unsigned          const  nThreads  = 0);
+
+/** \brief Flags points having at least \p minNeighbours neighbours closer than \p radius.
+ *
+ * \param[in] distsSqr      N x k squared neighbour distances, closest first, k >= \p minNeighbours.
+ * \param[in] radius        Radius to count neighbours in.
+ * \param[in] minNeighbours Neighbours needed to keep a point.
+ * \param[in] nThreads      Threads to use, 0: hardware concurrency.
+ *
+ * \return N flags, 1 for inliers, 0 for outliers.
+ */
+std::vector<char>
+findRadiusInliers(
+    KdTree::KnnDistsT const& distsSqr,
+    double            const  radius,
+    int               const  minNeighbours,
+    unsigned          const  nThreads = 0);
+
+/** @} (OutlierRemoval) */
+
+} //...ns acq
+
+#endif //ACQ_OUTLIERREMOVAL_H
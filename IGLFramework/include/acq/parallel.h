@@ -0,0 +1,44 @@
+//
+// Created by bontius on 15/02/17.
+//
+
+#ifndef ACQ_PARALLEL_H
+#define ACQ_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace acq {
+
+/** \brief Number of chunks to split \p n elements into for \p nThreads threads (0: hardware concurrency),
+ *         so that each chunk has at least \p minPerChunk elements.
+ */
+inline int getChunkCount(std::size_t n, unsigned nThreads, std::size_t minPerChunk = 1 << 14) {
+    if (!nThreads)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    return static_cast<int>(std::max<std::size_t>(1, std::min<std::size_t>(nThreads, n / minPerChunk)));
+} //...getChunkCount()
+
+/** \brief Runs \p job(chunk, begin, end) for \p nChunks consecutive ranges of [0, \p n).
+ *
+ * The first chunk runs in the calling thread, the others in std::async tasks.
+ * Exceptions of the jobs are rethrown after all chunks finished.
+ */
+template <typename _JobT>
+void parallelChunks(std::size_t n, int nChunks, _JobT const& job) {
+    std::vector<std::future<void> > others;
+    for (int chunk = 1; chunk < nChunks; ++chunk)
+        others.push_back(std::async(std::launch::async, [&job, chunk, n, nChunks]() {
+            job(chunk, n * chunk / nChunks, n * (chunk + 1) / nChunks);
+        }));
+    job(0, 0, n / nChunks);
+    for (std::future<void>& other : others)
+        other.get();
+} //...parallelChunks()
+
+} //...ns acq
+
+#endif //ACQ_PARALLEL_H
@@ -0,0 +1,137 @@
+//
+// Created by bontius on 12/02/17.
+//
+
+#ifndef ACQ_POINTSTORAGE_H
+#define ACQ_POINTSTORAGE_H
+
+#include "acq/typedefs.h"
+
+#include <cstddef>
+#include <iostream>
+#include <stdexcept>
+
+namespace acq {
+
+/** \brief Contiguous, row-major copy of the points of a cloud.
+ *
+ * \ref CloudT is column-major, so the coordinates of a single point are
+ * strided in memory. This storage keeps the coordinates of each point next
+ * to each other, optionally padded to 4 components (the 4th being 0), so
+ * that every point is a single aligned SIMD load and a pointer to a point
+ * can be handed to code expecting a contiguous Scalar[3].
+ *
+ * Can be filled from a cloud of any floating point type, so a double
+ * \ref CloudT may be stored in single precision to halve memory traffic.
+ *
+ * Also implements the dataset interface nanoflann expects.
+ *
+ * \tparam _Scalar Floating point type of the stored coordinates.
+ */
+template <typename _Scalar>
+class PointStorageT {
+public:
+    //! Floating point type
+    typedef _Scalar Scalar;
+    //! Row-major storage, 3 or 4 columns.
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> StorageT;
+    //! Read-only view of a single point.
+    typedef Eigen::Map<Eigen::Matrix<Scalar, 3, 1> const> PointMapT;
+    //! Read-only view of a padded point, last component is 0.
+    typedef Eigen::Map<Eigen::Matrix<Scalar, 4, 1> const> PaddedPointMapT;
+
+    //! Point dimensions
+    enum { Dim = 3, PaddedDim = 4 };
+
+    /** \brief Empty storage. */
+    PointStorageT() : _data(0, PaddedDim) {}
+
+    /** \brief Copies the points of \p cloud, converting them to \ref Scalar.
+     *
+     * \param[in] cloud  N x 3 matrix containing points in rows.
+     * \param[in] padded Pad points to 4 components for aligned vector loads.
+     */
+    template <typename _Derived>
+    explicit PointStorageT(Eigen::MatrixBase<_Derived> const& cloud, bool padded = true) {
+        assign(cloud, padded);
+    }
+
+    /** \brief Replace contents by the points of \p cloud, converting them to \ref Scalar. */
+    template <typename _Derived>
+    void assign(Eigen::MatrixBase<_Derived> const& cloud, bool padded = true) {
+        // Safety check dimensionality
+        if (cloud.cols() != Dim) {
+            std::cerr << "[PointStorage] Point dimension mismatch: " << cloud.cols()
+                      << " vs. " << Dim
+                      << "\n";
+            throw new std::runtime_error("Point dimension mismatch");
+        } //...check dimensionality
+
+        _data.resize(cloud.rows(), padded ? PaddedDim : Dim);
+        _data.template leftCols<Dim>() = cloud.template cast<Scalar>();
+        if (padded)
+            _data.col(Dim).setZero();
+    } //...assign()
+
+    /** \brief Pointer to the contiguous coordinates of point \p index. */
+    Scalar const* point(std::size_t index) const { return _data.data() + index * _data.cols(); }
+
+    /** \brief Point \p index as a 3D vector. */
+    PointMapT getPoint(std::size_t index) const { return PointMapT(point(index)); }
+
+    /** \brief Point \p index as a 4D vector, only valid if \ref isPadded. */
+    PaddedPointMapT getPaddedPoint(std::size_t index) const { return PaddedPointMapT(point(index)); }
+
+    /** \brief Number of points stored. */
+    int size() const { return static_cast<int>(_data.rows()); }
+
+    /** \brief Distance between consecutive points in Scalars, 3 or 4. */
+    int stride() const { return static_cast<int>(_data.cols()); }
+
+    /** \brief True, if points are padded to 4 components. */
+    bool isPadded() const { return _data.cols() == PaddedDim; }
+
+    /** \brief Underlying row-major matrix. */
+    StorageT const& getData() const { return _data; }
+
+    /** \brief Copy back to a column-major N x 3 double cloud. */
+    CloudT toCloud() const { return _data.template leftCols<Dim>().template cast<CloudT::Scalar>(); }
+
+    /** \brief Bytes allocated. */
+    std::size_t getMemoryFootprint() const { return _data.size() * sizeof(Scalar); }
+
+    //
+    // nanoflann dataset interface
+    //
+
+    /** \brief Number of points for nanoflann. */
+    inline std::size_t kdtree_get_point_count() const { return _data.rows(); }
+
+    /** \brief Squared distance of contiguous \p p1 and point \p idx2. */
+    inline Scalar kdtree_distance(Scalar const* p1, std::size_t idx2, std::size_t /*size*/) const {
+        Scalar const* const p2 = point(idx2);
+        Scalar const d0 = p1[0] - p2[0];
+        Scalar const d1 = p1[1] - p2[1];
+        Scalar const d2 = p1[2] - p2[2];
+        return d0 * d0 + d1 * d1 + d2 * d2;
+    }
+
+    /** \brief Coordinate \p dim of point \p idx for nanoflann. */
+    inline Scalar kdtree_get_pt(std::size_t idx, int dim) const { return point(idx)[dim]; }
+
+    /** \brief Let nanoflann compute the bounding box. */
+    template <class _BBoxT>
+    bool kdtree_get_bbox(_BBoxT& /*bb*/) const { return false; }
+
+protected:
+    StorageT _data; //!< N x 3 or N x 4 row-major coordinates.
+}; //...class PointStorageT
+
+//! Double precision point storage, matching \ref CloudT.
+typedef PointStorageT<CloudT::Scalar> PointStorage;
+//! Single precision point storage, half the memory traffic.
+typedef PointStorageT<float>          PointStorageF;
+
+} //...ns acq
+
+#endif //ACQ_POINTSTORAGE_H
@@ -0,0 +1,144 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#ifndef ACQ_REGISTRATION_H
+#define ACQ_REGISTRATION_H
+
+#include "acq/typedefs.h"
+#include "acq/kdTree.h"
+#include "acq/decoratedCloud.h"
+
+#include <vector>
+
+namespace acq {
+
+/** \brief Options of \ref registerPointToPlane. */
+struct IcpParams {
+    explicit IcpParams(int maxIterations = 30, double maxCorrespondenceDist = 0., int coarsestStride = 16,
+                       unsigned nThreads = 0)
+        : maxIterations(maxIterations), maxCorrespondenceDist(maxCorrespondenceDist),
+          coarsestStride(coarsestStride), minUpdate(1e-6), normalK(10), maxLeafs(10), nThreads(nThreads) {}
+
+    int      maxIterations;         //!< Iterations per level at most.
+    double   maxCorrespondenceDist; //!< Pairs farther apart are rejected, 0: unlimited.
+    int      coarsestStride;        //!< Every n-th source point on the first level, divided by 4 per level down to 1.
+    double   minUpdate;             //!< A level converged, when the update (radians and distance) is smaller.
+    int      normalK;               //!< Neighbours to estimate target normals from, if the target has none.
+    int      maxLeafs;              //!< Maximum number of points in a leaf node of the target kd-tree.
+    unsigned nThreads;              //!< Threads to use, 0: hardware concurrency.
+}; //...struct IcpParams
+
+/** \brief Statistics of one ICP iteration. */
+struct IcpIteration {
+    int    stride;           //!< Every n-th source point was used.
+    int    nCorrespondences; //!< Pairs not rejected.
+    double rmsResidual;      //!< Root mean square point-to-plane distance of the pairs, before the update.
+    double seconds;          //!< Time spent on the iteration.
+}; //...struct IcpIteration
+
+/** \brief Outcome of \ref registerPointToPlane. */
+struct IcpResult {
+    IcpResult() : transform(Eigen::Matrix4d::Identity()), converged(false) {}
+
+    Eigen::Matrix4d           transform;  //!< Rigid transform taking source points to the target.
+    std::vector<IcpIteration> iterations; //!< Statistics of all iterations, coarse to fine.
+    bool                      converged;  //!< True, if the finest level converged within its iterations.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct IcpResult
+
+/** \brief Rigidly aligns a source cloud to a target cloud by point-to-plane ICP.
+ *
+ * Each iteration pairs the transformed source points with their closest
+ * target points (\ref KdTreeT::batchKnnSearch, in parallel), and solves the
+ * linearized (small angle) least squares problem of the distances of the
+ * source points from the tangent planes of their partners (Low, "Linear
+ * Least-Squares Optimization for Point-to-Plane ICP Surface Registration").
+ * The normal equations are summed up per chunk of pairs in parallel.
+ *
+ * Registration runs coarse to fine: early levels use every n-th source point
+ * only, to get close cheaply, the last level uses all of them.
+ *
+ * \param[in] source        N x 3 matrix containing the points to move in rows, non-finite points are skipped.
+ * \param[in] targetTree    Kd-tree of the target points, e.g. \ref DecoratedCloud::getKdTree.
+ * \param[in] targetNormals M x 3 normals of the target points, orientation does not matter,
+ *                          pairs with non-finite normals are rejected.
+ * \param[in] initial       Initial guess of the transform.
+ * \param[in] params        Iterations, rejection and subsampling options.
+ *
+ * \return The transform, with the statistics of all iterations.
+ */
+IcpResult
+registerPointToPlane(
+    CloudConstRefT   const& source,
+    KdTree           const& targetTree,
+    NormalsConstRefT const& targetNormals,
+    Eigen::Matrix4d  const& initial = Eigen::Matrix4d::Identity(),
+    IcpParams        const& params  = IcpParams());
+
+/** \brief Options of \ref registerRansac. */
+struct RansacParams {
+    explicit RansacParams(double inlierDist = 0.01, int maxIterations = 100000, int k = 40, unsigned nThreads = 0)
+        : inlierDist(inlierDist), maxIterations(maxIterations), k(k), edgeSimilarity(0.9), mutualMatches(true),
+          maxLeafs(10), seed(0), nThreads(nThreads) {}
+
+    double   inlierDist;     //!< Pairs closer than this after the transform are inliers, a few point spacings.
+    int      maxIterations;  //!< Samples of three correspondences to draw.
+    int      k;              //!< Neighbours to describe points by, see \ref DecoratedCloud::getFpfhFeatures.
+    double   edgeSimilarity; //!< Samples are skipped, unless their edges in source and target differ less in length (ratio).
+    bool     mutualMatches;  //!< Keep only pairs, whose descriptors are the closest to each other both ways.
+    int      maxLeafs;       //!< Maximum number of points in a leaf node of the kd-trees.
+    unsigned seed;           //!< Seed of the sampling, results only depend on it, not on \ref nThreads.
+    unsigned nThreads;       //!< Threads to use, 0: hardware concurrency.
+}; //...struct RansacParams
+
+/** \brief Outcome of \ref registerRansac. */
+struct RansacResult {
+    RansacResult() : transform(Eigen::Matrix4d::Identity()), nCorrespondences(0), nInliers(0), inlierRms(0.),
+                     nValidSamples(0), seconds(0.) {}
+
+    Eigen::Matrix4d transform;        //!< Rigid transform taking source points to the target.
+    int             nCorrespondences; //!< Descriptor matches sampled from.
+    int             nInliers;         //!< Matches closer than the inlier distance after \ref transform.
+    double          inlierRms;        //!< Root mean square distance of the inlier matches.
+    int             nValidSamples;    //!< Samples passing the edge length check.
+    double          seconds;          //!< Time spent, descriptors included.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct RansacResult
+
+/** \brief Coarse global alignment of two clouds in any initial pose, from matching local descriptors.
+ *
+ * Points are paired with the target point of the closest fast point feature
+ * histogram (\ref DecoratedCloud::getFpfhFeatures, cached by both clouds).
+ * Random samples of three pairs, whose edge lengths agree, give rigid
+ * transforms, the one with the most inlier pairs is refit to all of its
+ * inliers. Samples are drawn in parallel, from per-iteration seeds.
+ *
+ * Run on downsampled clouds (\ref downsampleVoxelGrid), then refine the
+ * result by ICP (\ref registerPointToPlane) on the full clouds.
+ *
+ * Descriptors are considerably more distinctive from normals oriented
+ * consistently in both clouds, e.g. towards the sensors, than from estimated
+ * unoriented ones.
+ *
+ * \param[in] source Cloud to move, with normals, or they are estimated.
+ * \param[in] target Cloud to align to, with normals, or they are estimated.
+ * \param[in] params Sampling and descriptor options.
+ *
+ * \return The transform with the most inliers, identity if there are less than three matches.
+ */
+RansacResult
+registerRansac(
+    DecoratedCloud const& source,
+    DecoratedCloud const& target,
+    RansacParams   const& params = RansacParams());
+
+} //...ns acq
+
+#endif //ACQ_REGISTRATION_H
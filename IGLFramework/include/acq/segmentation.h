@@ -0,0 +1,98 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#ifndef ACQ_SEGMENTATION_H
+#define ACQ_SEGMENTATION_H
+
+#include "acq/typedefs.h"
+#include "acq/decoratedCloud.h"
+
+#include <vector>
+
+namespace acq {
+
+/** \brief Options of \ref segmentRegions. */
+struct SegmentationParams {
+    explicit SegmentationParams(double minNormalDot = 0.995, double maxCurvature = 0.05, int k = 10,
+                                unsigned nThreads = 0)
+        : minNormalDot(minNormalDot), maxCurvature(maxCurvature), minSegmentSize(1), k(k), nThreads(nThreads) {}
+
+    double   minNormalDot;   //!< Neighbours are joined, if their normals deviate less (cosine of the angle).
+    double   maxCurvature;   //!< Points of higher surface variation join segments, but do not connect them.
+    int      minSegmentSize; //!< Smaller segments are dropped, their points labelled -1.
+    int      k;              //!< Neighbours to connect points to, see \ref segmentRegions(DecoratedCloud&, SegmentationParams const&).
+    unsigned nThreads;       //!< Threads to use, 0: hardware concurrency.
+}; //...struct SegmentationParams
+
+/** \brief Statistics of a segment. */
+struct Segment {
+    int             size;          //!< Number of points.
+    Eigen::Vector3d centroid;      //!< Mean of the points.
+    Eigen::Vector3d normal;        //!< Mean of the normals, aligned to the first one.
+    double          meanCurvature; //!< Mean surface variation of the points.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct Segment
+
+//! List of segments, indexed by label.
+typedef std::vector<Segment, Eigen::aligned_allocator<Segment> > SegmentsT;
+
+/** \brief Surface variation of all points, lambda_0 / (lambda_0 + lambda_1 + lambda_2) of the
+ *         covariance of each point and its neighbours, 0 on planes, up to 1/3.
+ *
+ * \param[in] cloud      N x 3 matrix containing points in rows.
+ * \param[in] neighbours N x k neighbour ids, -1 entries are ignored, see \ref calculateCloudNeighbours.
+ * \param[in] nThreads   Threads to use, 0: hardware concurrency.
+ *
+ * \return N curvatures, 0 for points with less than two neighbours.
+ */
+Eigen::VectorXd
+calculateSurfaceVariation(
+    CloudConstRefT const& cloud,
+    KnnIndicesT    const& neighbours,
+    unsigned       const  nThreads = 0);
+
+/** \brief Splits a cloud into smooth patches along the neighbour graph.
+ *
+ * Same result as region growing from the flattest points (Rabbani et al.,
+ * "Segmentation of point clouds using smoothness constraint"), without its
+ * sequential front: neighbours with similar normals, both of curvature
+ * below \ref SegmentationParams::maxCurvature, are united in a lock-free
+ * union-find over all edges in parallel. Each curved point then joins the
+ * segment of its closest flat neighbour with a similar normal, so curved
+ * points never connect two segments. Roots are always the smallest point id
+ * of their set, so labels do not depend on the thread count.
+ *
+ * \param[in ] cloud      N x 3 matrix containing points in rows.
+ * \param[in ] normals    N x 3 normals of \p cloud, orientation does not matter.
+ * \param[in ] neighbours N x k neighbour ids, closest first, -1 entries are ignored.
+ * \param[out] labels     N, segment of each point, -1 for points of dropped segments.
+ * \param[in ] params     Thresholds.
+ *
+ * \return Statistics of the segments, in order of their smallest point id.
+ */
+SegmentsT
+segmentRegions(
+    CloudConstRefT     const& cloud,
+    NormalsConstRefT   const& normals,
+    KnnIndicesT        const& neighbours,
+    LabelsT                 & labels,
+    SegmentationParams const& params = SegmentationParams());
+
+/** \brief Segments a cloud along its \ref SegmentationParams::k nearest neighbours,
+ *         and stores the segment of each point as its labels.
+ *
+ * Uses the normals of the cloud, or normals estimated from the same neighbours
+ * (\ref calculateCloudNormals) if it has none.
+ */
+SegmentsT
+segmentRegions(
+    DecoratedCloud          & cloud,
+    SegmentationParams const& params = SegmentationParams());
+
+} //...ns acq
+
+#endif //ACQ_SEGMENTATION_H
@@ -0,0 +1,106 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#ifndef ACQ_SHAPEDETECTION_H
+#define ACQ_SHAPEDETECTION_H
+
+#include "acq/typedefs.h"
+#include "acq/decoratedCloud.h"
+
+#include <vector>
+
+namespace acq {
+
+/** \brief Kinds of shapes \ref detectPrimitives looks for. */
+enum PrimitiveType {
+    PLANE_PRIMITIVE = 0, //!< Infinite plane.
+    CYLINDER_PRIMITIVE   //!< Infinite circular cylinder.
+};
+
+/** \brief A detected shape. */
+struct Primitive {
+    /** \brief Distance of \p point from the surface. */
+    double getDistance(Eigen::Vector3d const& point) const;
+
+    /** \brief Unoriented surface normal at the closest surface point to \p point. */
+    Eigen::Vector3d getNormal(Eigen::Vector3d const& point) const;
+
+    PrimitiveType   type;      //!< Plane or cylinder.
+    Eigen::Vector3d point;     //!< Point on the plane, or on the axis of the cylinder.
+    Eigen::Vector3d direction; //!< Unit normal of the plane, or unit axis of the cylinder.
+    double          radius;    //!< Radius of the cylinder, 0 for planes.
+    int             nInliers;  //!< Points assigned to the shape.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct Primitive
+
+//! List of detected shapes.
+typedef std::vector<Primitive, Eigen::aligned_allocator<Primitive> > PrimitivesT;
+
+/** \brief Options of \ref detectPrimitives. */
+struct ShapeDetectionParams {
+    explicit ShapeDetectionParams(double epsilon = 0.01, int minSupport = 500, unsigned nThreads = 0)
+        : epsilon(epsilon), minNormalDot(0.9), minSupport(minSupport), maxRadius(0.), detectPlanes(true),
+          detectCylinders(true), samplesPerRound(64), maxFailedRounds(40), scoreSubset(1 << 13), normalK(10),
+          seed(0), nThreads(nThreads) {}
+
+    double   epsilon;         //!< Inliers are closer to the surface.
+    double   minNormalDot;    //!< Inliers' normals deviate less from the surface normal (cosine of the angle).
+    int      minSupport;      //!< Shapes with fewer inliers are not accepted.
+    double   maxRadius;       //!< Cylinders of larger radius are not considered, 0: the extent of the cloud.
+    bool     detectPlanes;    //!< Look for planes.
+    bool     detectCylinders; //!< Look for cylinders.
+    int      samplesPerRound; //!< Minimal sets drawn per round, each yields one candidate per shape type.
+    int      maxFailedRounds; //!< Stop after this many rounds in a row without an accepted shape.
+    int      scoreSubset;     //!< Candidates are compared on this many random unassigned points.
+    int      normalK;         //!< Neighbours to estimate normals from, if the cloud has none.
+    unsigned seed;            //!< Seed of the sampling, results only depend on it, not on \ref nThreads.
+    unsigned nThreads;        //!< Threads to use, 0: hardware concurrency.
+}; //...struct ShapeDetectionParams
+
+/** \brief Detects planes and cylinders by RANSAC with localized sampling
+ *         (Schnabel et al., "Efficient RANSAC for Point-Cloud Shape Detection").
+ *
+ * Minimal point sets are drawn from one cell of an octree around a random
+ * first point, at a random depth, so the points likely lie on the same
+ * shape also when it covers a small part of the cloud. The octree is
+ * implicit: points sorted along the Z-order curve (\ref calculateMortonOrder),
+ * each cell is a range of codes sharing a prefix. Candidates are verified by
+ * the normals of their minimal sets, scored in parallel on a random subset of
+ * the unassigned points, and only the best is evaluated on all of them.
+ * Accepted shapes are refit to their inliers, which are removed from further
+ * sampling.
+ *
+ * Inliers are not split into connected components, e.g. coplanar walls
+ * become one plane.
+ *
+ * \param[in ] cloud   N x 3 matrix containing points in rows, non-finite points are ignored.
+ * \param[in ] normals N x 3 normals of \p cloud, e.g. from \ref calculateCloudNormals.
+ * \param[out] labels  N, index of the shape each point was assigned to, -1 for none.
+ * \param[in ] params  Thresholds and sampling options.
+ *
+ * \return The detected shapes, in the order they were found.
+ */
+PrimitivesT
+detectPrimitives(
+    CloudConstRefT       const& cloud,
+    NormalsConstRefT     const& normals,
+    LabelsT                   & labels,
+    ShapeDetectionParams const& params = ShapeDetectionParams());
+
+/** \brief Detects shapes in a cloud and stores the shape index of each point as its labels.
+ *
+ * Uses the normals of the cloud, or normals estimated from the \ref ShapeDetectionParams::normalK
+ * nearest neighbours (\ref calculateCloudNormals) if it has none.
+ */
+PrimitivesT
+detectPrimitives(
+    DecoratedCloud            & cloud,
+    ShapeDetectionParams const& params = ShapeDetectionParams());
+
+} //...ns acq
+
+#endif //ACQ_SHAPEDETECTION_H
@@ -0,0 +1,298 @@
+//
+// Created by bontius on 13/02/17.
+//
+
+#ifndef ACQ_SOAKDTREE_H
+#define ACQ_SOAKDTREE_H
+
+#include "acq/typedefs.h"
+#include "acq/pointStorage.h"
+#include "acq/knnResult.h"
+
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace acq {
+
+/** \brief Instruction set used to scan kd-tree leaves. */
+enum SimdLevel {
+    SIMD_SCALAR = 0, //!< Plain C++, whatever the compiler vectorizes.
+    SIMD_AVX2,       //!< 256 bit lanes with FMA.
+    SIMD_AVX512      //!< 512 bit lanes (AVX-512F).
+};
+
+/** \brief Best instruction set supported by the CPU running the program. */
+SimdLevel detectSimdLevel();
+
+/** \brief Human readable name of \p level, e.g. "avx2". */
+char const* getSimdLevelName(SimdLevel level);
+
+/** \brief Construction options of \ref SoaKdTreeT. */
+struct KdTreeBuildParams {
+    explicit KdTreeBuildParams(int maxLeafs = 10, unsigned nThreads = 0, int medianSamples = 0)
+        : maxLeafs(maxLeafs), nThreads(nThreads), medianSamples(medianSamples) {}
+
+    int      maxLeafs;      //!< Maximum number of points in a leaf node.
+    unsigned nThreads;      //!< Threads building subtrees, 0: hardware concurrency, 1: serial.
+    int      medianSamples; //!< Split at the median of this many random samples, 0: exact median.
+}; //...struct KdTreeBuildParams
+
+/** \brief Query options trading accuracy for speed, the defaults search exactly. */
+struct KnnSearchParams {
+    explicit KnnSearchParams(float eps = 0.f, int maxLeafVisits = 0)
+        : eps(eps), maxLeafVisits(maxLeafVisits) {}
+
+    /** \brief True, if results are exact. */
+    bool isExact() const { return eps <= 0.f && maxLeafVisits <= 0; }
+
+    float eps;           //!< Skip cells farther than the current k-th neighbour divided by (1 + eps),
+                         //!< neighbours are then at most (1 + eps) times farther than the true ones.
+    int   maxLeafVisits; //!< Stop backtracking after this many leaves, once k neighbours are found, 0: unlimited.
+}; //...struct KnnSearchParams
+
+/** \brief 3D kd-tree storing the points of each leaf as a structure of arrays.
+ *
+ * Points are reordered at build time, so that the points of a leaf are
+ * consecutive in three separate x, y and z arrays. A leaf is then scanned by
+ * evaluating the distances to all of its points in SIMD lanes, instead of
+ * point by point, using the best kernel the CPU supports (chosen at runtime,
+ * see \ref detectSimdLevel). Splits are at the median of the dimension with
+ * the largest extent, traversal is depth-first with incremental distances to
+ * the cells like nanoflann.
+ *
+ * Large subtrees are built in parallel. The exact median may be replaced by
+ * the median of a random sample (\ref KdTreeBuildParams::medianSamples),
+ * turning each split from an nth_element into a single partitioning pass.
+ *
+ * \tparam _Scalar Floating point type, float (8/16 lanes) or double (4/8 lanes).
+ */
+template <typename _Scalar>
+class SoaKdTreeT {
+public:
+    //! Floating point type
+    typedef _Scalar Scalar;
+    //! Point dimensions
+    enum { Dim = 3 };
+    //! Receives the neighbours of one point: point id, neighbour count, ids and squared distances, closest first.
+    typedef std::function<void(std::size_t, std::size_t, std::size_t const*, Scalar const*)> KnnSinkT;
+    //! Kernel computing squared distances of \p n points in SoA layout to \p query.
+    typedef void (*LeafKernelT)(
+        Scalar const* x, Scalar const* y, Scalar const* z,
+        int n, Scalar const* query, Scalar* distsSqr);
+
+    /** \brief Empty tree. */
+    SoaKdTreeT();
+
+    /** \brief Builds the tree.
+     *
+     * \param[in] points   Points to index, copied.
+     * \param[in] maxLeafs Maximum number of points in a leaf node.
+     */
+    explicit SoaKdTreeT(PointStorageT<Scalar> const& points, int maxLeafs = 10);
+
+    /** \brief Builds the tree.
+     *
+     * \param[in] points Points to index, copied.
+     * \param[in] params Leaf size, threads and split heuristic.
+     */
+    SoaKdTreeT(PointStorageT<Scalar> const& points, KdTreeBuildParams const& params);
+
+    /** \brief (Re)builds the tree on \p points. */
+    void build(PointStorageT<Scalar> const& points, int maxLeafs = 10);
+
+    /** \brief (Re)builds the tree on \p points with options \p params. */
+    void build(PointStorageT<Scalar> const& points, KdTreeBuildParams const& params);
+
+    /** \brief Find the \p k nearest neighbours of \p query.
+     *
+     * \param[in ] query     Pointer to 3 contiguous coordinates.
+     * \param[in ] k         How many neighbours to look for.
+     * \param[out] indices   At least \p k long, receives point ids of neighbours, closest first.
+     * \param[out] distsSqr  At least \p k long, receives squared distances of neighbours.
+     * \param[in ] params    Approximation options, exact by default.
+     *
+     * \return The number of neighbours found, less than \p k only for small clouds.
+     */
+    std::size_t
+    knnSearch(
+        Scalar          const* query,
+        int                    k,
+        std::size_t          * indices,
+        Scalar               * distsSqr,
+        KnnSearchParams const& params = KnnSearchParams()) const;
+
+    /** \brief Continues a search, adding the points closer than the worst neighbour in \p result.
+     *
+     * Lets several trees contribute to one result, e.g. the levels of \ref DynamicKdTreeT.
+     *
+     * \param[in    ] query   Pointer to 3 contiguous coordinates.
+     * \param[in,out] result  Neighbours found so far.
+     * \param[in    ] removed Optional flags indexed by reported point id, flagged points are skipped.
+     * \param[in    ] params  Approximation options, exact by default.
+     */
+    void
+    knnSearch(
+        Scalar            const* query,
+        KnnResultT<Scalar>     & result,
+        std::vector<bool> const* removed = nullptr,
+        KnnSearchParams   const& params  = KnnSearchParams()) const;
+
+    /** \brief Finds the \p k nearest neighbours of every indexed point (self-join).
+     *
+     * Queries are processed leaf by leaf: the points of a leaf traverse the
+     * tree together, pruning nodes farther from their bounding box than the
+     * worst of their current neighbours, which is much less work than a
+     * descent per point. Results equal those of \ref knnSearch per point,
+     * up to the order of neighbours at equal distance.
+     *
+     * \param[in ] k        How many neighbours to look for, the point itself included.
+     * \param[out] indices  N x k row-major, row i receives the neighbours of point i, closest first.
+     * \param[out] distsSqr N x k row-major, squared distances of \p indices.
+     * \param[out] counts   N long, number of neighbours found for each point, \p k unless the tree is smaller.
+     * \param[in ] nThreads Threads to use, 0: hardware concurrency.
+     *
+     * \note Rows are indexed by point id, do not use on relabeled trees.
+     */
+    void
+    allKnnSearch(
+        int           k,
+        std::size_t * indices,
+        Scalar      * distsSqr,
+        std::size_t * counts,
+        unsigned      nThreads = 0) const;
+
+    /** \brief Self-join handing the neighbours of each point to \p sink instead of filling arrays.
+     *
+     * \param[in] k        How many neighbours to look for, the point itself included.
+     * \param[in] sink     Called once per point, concurrently from \p nThreads threads.
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     */
+    void
+    allKnnSearch(
+        int             k,
+        KnnSinkT const& sink,
+        unsigned        nThreads = 0) const;
+
+    /** \brief Renames points, point i is reported as \p labels[i] from now on. */
+    void relabel(std::vector<std::size_t> const& labels);
+
+    /** \brief Number of points indexed. */
+    int size() const { return static_cast<int>(_ids.size()); }
+
+    /** \brief Bytes allocated by the nodes, the coordinates in tree order and the ids. */
+    std::size_t getMemoryFootprint() const {
+        return _nodes.capacity() * sizeof(Node) + _soa.size() * sizeof(Scalar) + _ids.capacity() * sizeof(std::size_t);
+    }
+
+    /** \brief Instruction set leaves are scanned with. */
+    SimdLevel getSimdLevel() const { return _simdLevel; }
+
+    /** \brief Force a kernel, e.g. for comparisons, clamped to what the CPU supports. */
+    void setSimdLevel(SimdLevel level);
+
+protected:
+    /** \brief A node of the tree, a leaf, if \ref child[0] is negative. */
+    struct Node {
+        int    child[2]; //!< Indices of the children in \ref _nodes, -1 for leaves.
+        int    begin;    //!< First point (in tree order) of the subtree.
+        int    end;      //!< One past the last point (in tree order) of the subtree.
+        int    dim;      //!< Split dimension.
+        Scalar divLow;   //!< Largest coordinate along \ref dim in the left child.
+        Scalar divHigh;  //!< Smallest coordinate along \ref dim in the right child.
+    }; //...struct Node
+
+    //! Sorted list of the best neighbours so far.
+    typedef KnnResultT<Scalar> KnnResult;
+
+    /** \brief Partitions ids [\p begin, \p end) along \p dim, returns the first id of the right half. */
+    int splitRange(
+        std::vector<int>           & ids,
+        int                          begin,
+        int                          end,
+        PointStorageT<Scalar> const& points,
+        int                          dim,
+        int                          medianSamples) const;
+
+    /** \brief Recursively builds the node covering ids [\p begin, \p end) into \p nodes.
+     *
+     * The split dimension is the longest side of the cell [\p cellLow, \p cellHigh].
+     * Subtrees are built in parallel on the top \p forkDepth levels.
+     *
+     * \return Index of the node in \p nodes.
+     */
+    int buildLevel(
+        std::vector<Node>          & nodes,
+        std::vector<int>           & ids,
+        int                          begin,
+        int                          end,
+        PointStorageT<Scalar> const& points,
+        Scalar                const* cellLow,
+        Scalar                const* cellHigh,
+        int                          medianSamples,
+        int                          forkDepth) const;
+
+    /** \brief State of one query, shared by the levels of the recursion. */
+    struct SearchContext {
+        KnnResult              & result;       //!< Neighbours found so far.
+        Scalar            const* query;        //!< Query coordinates.
+        Scalar                 * cellDistsSqr; //!< Per dimension squared distance to the current cell.
+        Scalar                 * leafDistsSqr; //!< Leaf distance buffer, padded for SIMD stores.
+        std::vector<bool> const* removed;      //!< Optional flags of points to skip.
+        Scalar                   pruneScale;   //!< (1 + eps)^2, cells are visited, if closer than worst / pruneScale.
+        int                      leavesLeft;   //!< Leaf visits left before backtracking stops.
+    }; //...struct SearchContext
+
+    /** \brief State of the joint query of the points of a leaf. */
+    struct BatchContext {
+        /** \brief Context of the queries of leaf \p skipNodeId, starting at \p begin, with zero cell distances. */
+        BatchContext(std::vector<KnnResult>& results, int begin, int skipNodeId, Scalar* leafDistsSqr)
+            : results(results), begin(begin), skipNodeId(skipNodeId), boxLow(), boxHigh(), cellDistsSqr(),
+              bound(std::numeric_limits<Scalar>::max()), leafDistsSqr(leafDistsSqr) {}
+
+        std::vector<KnnResult>& results;           //!< Neighbours found so far, one per query.
+        int                     begin;             //!< First query point in tree order.
+        int                     skipNodeId;        //!< Leaf of the queries, scanned before the traversal.
+        Scalar                  boxLow[Dim];       //!< Bounding box minimum of the queries.
+        Scalar                  boxHigh[Dim];      //!< Bounding box maximum of the queries.
+        Scalar                  cellDistsSqr[Dim]; //!< Per dimension squared distance of the box to the current cell.
+        Scalar                  bound;             //!< Largest worst squared distance of the queries.
+        Scalar                * leafDistsSqr;      //!< Leaf distance buffer, padded for SIMD stores.
+    }; //...struct BatchContext
+
+    /** \brief Adds the points of leaf \p nodeId to the results of all queries of \p context. */
+    void scanLeafBatch(BatchContext& context, int nodeId) const;
+
+    /** \brief Recursive depth-first search below \p nodeId for the queries of a leaf. */
+    void searchLevelBatch(
+        BatchContext& context,
+        int           nodeId,
+        Scalar        minDistSqr) const;
+
+    /** \brief Recursive depth-first search below \p nodeId. */
+    void searchLevel(
+        SearchContext& context,
+        int            nodeId,
+        Scalar         minDistSqr) const;
+
+    //! Column-major N+padding x 3 matrix, each column is one coordinate of all points in tree order.
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Dim> SoaT;
+
+    std::vector<Node>        _nodes;         //!< Tree nodes, root first.
+    SoaT                     _soa;           //!< Coordinates in tree order, padded for full SIMD loads.
+    std::vector<std::size_t> _ids;           //!< Original index of each point in tree order.
+    Scalar                   _bboxLow[Dim];  //!< Bounding box minimum.
+    Scalar                   _bboxHigh[Dim]; //!< Bounding box maximum.
+    int                      _maxLeafs;      //!< Leaf size limit.
+    SimdLevel                _simdLevel;     //!< Instruction set of \ref _kernel.
+    LeafKernelT              _kernel;        //!< Leaf distance kernel.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...class SoaKdTreeT
+
+} //...ns acq
+
+#endif //ACQ_SOAKDTREE_H
@@ -0,0 +1,142 @@
+//
+// Created by bontius on 14/02/17.
+//
+
+#ifndef ACQ_SPATIALORDER_H
+#define ACQ_SPATIALORDER_H
+
+#include "acq/typedefs.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace acq {
+
+/** \addtogroup SpatialOrder
+ *  @{
+ */
+
+/** \brief Z-order (Morton) codes of points, 21 bits per dimension.
+ *
+ * Coordinates are quantized over the bounding box of \p cloud, and the bits
+ * of the three quantized coordinates are interleaved, so that sorting by code
+ * places points close in space close in memory.
+ * The bounding box only spans the finite points, points with non-finite
+ * coordinates (e.g. invalid pixels of depth frames) get the largest possible
+ * code, so they sort last.
+ *
+ * \param[in] cloud    N x 3 matrix containing points in rows.
+ * \param[in] nThreads Threads to use, 0: hardware concurrency.
+ *
+ * \return N codes, one per point.
+ */
+std::vector<std::uint64_t>
+calculateMortonCodes(
+    CloudConstRefT const& cloud,
+    unsigned       const  nThreads = 0);
+
+/** \brief Z-order (Morton) code of integer cell coordinates, the lower 21 bits of each are interleaved. */
+std::uint64_t
+calculateMortonCode(
+    std::uint32_t const x,
+    std::uint32_t const y,
+    std::uint32_t const z);
+
+/** \brief Sorts \p keys with a parallel LSD radix sort, stable for equal keys.
+ *
+ * \param[in,out] keys     Keys to sort, ascending on return.
+ * \param[in    ] keyBits  Number of lowest bits compared, fewer bits take fewer passes.
+ * \param[in    ] nThreads Threads to use, 0: hardware concurrency.
+ *
+ * \return Permutation, entry i is the original index of the i-th key after sorting.
+ */
+PermutationT
+sortKeys(
+    std::vector<std::uint64_t>      & keys,
+    int                        const  keyBits  = 64,
+    unsigned                   const  nThreads = 0);
+
+/** \brief Order of points along the Z-order curve.
+ *
+ * Sorts \ref calculateMortonCodes with a parallel LSD radix sort, stable for equal codes.
+ *
+ * \param[in] cloud    N x 3 matrix containing points in rows.
+ * \param[in] nThreads Threads to use, 0: hardware concurrency.
+ *
+ * \return Permutation, entry i is the row in \p cloud of the i-th point along the curve.
+ */
+PermutationT
+calculateMortonOrder(
+    CloudConstRefT const& cloud,
+    unsigned       const  nThreads = 0);
+
+/** \brief Inverse of \p order, entry i is the new row of original row i. */
+PermutationT
+invertPermutation(
+    PermutationT const& order);
+
+/** \brief Gathers rows, row i of the result is row order(i) of \p matrix.
+ *
+ * \tparam _MatrixT Concept: acq::CloudT, acq::NormalsT or acq::FacesT.
+ */
+template <typename _MatrixT>
+_MatrixT
+permuteRows(
+    _MatrixT     const& matrix,
+    PermutationT const& order);
+
+/** \brief Scatters rows back, undoing \ref permuteRows:
+ *         row order(i) of the result is row i of \p matrix.
+ *
+ * Use to map results computed on a reordered cloud to the original order.
+ * \p order has to be a permutation, see the overload below for clouds that lost points.
+ *
+ * \tparam _MatrixT Concept: acq::CloudT, acq::NormalsT or acq::FacesT.
+ */
+template <typename _MatrixT>
+_MatrixT
+restoreRows(
+    _MatrixT     const& matrix,
+    PermutationT const& order);
+
+/** \brief Scatters rows back into \p originalCount rows, row order(i) of the result is row i of \p matrix.
+ *
+ * Use after \ref DecoratedCloud::keepPoints, passing its \ref DecoratedCloud::getOriginalPointCount.
+ * Rows of removed points, the ones missing from \p order, are set to \p fillValue,
+ * pick one that cannot be a result, e.g. NaN or -1.
+ *
+ * \tparam _MatrixT Concept: acq::CloudT, acq::NormalsT or acq::FacesT.
+ */
+template <typename _MatrixT>
+_MatrixT
+restoreRows(
+    _MatrixT                  const& matrix,
+    PermutationT              const& order,
+    int                              originalCount,
+    typename _MatrixT::Scalar        fillValue);
+
+/** \brief Renumbers the vertex indices of faces after the vertices were reordered by \p order. */
+FacesT
+remapFaces(
+    FacesConstMapT const& faces,
+    PermutationT   const& order);
+
+/** \brief Renumbers keys and values of a neighbourhood.
+ *
+ * \param[in] neighbours Neighbour lists of points.
+ * \param[in] newIds     Entry i is the new id of point i, pass the order of a
+ *                       reordered cloud to translate its neighbourhood back to
+ *                       the original ids.
+ *
+ * \return The same neighbourhood with renamed points.
+ */
+NeighboursT
+remapNeighbours(
+    NeighboursT  const& neighbours,
+    PermutationT const& newIds);
+
+/** @} (SpatialOrder) */
+
+} //...ns acq
+
+#endif //ACQ_SPATIALORDER_H
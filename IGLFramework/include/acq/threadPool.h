@@ -0,0 +1,60 @@
+//
+// Created by bontius on 06/02/17.
+//
+
+#ifndef ACQ_THREADPOOL_H
+#define ACQ_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace acq {
+
+/** \brief Fixed size pool of worker threads executing submitted tasks in FIFO order. */
+class ThreadPool {
+public:
+    /** \brief Starts \p nThreads workers, 0 means one per hardware thread. */
+    explicit ThreadPool(unsigned nThreads = 0);
+
+    /** \brief Finishes all queued tasks, then joins the workers. */
+    ~ThreadPool();
+
+    /** \brief Enqueue a task for execution on one of the workers.
+     *
+     * \tparam _FunctorT Concept: callable without arguments.
+     *
+     * \param[in] task Task to execute, exceptions thrown are stored in the returned future.
+     *
+     * \return Future to the return value of \p task.
+     */
+    template <typename _FunctorT>
+    std::future<typename std::result_of<_FunctorT()>::type>
+    submit(_FunctorT&& task);
+
+    /** \brief Number of worker threads. */
+    unsigned size() const { return static_cast<unsigned>(_workers.size()); }
+
+protected:
+    /** \brief Worker loop popping and running tasks until the pool is stopped. */
+    void work();
+
+    std::vector<std::thread>          _workers; //!< Worker threads.
+    std::queue<std::function<void()>> _tasks;   //!< Tasks waiting for a worker.
+    std::mutex                        _mutex;   //!< Guards \ref _tasks and \ref _stop.
+    std::condition_variable           _wakeUp;  //!< Signalled on new task or stop.
+    bool                              _stop;    //!< Set, when workers should exit after draining the queue.
+
+private:
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+}; //...class ThreadPool
+
+} //...ns acq
+
+#endif //ACQ_THREADPOOL_H
@@ -0,0 +1,145 @@
+//
+// Created by bontius on 17/02/17.
+//
+
+#ifndef ACQ_TSDFVOLUME_H
+#define ACQ_TSDFVOLUME_H
+
+#include "acq/typedefs.h"
+#include "acq/decoratedCloud.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace acq {
+
+/** \brief Truncated signed distance volume fusing scans into one surface.
+ *
+ * Voxels are only allocated close to the integrated points, in blocks of
+ * 8 x 8 x 8 looked up by a hash table of their block coordinates (Niessner et al.,
+ * "Real-time 3D Reconstruction at Scale using Voxel Hashing"), so memory grows
+ * with the scanned surface area instead of the bounding volume.
+ *
+ * Each point updates the voxels along its normal, up to the truncation distance
+ * in front of and behind the surface, with their distance from its tangent
+ * plane. Depth frames get normals estimated and oriented towards the sensor
+ * first, distances along the viewing rays would have the wrong sign beside
+ * surfaces seen at grazing angles. Each slab of voxels the line
+ * crosses gets a bilinear splat to the 2 x 2 voxels closest to it, so lines of
+ * neighbouring points leave no gaps. Every voxel keeps a running weighted
+ * average of the signed distances it was given, positive outside.
+ *
+ * Integration is parallel: the updates of a batch of points are computed per
+ * chunk of points, counting sorted by the blocks the batch touches, then
+ * applied per chunk of those blocks, so a batch costs nothing for the rest
+ * of the volume.
+ * \ref extractMesh triangulates the zero crossing.
+ */
+class TsdfVolume {
+public:
+    //! Bits of voxel coordinates within a block.
+    enum { BlockBits = 3 };
+    //! Voxels along the side of a block.
+    enum { BlockSide = 1 << BlockBits };
+    //! Voxels in a block.
+    enum { BlockVoxels = BlockSide * BlockSide * BlockSide };
+
+    /** \brief Empty volume.
+     *
+     * \param[in] voxelSize  Side length of voxels, about the point spacing of the scans.
+     * \param[in] truncation Distance from the surface beyond which distances are not stored, 0: 4 voxels.
+     * \param[in] maxWeight  Cap of the accumulated weight of a voxel, lower values adapt faster to change.
+     */
+    explicit TsdfVolume(double voxelSize, double truncation = 0., float maxWeight = 64.f);
+
+    /** \brief Fuses an oriented cloud, updating voxels along the normals.
+     *
+     * \param[in] points   N x 3 matrix containing points in rows, non-finite points are skipped.
+     * \param[in] normals  N x 3 outward facing normals of \p points, e.g. oriented by \ref orientCloudNormals.
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     */
+    void integrate(CloudConstRefT const& points, NormalsConstRefT const& normals, unsigned nThreads = 0);
+
+    /** \brief Fuses a depth frame, estimating normals (kNN) and orienting them towards the sensor.
+     *
+     * \param[in] points       N x 3 matrix containing points in rows, non-finite points are skipped.
+     * \param[in] sensorOrigin Position of the sensor in the coordinate frame of \p points.
+     * \param[in] nThreads     Threads to use, 0: hardware concurrency.
+     */
+    void integrateFrame(CloudConstRefT const& points, Eigen::Vector3d const& sensorOrigin, unsigned nThreads = 0);
+
+    /** \brief Fuses a cloud along its normals if it has any,
+     *         otherwise as a depth frame seen from the origin,
+     *         normals from integral images if it is organized (see \ref DecoratedCloud::setGridSize).
+     */
+    void integrate(DecoratedCloud const& cloud, unsigned nThreads = 0);
+
+    /** \brief Triangulates the zero crossing of the observed voxels (naive surface nets).
+     *
+     * One vertex per cell of 2 x 2 x 2 voxels with a sign change, at the mean of
+     * the crossings along its edges, two triangles per voxel edge crossing the surface.
+     *
+     * \param[in] nThreads Threads to use, 0: hardware concurrency.
+     *
+     * \return Vertices, triangles, and outward normals from the distance gradient.
+     */
+    DecoratedCloud extractMesh(unsigned nThreads = 0) const;
+
+    /** \brief Drops all voxels. */
+    void clear();
+
+    /** \brief Number of allocated blocks. */
+    std::size_t getBlockCount() const { return _blocks.size(); }
+
+    /** \brief Bytes of voxel memory allocated. */
+    std::size_t getMemoryFootprint() const { return _blocks.size() * (sizeof(Block) + sizeof(BlockCoordT)); }
+
+    /** \brief Side length of voxels. */
+    double getVoxelSize() const { return _voxelSize; }
+
+    /** \brief Distance from the surface beyond which distances are not stored. */
+    double getTruncation() const { return _truncation; }
+
+protected:
+    //! Integer coordinates of a block, voxel coordinates divided by \ref BlockSide.
+    typedef Eigen::Vector3i BlockCoordT;
+    //! Packed \ref BlockCoordT, 21 bits per dimension.
+    typedef std::uint64_t BlockKeyT;
+
+    /** \brief Voxels of a block, x fastest. */
+    struct Block {
+        float tsdf  [BlockVoxels]; //!< Signed distance divided by the truncation, in [-1, 1].
+        float weight[BlockVoxels]; //!< Accumulated weight, 0: unobserved.
+    }; //...struct Block
+
+    /** \brief Update of a voxel by a point. */
+    struct Sample {
+        std::uint64_t block;  //!< \ref BlockKeyT while computed, then block index.
+        int           voxel;  //!< Voxel index in the block.
+        float         tsdf;   //!< Truncated signed distance divided by the truncation.
+        float         weight; //!< Weight of the update, closeness of the voxel to the line.
+    }; //...struct Sample
+
+    /** \brief Packs block coordinates into a hash key. */
+    static BlockKeyT getBlockKey(BlockCoordT const& block);
+
+    /** \brief Index of block \p key, -1 if not allocated. */
+    int findBlock(BlockKeyT key) const;
+
+    /** \brief Indices of the 3 x 3 x 3 blocks around block \p blockId, -1 where not allocated, x fastest. */
+    void getNeighbourBlocks(int blockId, int neighbours[27]) const;
+
+    double                             _voxelSize;   //!< Side length of voxels.
+    double                             _truncation;  //!< Truncation distance.
+    float                              _maxWeight;   //!< Cap of the voxel weights.
+    std::vector<Block>                 _blocks;      //!< Allocated blocks.
+    std::vector<BlockCoordT>           _blockCoords; //!< Coordinates of each block.
+    std::unordered_map<BlockKeyT, int> _blockIds;    //!< Index of each allocated block.
+    std::vector<int>                   _batchIds;    //!< Scratch: dense id of each block in the current batch, -1 between batches.
+}; //...class TsdfVolume
+
+} //...ns acq
+
+#endif //ACQ_TSDFVOLUME_H
@@ -29,6 +29,36 @@ typedef Eigen::MatrixXd NormalsT;
 //! Dynamically sized matrix of face vertex indices in rows.
 typedef Eigen::MatrixXi FacesT;
 
+//! Single precision point cloud, e.g. as read from scanners.
+typedef Eigen::MatrixXf CloudFT;
+//! Single precision list of normals.
+typedef Eigen::MatrixXf NormalsFT;
+
+//! Read-only view of a point cloud living in memory owned elsewhere.
+typedef Eigen::Map<CloudT const>   CloudConstMapT;
+//! Read-only view of a list of normals living in memory owned elsewhere.
+typedef Eigen::Map<NormalsT const> NormalsConstMapT;
+//! Read-only view of a list of faces living in memory owned elsewhere.
+typedef Eigen::Map<FacesT const>   FacesConstMapT;
+
+//! Read-only reference to a point cloud, binds both to \ref CloudT and \ref CloudConstMapT without copying.
+typedef Eigen::Ref<CloudT const>   CloudConstRefT;
+//! Read-only reference to a list of normals, binds both to \ref NormalsT and \ref NormalsConstMapT without copying.
+typedef Eigen::Ref<NormalsT const> NormalsConstRefT;
+
+//! Reordering of points, entry i is the original row of the point now at row i.
+typedef Eigen::VectorXi PermutationT;
+//! Read-only view of a reordering.
+typedef Eigen::Map<PermutationT const> PermutationConstMapT;
+
+//! Integer label of each point, e.g. the primitive or segment it belongs to, -1 if none.
+typedef Eigen::VectorXi LabelsT;
+//! Read-only view of point labels.
+typedef Eigen::Map<LabelsT const> LabelsConstMapT;
+
+//! Neighbour indices of query points in rows, -1 where fewer neighbours were found.
+typedef Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> KnnIndicesT;
+
 /** \brief An associative storage of neighbour indices for point cloud
  * { pointId => [neighbourId_0, nId_1, ... nId_k-1] }
  */
@@ -0,0 +1,142 @@
+//
+// Created by bontius on 15/02/17.
+//
+
+#ifndef ACQ_VOXELGRID_H
+#define ACQ_VOXELGRID_H
+
+#include "acq/typedefs.h"
+#include "acq/pointStorage.h"
+#include "acq/knnResult.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace acq {
+
+/** \brief Uniform grid of cubic cells over a cloud, hashed, for neighbour lookups.
+ *
+ * Cells are hashed into a table with about as many buckets as points, blocks of
+ * neighbouring cells to consecutive buckets, and the points are radix sorted
+ * by bucket (\ref sortKeys), so building is linear and parallel.
+ * The points of a bucket are consecutive (structure of arrays), together with
+ * the key of their cell, which filters out points of other cells hashed to
+ * the same bucket. Points with non-finite coordinates, e.g. invalid pixels of
+ * an organized cloud, are not indexed and never found.
+ *
+ * kNN queries visit shells of cells around the query cell, until the
+ * neighbours found are closer than any unvisited cell. For dense, roughly
+ * uniform clouds with a cell size close to the neighbourhood radius, this
+ * touches one or two shells, and is faster than descending a tree. For very
+ * uneven clouds use \ref KdTreeT.
+ *
+ * \tparam _Scalar Floating point type of the stored coordinates, float or double.
+ */
+template <typename _Scalar>
+class VoxelGridT {
+public:
+    //! Floating point type
+    typedef _Scalar Scalar;
+    //! Storage type of the indexed points
+    typedef PointStorageT<Scalar> PointStorageType;
+    //! Point dimensions
+    enum { Dim = 3 };
+
+    /** \brief Builds the grid.
+     *
+     * \param[in] cloud    N x 3 matrix containing points in rows, of any floating point type.
+     * \param[in] cellSize Side length of cells, chosen from the point density if not positive.
+     * \param[in] nThreads Threads to build with, 0: hardware concurrency.
+     */
+    template <typename _Derived>
+    explicit VoxelGridT(Eigen::MatrixBase<_Derived> const& cloud, Scalar cellSize = 0, unsigned nThreads = 0)
+        : VoxelGridT(PointStorageType(cloud), cellSize, nThreads) {}
+
+    /** \brief Builds the grid taking over already converted points. */
+    explicit VoxelGridT(PointStorageType&& points, Scalar cellSize = 0, unsigned nThreads = 0);
+
+    /** \brief Find the \p k nearest neighbours of \p query.
+     *
+     * \param[in ] query     Pointer to 3 contiguous coordinates.
+     * \param[in ] k         How many neighbours to look for.
+     * \param[out] indices   At least \p k long, receives row ids of neighbours, closest first.
+     * \param[out] distsSqr  At least \p k long, receives squared distances of neighbours.
+     *
+     * \return The number of neighbours found, less than \p k only for small clouds.
+     */
+    std::size_t
+    knnSearch(
+        Scalar const* query,
+        int           k,
+        std::size_t * indices,
+        Scalar      * distsSqr) const;
+
+    /** \brief Find all points closer than \p radius to \p query.
+     *
+     * \param[in ] query     Pointer to 3 contiguous coordinates.
+     * \param[in ] radius    Search radius.
+     * \param[out] matches   Cleared, then receives (row id, squared distance) pairs, unordered.
+     *
+     * \return The number of points found.
+     */
+    std::size_t
+    radiusSearch(
+        Scalar                                  const* query,
+        Scalar                                  const  radius,
+        std::vector<std::pair<std::size_t, Scalar> > & matches) const;
+
+    /** \brief The points the grid was built on, in their original order. */
+    PointStorageType const& getPoints() const { return _points; }
+
+    /** \brief Number of points the grid was built on, non-finite ones included. */
+    int size() const { return _points.size(); }
+
+    /** \brief Side length of the cells. */
+    Scalar getCellSize() const { return _cellSize; }
+
+protected:
+    //! Integer cell coordinates
+    typedef Eigen::Matrix<int, Dim, 1> CellT;
+    //! Column-major N x 3 matrix, each column is one coordinate of all points in bucket order.
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Dim> SoaT;
+
+    /** \brief Cell containing \p point, not clamped to the grid. */
+    CellT getCell(Scalar const* point) const;
+
+    /** \brief Squared distance of \p point from the closest point of \p cell. */
+    Scalar getCellDistSqr(CellT const& cell, Scalar const* point) const;
+
+    /** \brief Unique key of a cell inside the grid. */
+    static std::uint64_t getCellKey(CellT const& cell);
+
+    /** \brief Hash table bucket of a cell. */
+    std::size_t getBucket(CellT const& cell) const;
+
+    /** \brief Calls \p visit(index, distSqr) for the points of \p cell, if inside the grid. */
+    template <typename _VisitorT>
+    void scanCell(CellT const& cell, Scalar const* query, _VisitorT& visit) const;
+
+    PointStorageType           _points;      //!< Copy of the points in original order.
+    SoaT                       _soa;         //!< Coordinates in bucket order.
+    std::vector<std::size_t>   _ids;         //!< Original row of each point in bucket order.
+    std::vector<std::uint64_t> _keys;        //!< Cell key of each point in bucket order.
+    std::vector<int>           _bucketStart; //!< First point of each bucket, one extra entry at the end.
+    Eigen::Matrix<Scalar, Dim, 1> _origin;   //!< Minimum corner of cell (0,0,0).
+    CellT                      _cellCount;   //!< Number of cells along each axis.
+    Scalar                     _cellSize;    //!< Side length of cells.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...class VoxelGridT
+
+//! Double precision voxel grid, matching \ref CloudT.
+typedef VoxelGridT<CloudT::Scalar> VoxelGrid;
+//! Single precision voxel grid.
+typedef VoxelGridT<float>          VoxelGridF;
+
+} //...ns acq
+
+#endif //ACQ_VOXELGRID_H
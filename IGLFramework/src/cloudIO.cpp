@@ -0,0 +1,118 @@
+//
+// Created by bontius on 08/02/17.
+//
+
+#include "acq/cloudIO.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+namespace acq {
+
+namespace {
+
+//! File signature, "ACQC"
+std::uint32_t const kMagic   = 0x43514341u;
+//! Format version, 2 added the original order of points, 3 the labels, 4 the sensor grid size,
+//! 5 the point count of the original order
+std::uint32_t const kVersion = 5u;
+
+/** \brief Writes matrix dimensions followed by its raw column-major coefficients. */
+template <typename _MatrixT>
+void writeMatrix(std::ostream& out, _MatrixT const& matrix) {
+    std::int64_t const dims[2] = { matrix.rows(), matrix.cols() };
+    out.write(reinterpret_cast<char const*>(dims), sizeof(dims));
+    out.write(reinterpret_cast<char const*>(matrix.data()),
+              matrix.size() * sizeof(typename _MatrixT::Scalar));
+} //...writeMatrix()
+
+/** \brief Reads a matrix written by \ref writeMatrix. */
+template <typename _MatrixT>
+bool readMatrix(std::istream& in, _MatrixT& matrix) {
+    std::int64_t dims[2];
+    if (!in.read(reinterpret_cast<char*>(dims), sizeof(dims)) || dims[0] < 0 || dims[1] < 0)
+        return false;
+    matrix.resize(dims[0], dims[1]);
+    return static_cast<bool>(
+        in.read(reinterpret_cast<char*>(matrix.data()),
+                matrix.size() * sizeof(typename _MatrixT::Scalar))
+    );
+} //...readMatrix()
+
+} //...ns anonymous
+
+bool
+writeCloudBinary(
+    std::string    const& path,
+    DecoratedCloud const& cloud
+) {
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "[writeCloudBinary] Could not open " << path << " for writing\n";
+        return false;
+    }
+
+    out.write(reinterpret_cast<char const*>(&kMagic), sizeof(kMagic));
+    out.write(reinterpret_cast<char const*>(&kVersion), sizeof(kVersion));
+    writeMatrix(out, cloud.getVertices());
+    writeMatrix(out, cloud.getFaces());
+    writeMatrix(out, cloud.getNormals());
+    writeMatrix(out, cloud.getOriginalOrder());
+    writeMatrix(out, cloud.getLabels());
+    std::int32_t const gridSize[2] = { cloud.getGridWidth(), cloud.getGridHeight() };
+    out.write(reinterpret_cast<char const*>(gridSize), sizeof(gridSize));
+    std::int32_t const nOriginal = cloud.getOriginalPointCount();
+    out.write(reinterpret_cast<char const*>(&nOriginal), sizeof(nOriginal));
+
+    if (!out) {
+        std::cerr << "[writeCloudBinary] Could not write " << path << "\n";
+        return false;
+    }
+    return true;
+} //...writeCloudBinary()
+
+bool
+readCloudBinary(
+    std::string    const& path,
+    DecoratedCloud      & cloud
+) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        std::cerr << "[readCloudBinary] Could not open " << path << " for reading\n";
+        return false;
+    }
+
+    std::uint32_t magic = 0, version = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (!in || magic != kMagic || version < 1u || version > kVersion) {
+        std::cerr << "[readCloudBinary] " << path << " is not an acq cloud file\n";
+        return false;
+    }
+
+    CloudT       vertices;
+    FacesT       faces;
+    NormalsT     normals;
+    PermutationT order;
+    LabelsT      labels;
+    std::int32_t gridSize[2] = { 0, 0 };
+    std::int32_t nOriginal   = -1;
+    if (!readMatrix(in, vertices) || !readMatrix(in, faces) || !readMatrix(in, normals) ||
+        (version >= 2u && !readMatrix(in, order)) || (version >= 3u && !readMatrix(in, labels)) ||
+        (version >= 4u && !in.read(reinterpret_cast<char*>(gridSize), sizeof(gridSize))) ||
+        (version >= 5u && !in.read(reinterpret_cast<char*>(&nOriginal), sizeof(nOriginal)))) {
+        std::cerr << "[readCloudBinary] " << path << " is truncated\n";
+        return false;
+    }
+
+    cloud = DecoratedCloud(std::move(vertices), std::move(faces), std::move(normals));
+    if (order.size())
+        cloud.setOriginalOrder(std::move(order), nOriginal);
+    if (labels.size())
+        cloud.setLabels(std::move(labels));
+    cloud.setGridSize(gridSize[0], gridSize[1]);
+    return true;
+} //...readCloudBinary()
+
+} //...ns acq
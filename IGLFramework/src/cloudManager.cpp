@@ -3,30 +3,86 @@
 //
 
 #include "acq/impl/cloudManager.hpp"
+#include "acq/impl/threadPool.hpp"
+#include "acq/cloudIO.h"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <unordered_map>
 
 namespace acq {
 
+//! Exclusive lock for writers
+typedef std::unique_lock<std::shared_timed_mutex> WriteLockT;
+//! Shared lock for readers
+typedef std::shared_lock<std::shared_timed_mutex> ReadLockT;
+
+CloudManager::CloudManager()
+    : _clock(0), _budget(0), _cacheDir(".")
+{
+    std::random_device randomDevice;
+    std::ostringstream tag;
+    tag << std::hex << randomDevice() << randomDevice();
+    _cacheTag = tag.str();
+} //...CloudManager::CloudManager()
+
+CloudManager::~CloudManager() {
+    // Finish jobs while the clouds still exist
+    _workers.reset();
+
+    // Clean up spill files
+    for (Entry const& entry : _clouds)
+        if (!entry.cachePath.empty())
+            std::remove(entry.cachePath.c_str());
+} //...CloudManager::~CloudManager()
+
 void CloudManager::addCloud(DecoratedCloud const& cloud) {
-    _clouds.push_back(cloud);
+    WriteLockT lock(_mutex);
+    _clouds.emplace_back();
+    _clouds.back().cloud = cloud;
+    onWrite(static_cast<int>(_clouds.size()) - 1);
 } //...CloudManager::addCloud()
 
-void CloudManager::setCloud(DecoratedCloud const& cloud, int index) {
-    if (index >= _clouds.size()) {
-        if (index != _clouds.size())
+void CloudManager::addCloud(DecoratedCloud&& cloud) {
+    WriteLockT lock(_mutex);
+    _clouds.emplace_back();
+    _clouds.back().cloud = std::move(cloud);
+    onWrite(static_cast<int>(_clouds.size()) - 1);
+} //...CloudManager::addCloud()
+
+void CloudManager::reserveSlot(int index) {
+    int const size = static_cast<int>(_clouds.size());
+    if (index >= size) {
+        if (index != size)
             std::cerr << "[CloudManager::setCloud] "
-                      << "Warning, creating " << index - _clouds.size()
+                      << "Warning, creating " << index - size
                       << " empty clouds when inserting to index " << index
-                      << ", current size is " << _clouds.size()
+                      << ", current size is " << size
                       << "...why not use addCloud?\n";
         _clouds.resize(index + 1);
     }
+} //...CloudManager::reserveSlot()
 
-    _clouds.at(index) = cloud;
+void CloudManager::setCloud(DecoratedCloud const& cloud, int index) {
+    WriteLockT lock(_mutex);
+    reserveSlot(index);
+    _clouds.at(index).cloud = cloud;
+    onWrite(index);
 } //...CloudManager::setCloud()
 
-DecoratedCloud& CloudManager::getCloud(int index) {
-    if (index < _clouds.size())
+void CloudManager::setCloud(DecoratedCloud&& cloud, int index) {
+    WriteLockT lock(_mutex);
+    reserveSlot(index);
+    _clouds.at(index).cloud = std::move(cloud);
+    onWrite(index);
+} //...CloudManager::setCloud()
+
+CloudManager::Entry& CloudManager::entryAt(int index) const {
+    if (index >= 0 && index < static_cast<int>(_clouds.size()))
         return _clouds.at(index);
     else {
         std::cerr << "Cannot return cloud with id " << index
@@ -34,12 +90,288 @@ DecoratedCloud& CloudManager::getCloud(int index) {
                   << " clouds...returning empty cloud\n";
         throw new std::runtime_error("No such cloud");
     }
+} //...CloudManager::entryAt()
+
+void CloudManager::touch(Entry const& entry) const {
+    entry.lastUse.store(++_clock);
+} //...CloudManager::touch()
+
+CloudManager::Entry& CloudManager::residentEntryAt(int index) const {
+    Entry &entry = entryAt(index);
+    if (entry.spilled) {
+        if (!readCloudBinary(entry.cachePath, entry.cloud)) {
+            std::cerr << "[CloudManager] Could not load spilled cloud " << index
+                      << " from " << entry.cachePath << "\n";
+            throw new std::runtime_error("Could not load spilled cloud");
+        }
+        entry.spilled = false;
+    } //...if spilled
+
+    touch(entry);
+    enforceBudget(index);
+    return entry;
+} //...CloudManager::residentEntryAt()
+
+void CloudManager::onWrite(int index) {
+    Entry &entry = _clouds.at(index);
+    entry.spilled = false;
+    ++entry.version;
+    touch(entry);
+    enforceBudget(index);
+} //...CloudManager::onWrite()
+
+std::size_t CloudManager::residentBytes() const {
+    // Union of the buffers, clouds sharing storage count it once
+    BufferSizesT buffers;
+    for (Entry const& entry : _clouds)
+        if (!entry.spilled)
+            entry.cloud.collectBuffers(buffers);
+
+    std::size_t bytes = 0;
+    for (BufferSizesT::value_type const& buffer : buffers)
+        bytes += buffer.second;
+    return bytes;
+} //...CloudManager::residentBytes()
+
+void CloudManager::enforceBudget(int keepIndex) const {
+    if (!_budget)
+        return;
+
+    // Buffers of each resident cloud, and how many resident clouds hold each buffer
+    std::vector<BufferSizesT>            entryBuffers(_clouds.size());
+    std::unordered_map<void const*, int> holders;
+    std::size_t                          usage = 0;
+    for (std::size_t index = 0; index != _clouds.size(); ++index) {
+        if (_clouds[index].spilled)
+            continue;
+        _clouds[index].cloud.collectBuffers(entryBuffers[index]);
+        for (BufferSizesT::value_type const& buffer : entryBuffers[index])
+            if (!holders[buffer.first]++)
+                usage += buffer.second;
+    } //...for clouds
+
+    while (usage > _budget) {
+        // Find least recently used resident cloud
+        int lruIndex = -1;
+        for (int index = 0; index != static_cast<int>(_clouds.size()); ++index) {
+            Entry const& entry = _clouds[index];
+            if (index == keepIndex || entry.spilled || entry.pins > 0 || entryBuffers[index].empty())
+                continue;
+            if (lruIndex < 0 || entry.lastUse < _clouds[lruIndex].lastUse)
+                lruIndex = index;
+        } //...for clouds
+
+        // Nothing left to spill
+        if (lruIndex < 0)
+            break;
+
+        if (!spill(lruIndex))
+            break;
+
+        // Only buffers no other resident cloud holds are freed
+        for (BufferSizesT::value_type const& buffer : entryBuffers[lruIndex])
+            if (!--holders[buffer.first])
+                usage -= buffer.second;
+        entryBuffers[lruIndex].clear();
+    } //...while over budget
+} //...CloudManager::enforceBudget()
+
+bool CloudManager::spill(int index) const {
+    Entry &entry = _clouds.at(index);
+
+    // Write, unless the file already holds this version
+    if (entry.cachePath.empty() || entry.cachedVersion != entry.version) {
+        if (entry.cachePath.empty()) {
+            std::ostringstream path;
+            path << _cacheDir << "/acqCloud_" << _cacheTag << "_" << index << ".bin";
+            entry.cachePath = path.str();
+        }
+        if (!writeCloudBinary(entry.cachePath, entry.cloud)) {
+            std::cerr << "[CloudManager::spill] Keeping cloud " << index << " in memory\n";
+            entry.cachePath.clear();
+            return false;
+        }
+        entry.cachedVersion = entry.version;
+    } //...if file outdated
+
+    entry.cloud   = DecoratedCloud();
+    entry.spilled = true;
+    return true;
+} //...CloudManager::spill()
+
+DecoratedCloud& CloudManager::getCloud(int index) {
+    WriteLockT lock(_mutex);
+    Entry &entry = residentEntryAt(index);
+    // Caller may write through the reference
+    ++entry.version;
+    ++entry.pins;
+    return entry.cloud;
 } //...CloudManager::getCloud()
 
 DecoratedCloud const& CloudManager::getCloud(int index) const {
-    return const_cast<DecoratedCloud const&>(
-        const_cast<CloudManager*>(this)->getCloud(index)
-    );
+    {
+        ReadLockT lock(_mutex);
+        Entry const& entry = entryAt(index);
+        if (!entry.spilled) {
+            touch(entry);
+            ++entry.pins;
+            return entry.cloud;
+        }
+    }
+
+    // Needs loading from disk
+    WriteLockT lock(_mutex);
+    Entry const& entry = residentEntryAt(index);
+    ++entry.pins;
+    return entry.cloud;
 } //...CloudManager::getCloud() (const)
 
-} //...ns acq
\ No newline at end of file
+void CloudManager::releaseCloud(int index) const {
+    {
+        ReadLockT lock(_mutex);
+        Entry const& entry = entryAt(index);
+        int const pins = entry.pins.fetch_sub(1);
+        if (pins <= 0) {
+            std::cerr << "[CloudManager::releaseCloud] Cloud " << index << " was not pinned\n";
+            ++entry.pins;
+            return;
+        }
+        // Still referenced, or nothing to spill
+        if (pins > 1 || !_budget)
+            return;
+    }
+
+    // Spilling may have been postponed while the cloud was pinned
+    WriteLockT lock(_mutex);
+    enforceBudget(-1);
+} //...CloudManager::releaseCloud()
+
+int CloudManager::getCloudCount() const {
+    ReadLockT lock(_mutex);
+    return static_cast<int>(_clouds.size());
+} //...CloudManager::getCloudCount()
+
+CloudManager::VersionT CloudManager::getVersion(int index) const {
+    ReadLockT lock(_mutex);
+    return entryAt(index).version;
+} //...CloudManager::getVersion()
+
+CloudManager::Handle CloudManager::getHandle(int index) const {
+    ReadLockT lock(_mutex);
+    return Handle{index, entryAt(index).version};
+} //...CloudManager::getHandle()
+
+DecoratedCloud CloudManager::getSnapshot(int index, Handle* handle) const {
+    {
+        ReadLockT lock(_mutex);
+        Entry const& entry = entryAt(index);
+        if (!entry.spilled) {
+            touch(entry);
+            if (handle)
+                *handle = Handle{index, entry.version};
+            // Copy-on-write channels, only reference counts change here
+            return entry.cloud;
+        }
+    }
+
+    // Needs loading from disk
+    WriteLockT lock(_mutex);
+    Entry const& entry = residentEntryAt(index);
+    if (handle)
+        *handle = Handle{index, entry.version};
+    return entry.cloud;
+} //...CloudManager::getSnapshot()
+
+bool CloudManager::commitCloud(Handle const& handle, DecoratedCloud&& cloud) {
+    WriteLockT lock(_mutex);
+    Entry &entry = entryAt(handle.index);
+    if (entry.version != handle.version)
+        return false;
+
+    entry.cloud = std::move(cloud);
+    onWrite(handle.index);
+    return true;
+} //...CloudManager::commitCloud()
+
+std::future<bool> CloudManager::submitJob(int index, JobT job) {
+    std::call_once(_poolStart, [this]() { _workers.reset(new ThreadPool()); });
+
+    // Take snapshot now, so the job sees the cloud as it was at submission
+    Handle handle;
+    std::shared_ptr<DecoratedCloud> const snapshot =
+        std::make_shared<DecoratedCloud>(getSnapshot(index, &handle));
+
+    return _workers->submit(
+        [this, handle, snapshot, job]() {
+            job(*snapshot);
+            return commitCloud(handle, std::move(*snapshot));
+        }
+    );
+} //...CloudManager::submitJob()
+
+IcpResult CloudManager::registerClouds(
+    int                    sourceIndex,
+    int                    targetIndex,
+    Eigen::Matrix4d const& initial,
+    IcpParams       const& params
+) const {
+    DecoratedCloud const source = getSnapshot(sourceIndex);
+
+    // Derive on a snapshot without holding the lock, cache hits of the stored target come along
+    Handle                                handle;
+    DecoratedCloud const                  target           = getSnapshot(targetIndex, &handle);
+    std::shared_ptr<KdTree const> const   tree             = target.getKdTree(params.maxLeafs);
+    std::shared_ptr<NormalsT const> const estimatedNormals =
+        target.hasNormals()
+        ? std::shared_ptr<NormalsT const>()
+        : target.getEstimatedNormals(params.normalK, std::sqrt(std::numeric_limits<float>::max()) - 1.f,
+                                     params.maxLeafs);
+
+    // Keep the results for the next registration, unless the target changed meanwhile
+    {
+        WriteLockT lock(_mutex);
+        Entry& entry = entryAt(targetIndex);
+        if (entry.version == handle.version && !entry.spilled) {
+            entry.cloud.adoptDerivedCache(target);
+            // Cached items count towards the budget
+            enforceBudget(targetIndex);
+        }
+    }
+
+    return registerPointToPlane(
+        /* [in]         Points to move: */ source.getVertices(),
+        /* [in]         Target kd-tree: */ *tree,
+        /* [in]         Target normals: */ estimatedNormals ? NormalsConstRefT(*estimatedNormals)
+                                                            : NormalsConstRefT(target.getNormals()),
+        /* [in] Initial transformation: */ initial,
+        /* [in]                Options: */ params
+    );
+} //...CloudManager::registerClouds()
+
+void CloudManager::setMemoryBudget(std::size_t bytes) {
+    WriteLockT lock(_mutex);
+    _budget = bytes;
+    enforceBudget(-1);
+} //...CloudManager::setMemoryBudget()
+
+std::size_t CloudManager::getMemoryBudget() const {
+    ReadLockT lock(_mutex);
+    return _budget;
+} //...CloudManager::getMemoryBudget()
+
+std::size_t CloudManager::getMemoryUsage() const {
+    ReadLockT lock(_mutex);
+    return residentBytes();
+} //...CloudManager::getMemoryUsage()
+
+void CloudManager::setCacheDirectory(std::string const& directory) {
+    WriteLockT lock(_mutex);
+    _cacheDir = directory;
+} //...CloudManager::setCacheDirectory()
+
+bool CloudManager::isSpilled(int index) const {
+    ReadLockT lock(_mutex);
+    return entryAt(index).spilled;
+} //...CloudManager::isSpilled()
+
+} //...ns acq
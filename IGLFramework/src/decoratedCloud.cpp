@@ -3,22 +3,327 @@
 //
 
 #include "acq/impl/decoratedCloud.hpp"
+#include "acq/impl/derivedCache.hpp"
+#include "acq/normalEstimation.h"
+#include "acq/organizedCloud.h"
+#include "acq/outlierRemoval.h"
+#include "acq/parallel.h"
+#include "acq/impl/spatialOrder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
 
 namespace acq {
 
-DecoratedCloud::DecoratedCloud(CloudT const& vertices)
-    : _vertices(vertices) {}
+namespace {
+
+/** \brief Bytes of the coefficients of a dense matrix. */
+template <typename _MatrixT>
+std::size_t estimateBytes(_MatrixT const& matrix) {
+    return static_cast<std::size_t>(matrix.size()) * sizeof(typename _MatrixT::Scalar);
+} //...estimateBytes()
+
+/** \brief Bytes of the neighbour lists, a red-black tree node costs about four pointers besides its value. */
+std::size_t estimateBytes(NeighboursT const& neighbours) {
+    std::size_t const nodeOverhead = 4 * sizeof(void*);
+    std::size_t       bytes        = sizeof(NeighboursT);
+    for (NeighboursT::value_type const& entry : neighbours)
+        bytes += nodeOverhead + sizeof(NeighboursT::value_type)
+               + entry.second.size() * (nodeOverhead + sizeof(NeighboursT::mapped_type::value_type));
+    return bytes;
+} //...estimateBytes()
+
+} //...ns anonymous
+
+DecoratedCloud::DecoratedCloud(CloudT vertices)
+    : _vertices(std::move(vertices)), _gridWidth(0), _gridHeight(0), _nOriginal(0) {}
 
-DecoratedCloud::DecoratedCloud(CloudT const& vertices, FacesT const& faces)
-    : _vertices(vertices), _faces(faces)
+DecoratedCloud::DecoratedCloud(CloudT vertices, FacesT faces)
+    : _vertices(std::move(vertices)), _faces(std::move(faces)), _gridWidth(0), _gridHeight(0), _nOriginal(0)
 {}
 
-DecoratedCloud::DecoratedCloud(CloudT const& vertices, FacesT const& faces, NormalsT const& normals)
-    : _vertices(vertices), _faces(faces), _normals(normals)
+DecoratedCloud::DecoratedCloud(CloudT vertices, FacesT faces, NormalsT normals)
+    : _vertices(std::move(vertices)), _faces(std::move(faces)), _normals(std::move(normals)),
+      _gridWidth(0), _gridHeight(0), _nOriginal(0)
 {}
 
-DecoratedCloud::DecoratedCloud(CloudT const& vertices, NormalsT const& normals)
-    : _vertices(vertices), _normals(normals)
+DecoratedCloud::DecoratedCloud(CloudT vertices, NormalsT normals)
+    : _vertices(std::move(vertices)), _normals(std::move(normals)), _gridWidth(0), _gridHeight(0), _nOriginal(0)
 {}
 
+std::shared_ptr<KdTree const> DecoratedCloud::getKdTree(int maxLeafs) const {
+    DerivedCache::KeyT const key(KD_TREE, 0, 0.f, maxLeafs);
+    GenerationT        const generation = _vertices.generation();
+
+    std::shared_ptr<KdTree const> tree = _cache.find<KdTree>(key, generation);
+    if (!tree) {
+        // The tree keeps its own row-major copy of the points
+        tree = std::make_shared<KdTree const>(getVertices(), maxLeafs);
+        _cache.store(key, generation, tree, tree->getMemoryFootprint());
+    }
+    return tree;
+} //...DecoratedCloud::getKdTree()
+
+void DecoratedCloud::findNearestPoints(
+    CloudConstRefT   const& queries,
+    int                     k,
+    KnnIndicesT           & indices,
+    KdTree::KnnDistsT     & distsSqr,
+    int                     maxLeafs
+) const {
+    getKdTree(maxLeafs)->batchKnnSearch(
+        /* [in ] Query points: */ queries,
+        /* [in ] k-neighbours: */ k,
+        /* [out]      Indices: */ indices,
+        /* [out]  Sqr. dists.: */ distsSqr
+    );
+} //...DecoratedCloud::findNearestPoints()
+
+std::shared_ptr<NeighboursT const> DecoratedCloud::getNeighbours(int k, float maxDist, int maxLeafs) const {
+    DerivedCache::KeyT const key(NEIGHBOURS, k, maxDist, maxLeafs);
+    GenerationT        const generation = _vertices.generation();
+
+    std::shared_ptr<NeighboursT const> neighbours = _cache.find<NeighboursT>(key, generation);
+    if (!neighbours) {
+        neighbours = std::make_shared<NeighboursT const>(
+            calculateCloudNeighbours(
+                /* [in] Kd-tree of points: */ *getKdTree(maxLeafs),
+                /* [in]      k-neighbours: */ k,
+                /* [in]           maxDist: */ maxDist
+            )
+        );
+        _cache.store(key, generation, neighbours, estimateBytes(*neighbours));
+    }
+    return neighbours;
+} //...DecoratedCloud::getNeighbours()
+
+std::shared_ptr<NeighboursT const> DecoratedCloud::getFaceNeighbours() const {
+    DerivedCache::KeyT const key(FACE_NEIGHBOURS, 0, 0.f, 0);
+    GenerationT        const generation = _faces.generation();
+
+    std::shared_ptr<NeighboursT const> neighbours = _cache.find<NeighboursT>(key, generation);
+    if (!neighbours) {
+        neighbours = std::make_shared<NeighboursT const>(
+            calculateCloudNeighboursFromFaces(
+                /* [in] Faces: */ getFaces()
+            )
+        );
+        _cache.store(key, generation, neighbours, estimateBytes(*neighbours));
+    }
+    return neighbours;
+} //...DecoratedCloud::getFaceNeighbours()
+
+std::shared_ptr<NormalsT const> DecoratedCloud::getEstimatedNormals(int k, float maxDist, int maxLeafs) const {
+    DerivedCache::KeyT const key(NORMALS, k, maxDist, maxLeafs);
+    GenerationT        const generation = _vertices.generation();
+
+    std::shared_ptr<NormalsT const> normals = _cache.find<NormalsT>(key, generation);
+    if (!normals) {
+        // Not created const, so estimateNormals() may hand it to a channel that writes to it later
+        normals = std::make_shared<NormalsT>(
+            calculateCloudNormals(
+                /* [in]    Row-major points: */ getKdTree(maxLeafs)->getPoints(),
+                /* [in] Lists of neighbours: */ *getNeighbours(k, maxDist, maxLeafs)
+            )
+        );
+        _cache.store(key, generation, normals, estimateBytes(*normals));
+    }
+    return normals;
+} //...DecoratedCloud::getEstimatedNormals()
+
+std::shared_ptr<KnnIndicesT const> DecoratedCloud::getWindowNeighbours(int windowRadius, float maxDist) const {
+    DerivedCache::KeyT const key(WINDOW_NEIGHBOURS, windowRadius, maxDist, _gridWidth);
+    GenerationT        const generation = _vertices.generation();
+
+    std::shared_ptr<KnnIndicesT const> neighbours = _cache.find<KnnIndicesT>(key, generation);
+    if (!neighbours) {
+        neighbours = std::make_shared<KnnIndicesT const>(
+            calculateOrganizedNeighbours(
+                /* [in]      Points in pixel order: */ getVertices(),
+                /* [in] Sensor grid width, height: */ _gridWidth, _gridHeight,
+                /* [in]     Window half side size: */ windowRadius,
+                /* [in]                   maxDist: */ maxDist
+            )
+        );
+        _cache.store(key, generation, neighbours, estimateBytes(*neighbours));
+    }
+    return neighbours;
+} //...DecoratedCloud::getWindowNeighbours()
+
+std::shared_ptr<NormalsT const> DecoratedCloud::getOrganizedNormals(int windowRadius) const {
+    DerivedCache::KeyT const key(ORGANIZED_NORMALS, windowRadius, 0.f, _gridWidth);
+    GenerationT        const generation = _vertices.generation();
+
+    std::shared_ptr<NormalsT const> normals = _cache.find<NormalsT>(key, generation);
+    if (!normals) {
+        // Not created const, so estimateOrganizedNormals() may hand it to a channel that writes to it later
+        normals = std::make_shared<NormalsT>(
+            calculateOrganizedNormals(
+                /* [in]      Points in pixel order: */ getVertices(),
+                /* [in] Sensor grid width, height: */ _gridWidth, _gridHeight,
+                /* [in]     Window half side size: */ windowRadius
+            )
+        );
+        _cache.store(key, generation, normals, estimateBytes(*normals));
+    }
+    return normals;
+} //...DecoratedCloud::getOrganizedNormals()
+
+std::shared_ptr<FeaturesT const> DecoratedCloud::getFpfhFeatures(int k, int maxLeafs, unsigned nThreads) const {
+    // Generations are increasing process-wide, the larger one changes when either channel does
+    DerivedCache::KeyT const key(FPFH_FEATURES, k, 0.f, maxLeafs);
+    GenerationT        const generation = std::max(_vertices.generation(), _normals.generation());
+
+    std::shared_ptr<FeaturesT const> features = _cache.find<FeaturesT>(key, generation);
+    if (!features) {
+        std::shared_ptr<KdTree const> const tree = getKdTree(maxLeafs);
+        KnnIndicesT       neighbours;
+        KdTree::KnnDistsT distsSqr;
+        calculateCloudNeighbours(*tree, k, neighbours, distsSqr,
+                                 std::sqrt(std::numeric_limits<float>::max()) - 1.f, nThreads);
+        NormalsT const estimated = hasNormals()
+                                   ? NormalsT()
+                                   : NormalsT(calculateCloudNormals(tree->getPoints(), neighbours, nThreads));
+        features = std::make_shared<FeaturesT const>(
+            calculateFpfhFeatures(
+                /* [in]             Points: */ _vertices.view(),
+                /* [in]            Normals: */ hasNormals() ? NormalsConstRefT(_normals.view())
+                                                            : NormalsConstRefT(estimated),
+                /* [in] Neighbour ids, dists: */ neighbours, distsSqr,
+                /* [in]            nThreads: */ nThreads
+            )
+        );
+        _cache.store(key, generation, features, estimateBytes(*features));
+    }
+    return features;
+} //...DecoratedCloud::getFpfhFeatures()
+
+void DecoratedCloud::reorder(PermutationT const& order) {
+    if (order.size() != _vertices.rows()) {
+        std::cerr << "[DecoratedCloud::reorder] Permutation size " << order.size()
+                  << " does not match point count " << _vertices.rows() << "\n";
+        throw new std::runtime_error("Permutation size mismatch");
+    }
+
+    _vertices.set(permuteRows(CloudT(getVertices()), order));
+    setGridSize(0, 0);
+    if (hasNormals())
+        _normals.set(permuteRows(NormalsT(getNormals()), order));
+    if (hasLabels())
+        _labels.set(permuteRows(LabelsT(getLabels()), order));
+    if (hasFaces())
+        _faces.set(remapFaces(getFaces(), order));
+
+    // Compose with earlier reorderings, so it always maps to the very first order
+    if (isReordered()) {
+        PermutationConstMapT const previous = getOriginalOrder();
+        PermutationT composed(order.size());
+        for (int row = 0; row != order.size(); ++row)
+            composed(row) = previous(order(row));
+        _order.set(std::move(composed));
+    } else
+        setOriginalOrder(order);
+} //...DecoratedCloud::reorder()
+
+void DecoratedCloud::reorderMorton(unsigned nThreads) {
+    reorder(calculateMortonOrder(getVertices(), nThreads));
+} //...DecoratedCloud::reorderMorton()
+
+std::size_t DecoratedCloud::keepPoints(std::vector<char> const& keep, unsigned nThreads) {
+    if (keep.size() != static_cast<std::size_t>(_vertices.rows())) {
+        std::cerr << "[DecoratedCloud::keepPoints] Flag count " << keep.size()
+                  << " does not match point count " << _vertices.rows() << "\n";
+        throw new std::runtime_error("Flag count mismatch");
+    }
+
+    // New row of each point, -1 if removed
+    std::size_t const n = keep.size();
+    PermutationT newRows(n);
+    int nKept = 0;
+    for (std::size_t row = 0; row != n; ++row)
+        newRows(row) = keep[row] ? nKept++ : -1;
+    if (static_cast<std::size_t>(nKept) == n)
+        return 0;
+
+    // Gather the remaining rows, original rows composed with earlier reorderings
+    bool const reordered = isReordered();
+    PermutationConstMapT const previous = _order.view();
+    CloudConstMapT       const vertices = _vertices.view();
+    NormalsConstMapT     const normals  = _normals.view();
+    LabelsConstMapT      const labels   = _labels.view();
+    CloudT       keptVertices(nKept, 3);
+    NormalsT     keptNormals (hasNormals() ? nKept : 0, 3);
+    LabelsT      keptLabels  (hasLabels()  ? nKept : 0);
+    PermutationT keptOrder   (nKept);
+    parallelChunks(n, getChunkCount(n, nThreads), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            int const newRow = newRows(row);
+            if (newRow < 0)
+                continue;
+            keptVertices.row(newRow) = vertices.row(row);
+            if (keptNormals.rows())
+                keptNormals.row(newRow) = normals.row(row);
+            if (keptLabels.size())
+                keptLabels(newRow) = labels(row);
+            keptOrder(newRow) = reordered ? previous(row) : static_cast<int>(row);
+        }
+    });
+
+    // Faces of remaining points only
+    if (hasFaces()) {
+        FacesConstMapT const faces = _faces.view();
+        FacesT keptFaces(faces.rows(), faces.cols());
+        int nFaces = 0;
+        for (int face = 0; face != faces.rows(); ++face) {
+            bool complete = true;
+            for (int corner = 0; corner != faces.cols() && complete; ++corner)
+                complete = (keptFaces(nFaces, corner) = newRows(faces(face, corner))) >= 0;
+            nFaces += complete;
+        }
+        keptFaces.conservativeResize(nFaces, faces.cols());
+        _faces.set(std::move(keptFaces));
+    }
+
+    _vertices.set(std::move(keptVertices));
+    if (hasNormals())
+        _normals.set(std::move(keptNormals));
+    if (hasLabels())
+        _labels.set(std::move(keptLabels));
+    // Remember the point count of the original order, restoreRows() needs it to place the gaps
+    setOriginalOrder(std::move(keptOrder), reordered ? _nOriginal : static_cast<int>(n));
+    setGridSize(0, 0);
+    return n - nKept;
+} //...DecoratedCloud::keepPoints()
+
+std::size_t DecoratedCloud::removeStatisticalOutliers(int k, double stdDevMul, unsigned nThreads, int maxLeafs) {
+    KnnIndicesT       neighbours;
+    KdTree::KnnDistsT distsSqr;
+    calculateCloudNeighbours(*getKdTree(maxLeafs), k, neighbours, distsSqr,
+                             std::sqrt(std::numeric_limits<float>::max()) - 1.f, nThreads);
+    return keepPoints(findStatisticalInliers(distsSqr, stdDevMul, nThreads), nThreads);
+} //...DecoratedCloud::removeStatisticalOutliers()
+
+std::size_t DecoratedCloud::removeRadiusOutliers(double radius, int minNeighbours, unsigned nThreads, int maxLeafs) {
+    if (minNeighbours <= 0)
+        return 0;
+
+    // The minNeighbours closest are enough to tell
+    KnnIndicesT       neighbours;
+    KdTree::KnnDistsT distsSqr;
+    calculateCloudNeighbours(*getKdTree(maxLeafs), minNeighbours, neighbours, distsSqr,
+                             static_cast<float>(radius), nThreads);
+    return keepPoints(findRadiusInliers(distsSqr, radius, minNeighbours, nThreads), nThreads);
+} //...DecoratedCloud::removeRadiusOutliers()
+
+void DecoratedCloud::estimateNormals(int k, float maxDist, int maxLeafs) {
+    _normals.share(getEstimatedNormals(k, maxDist, maxLeafs));
+} //...DecoratedCloud::estimateNormals()
+
+void DecoratedCloud::estimateOrganizedNormals(int windowRadius) {
+    _normals.share(getOrganizedNormals(windowRadius));
+} //...DecoratedCloud::estimateOrganizedNormals()
+
 } //...ns acq
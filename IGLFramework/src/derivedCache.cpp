@@ -0,0 +1,78 @@
+//
+// Created by bontius on 10/02/17.
+//
+
+#include "acq/impl/derivedCache.hpp"
+
+namespace acq {
+
+DerivedCache::DerivedCache(DerivedCache const& other) {
+    std::lock_guard<std::mutex> lock(other._mutex);
+    _items = other._items;
+} //...DerivedCache::DerivedCache()
+
+DerivedCache::DerivedCache(DerivedCache&& other) {
+    std::lock_guard<std::mutex> lock(other._mutex);
+    _items = std::move(other._items);
+} //...DerivedCache::DerivedCache()
+
+DerivedCache& DerivedCache::operator=(DerivedCache const& other) {
+    if (this != &other) {
+        std::lock(_mutex, other._mutex);
+        std::lock_guard<std::mutex> lock(_mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> otherLock(other._mutex, std::adopt_lock);
+        _items = other._items;
+    }
+    return *this;
+} //...DerivedCache::operator=()
+
+DerivedCache& DerivedCache::operator=(DerivedCache&& other) {
+    if (this != &other) {
+        std::lock(_mutex, other._mutex);
+        std::lock_guard<std::mutex> lock(_mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> otherLock(other._mutex, std::adopt_lock);
+        _items = std::move(other._items);
+    }
+    return *this;
+} //...DerivedCache::operator=()
+
+void DerivedCache::merge(DerivedCache const& other) {
+    if (this == &other)
+        return;
+    std::lock(_mutex, other._mutex);
+    std::lock_guard<std::mutex> lock(_mutex, std::adopt_lock);
+    std::lock_guard<std::mutex> otherLock(other._mutex, std::adopt_lock);
+
+    for (std::pair<KeyT const, Item> const& entry : other._items) {
+        // Skip, if this cache holds the kind from a newer generation, or the same item already
+        int  const kind  = std::get<0>(entry.first);
+        bool       newer = false;
+        for (std::pair<KeyT const, Item> const& held : _items)
+            newer |= std::get<0>(held.first) == kind && held.second.generation > entry.second.generation;
+        if (newer || _items.count(entry.first))
+            continue;
+
+        // Drop items of the same kind derived from older generations
+        for (std::map<KeyT, Item>::iterator it = _items.begin(); it != _items.end(); ) {
+            if (std::get<0>(it->first) == kind && it->second.generation != entry.second.generation)
+                it = _items.erase(it);
+            else
+                ++it;
+        }
+        _items.insert(entry);
+    } //...for items of other
+} //...DerivedCache::merge()
+
+void DerivedCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _items.clear();
+} //...DerivedCache::clear()
+
+void DerivedCache::collectBuffers(BufferSizesT& buffers) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (std::pair<KeyT const, Item> const& entry : _items)
+        if (entry.second.bytes)
+            buffers[entry.second.value.get()] = entry.second.bytes;
+} //...DerivedCache::collectBuffers()
+
+} //...ns acq
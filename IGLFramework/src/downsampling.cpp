@@ -0,0 +1,119 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#include "acq/downsampling.h"
+
+#include "acq/parallel.h"
+#include "acq/spatialOrder.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace acq {
+
+DecoratedCloud
+downsampleVoxelGrid(
+    DecoratedCloud  const& cloud,
+    double          const  cellSize,
+    Eigen::VectorXi      & cellOfPoint,
+    unsigned        const  nThreads
+) {
+    if (!(cellSize > 0.)) {
+        std::cerr << "[downsampleVoxelGrid] Cell size has to be positive, got " << cellSize << "\n";
+        throw new std::runtime_error("Non-positive cell size");
+    }
+
+    CloudConstMapT const points  = cloud.getVertices();
+    std::size_t    const n       = points.rows();
+    int            const nChunks = getChunkCount(n, nThreads);
+
+    // Bounding box of the finite points, per chunk then reduced
+    std::vector<Eigen::Array3d> lows (nChunks, Eigen::Array3d::Constant( std::numeric_limits<double>::infinity()));
+    std::vector<Eigen::Array3d> highs(nChunks, Eigen::Array3d::Constant(-std::numeric_limits<double>::infinity()));
+    parallelChunks(n, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            Eigen::Array3d const point = points.row(row).transpose();
+            if (point.allFinite()) {
+                lows [chunk] = lows [chunk].min(point);
+                highs[chunk] = highs[chunk].max(point);
+            }
+        }
+    });
+    Eigen::Array3d low  = lows [0];
+    Eigen::Array3d high = highs[0];
+    for (int chunk = 1; chunk < nChunks; ++chunk) {
+        low  = low .min(lows [chunk]);
+        high = high.max(highs[chunk]);
+    }
+
+    enum { CellBits = 21 };
+    if (low.allFinite() && ((high - low) / cellSize).maxCoeff() >= (1 << CellBits)) {
+        std::cerr << "[downsampleVoxelGrid] Extent " << (high - low).transpose() << " over cell size "
+                  << cellSize << " exceeds " << (1 << CellBits) << " cells\n";
+        throw new std::runtime_error("Too many cells");
+    }
+
+    // Cell codes, non-finite points last
+    std::uint64_t const invalid = std::numeric_limits<std::uint64_t>::max();
+    std::vector<std::uint64_t> keys(n);
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            Eigen::Array3d const point = points.row(row).transpose();
+            if (!point.allFinite()) {
+                keys[row] = invalid;
+                continue;
+            }
+            Eigen::Array3d const cell = ((point - low) / cellSize).floor();
+            keys[row] = calculateMortonCode(
+                static_cast<std::uint32_t>(cell(0)),
+                static_cast<std::uint32_t>(cell(1)),
+                static_cast<std::uint32_t>(cell(2)));
+        }
+    });
+    PermutationT const order = sortKeys(keys, 64, nThreads);
+
+    // Runs of equal codes
+    std::vector<std::size_t> cellStarts;
+    for (std::size_t i = 0; i != n && keys[i] != invalid; ++i)
+        if (!i || keys[i] != keys[i - 1])
+            cellStarts.push_back(i);
+    int const nCells = cellStarts.size();
+    cellStarts.push_back(std::find(keys.begin(), keys.end(), invalid) - keys.begin());
+
+    // Average per cell, in sorted order
+    bool     const hasNormals = cloud.hasNormals();
+    NormalsConstMapT const normals = cloud.getNormals();
+    CloudT   vertices(nCells, 3);
+    NormalsT cellNormals(hasNormals ? nCells : 0, 3);
+    cellOfPoint.setConstant(n, -1);
+    parallelChunks(nCells, getChunkCount(nCells, nThreads, 1 << 12),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (std::size_t cell = begin; cell != end; ++cell) {
+                Eigen::RowVector3d position(Eigen::RowVector3d::Zero());
+                Eigen::RowVector3d normal  (Eigen::RowVector3d::Zero());
+                int const firstRow = order(cellStarts[cell]);
+                for (std::size_t i = cellStarts[cell]; i != cellStarts[cell + 1]; ++i) {
+                    int const row = order(i);
+                    position += points.row(row);
+                    // Unoriented normals might point either way
+                    if (hasNormals)
+                        normal += (normals.row(row).dot(normals.row(firstRow)) < 0. ? -1. : 1.) * normals.row(row);
+                    cellOfPoint(row) = cell;
+                }
+                vertices.row(cell) = position / (cellStarts[cell + 1] - cellStarts[cell]);
+                if (hasNormals)
+                    cellNormals.row(cell) = normal.normalized();
+            }
+        }
+    );
+
+    if (hasNormals)
+        return DecoratedCloud(std::move(vertices), std::move(cellNormals));
+    return DecoratedCloud(std::move(vertices));
+} //...downsampleVoxelGrid()
+
+} //...ns acq
@@ -0,0 +1,158 @@
+//
+// Created by bontius on 16/02/17.
+//
+
+#include "acq/dynamicKdTree.h"
+#include "acq/knnResult.h"
+
+#include <algorithm>
+
+namespace acq {
+
+namespace {
+
+//! Points collected before they are moved to a tree.
+enum { BufferSize = 256 };
+
+} //...ns anonymous
+
+template <typename _Scalar>
+DynamicKdTreeT<_Scalar>::DynamicKdTreeT(int maxLeafs)
+    : _size(0), _maxLeafs(std::max(1, maxLeafs)) {}
+
+template <typename _Scalar>
+void DynamicKdTreeT<_Scalar>::addIds(std::size_t firstId, std::size_t count) {
+    _removed.resize(firstId + count, false);
+    _levelOf.resize(firstId + count, -1);
+    for (std::size_t id = firstId; id != firstId + count; ++id)
+        _buffer.push_back(id);
+    _size += count;
+
+    if (_buffer.size() >= BufferSize)
+        flushBuffer();
+} //...DynamicKdTreeT::addIds()
+
+template <typename _Scalar>
+void DynamicKdTreeT<_Scalar>::flushBuffer() {
+    // Binary counter: carry occupied levels upwards, until an empty one fits them all
+    std::vector<std::size_t> carry;
+    carry.swap(_buffer);
+    for (int level = 0; ; ++level) {
+        if (level == static_cast<int>(_levels.size()))
+            _levels.push_back(Level());
+
+        if (_levels[level].ids.empty()) {
+            if (carry.size() <= getLevelCapacity(level)) {
+                buildLevel(level, std::move(carry));
+                return;
+            }
+        } else {
+            gatherLevel(level, carry);
+            _levels[level] = Level();
+        }
+    } //...for levels
+} //...DynamicKdTreeT::flushBuffer()
+
+template <typename _Scalar>
+void DynamicKdTreeT<_Scalar>::buildLevel(int level, std::vector<std::size_t>&& ids) {
+    // Gather points contiguously, the tree copies them into its own layout
+    Eigen::Matrix<Scalar, Eigen::Dynamic, Dim> gathered(ids.size(), Dim);
+    for (std::size_t i = 0; i != ids.size(); ++i) {
+        gathered.row(i) = Eigen::Map<Eigen::Matrix<Scalar, 1, Dim> const>(point(ids[i]));
+        _levelOf[ids[i]] = level;
+    }
+
+    Level& target = _levels[level];
+    target.tree.build(PointStorageT<Scalar>(gathered), KdTreeBuildParams(_maxLeafs));
+    target.tree.relabel(ids);
+    target.ids.swap(ids);
+    target.nRemoved = 0;
+} //...DynamicKdTreeT::buildLevel()
+
+template <typename _Scalar>
+void DynamicKdTreeT<_Scalar>::gatherLevel(int level, std::vector<std::size_t>& ids) const {
+    for (std::size_t const id : _levels[level].ids)
+        if (!_removed[id])
+            ids.push_back(id);
+} //...DynamicKdTreeT::gatherLevel()
+
+template <typename _Scalar>
+std::size_t DynamicKdTreeT<_Scalar>::getLevelCapacity(int level) const {
+    return static_cast<std::size_t>(BufferSize) << level;
+} //...DynamicKdTreeT::getLevelCapacity()
+
+template <typename _Scalar>
+bool DynamicKdTreeT<_Scalar>::remove(std::size_t id) {
+    if (id >= _removed.size() || _removed[id])
+        return false;
+
+    _removed[id] = true;
+    --_size;
+
+    int const level = _levelOf[id];
+    if (level < 0) {
+        _buffer.erase(std::find(_buffer.begin(), _buffer.end(), id));
+        return true;
+    }
+
+    // Rebuild without the removed points, once they are the majority
+    Level& owner = _levels[level];
+    if (2 * ++owner.nRemoved > owner.ids.size()) {
+        std::vector<std::size_t> ids;
+        gatherLevel(level, ids);
+        owner = Level();
+        if (!ids.empty())
+            buildLevel(level, std::move(ids));
+    }
+    return true;
+} //...DynamicKdTreeT::remove()
+
+template <typename _Scalar>
+std::size_t
+DynamicKdTreeT<_Scalar>::knnSearch(
+    Scalar const* query,
+    int           k,
+    std::size_t * indices,
+    Scalar      * distsSqr
+) const {
+    KnnResultT<Scalar> result(k, indices, distsSqr);
+    if (k <= 0)
+        return 0;
+
+    // Recent points one by one
+    for (std::size_t const id : _buffer) {
+        Scalar const* const p = point(id);
+        Scalar const dx = p[0] - query[0];
+        Scalar const dy = p[1] - query[1];
+        Scalar const dz = p[2] - query[2];
+        Scalar const distSqr = dx * dx + dy * dy + dz * dz;
+        if (result.accepts(distSqr, id))
+            result.add(distSqr, id);
+    }
+
+    // Largest levels first, they are likely to hold most of the neighbours
+    for (int level = static_cast<int>(_levels.size()) - 1; level >= 0; --level)
+        if (!_levels[level].ids.empty())
+            _levels[level].tree.knnSearch(query, result, _levels[level].nRemoved ? &_removed : nullptr);
+
+    return result.count;
+} //...DynamicKdTreeT::knnSearch()
+
+template <typename _Scalar>
+int DynamicKdTreeT<_Scalar>::getTreeCount() const {
+    return static_cast<int>(std::count_if(_levels.begin(), _levels.end(),
+                                          [](Level const& level) { return !level.ids.empty(); }));
+} //...DynamicKdTreeT::getTreeCount()
+
+} //...ns acq
+
+//
+// Template instantiation
+//
+
+namespace acq {
+
+template class DynamicKdTreeT<float>;
+template class DynamicKdTreeT<double>;
+
+} //...ns acq
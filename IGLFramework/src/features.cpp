@@ -0,0 +1,164 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#include "acq/features.h"
+
+#include "acq/parallel.h"
+
+#include "nanoflann/nanoflann.hpp"  // Nearest neighbour lookup of descriptors
+
+#include "Eigen/Geometry"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace acq {
+
+namespace {
+
+/** \brief Descriptors as a nanoflann dataset. */
+struct FeatureDataset {
+    explicit FeatureDataset(FeaturesT const& features) : features(features) {}
+
+    inline std::size_t kdtree_get_point_count() const { return features.rows(); }
+    inline float kdtree_get_pt(std::size_t idx, int dim) const { return features(idx, dim); }
+    template <class _BBoxT>
+    bool kdtree_get_bbox(_BBoxT& /*bb*/) const { return false; }
+
+    FeaturesT const& features; //!< Descriptors in rows.
+}; //...struct FeatureDataset
+
+/** \brief Bin of \p value in [\p low, \p high]. */
+inline int getBin(double value, double low, double high) {
+    int const bin = static_cast<int>(std::floor((value - low) / (high - low) * FpfhBins));
+    return std::min(FpfhBins - 1, std::max(0, bin));
+} //...getBin()
+
+} //...ns anonymous
+
+FeaturesT
+calculateSpfhFeatures(
+    CloudConstRefT   const& cloud,
+    NormalsConstRefT const& normals,
+    KnnIndicesT      const& neighbours,
+    unsigned         const  nThreads
+) {
+    if (normals.rows() != cloud.rows() || neighbours.rows() != cloud.rows()) {
+        std::cerr << "[calculateSpfhFeatures] Point count " << cloud.rows() << " does not match normal count "
+                  << normals.rows() << " or neighbour count " << neighbours.rows() << "\n";
+        throw new std::runtime_error("Point count mismatch");
+    }
+
+    std::size_t const n = cloud.rows();
+    FeaturesT spfh(FeaturesT::Zero(n, static_cast<int>(FpfhDim)));
+    parallelChunks(n, getChunkCount(n, nThreads, 1 << 12), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId) {
+            int nPairs = 0;
+            float* const histograms = spfh.row(pointId).data();
+            Eigen::Vector3d const point  = cloud  .row(pointId).transpose();
+            Eigen::Vector3d const normal = normals.row(pointId).transpose();
+            for (int const neighbourId : neighbours.row(pointId)) {
+                if (neighbourId < 0)
+                    continue;
+                Eigen::Vector3d delta = cloud.row(neighbourId).transpose() - point;
+                double const dist = delta.norm();
+                Eigen::Vector3d const neighbourNormal = normals.row(neighbourId).transpose();
+                if (!(dist > 0.) || !neighbourNormal.allFinite() || !normal.allFinite())
+                    continue;
+                delta /= dist;
+
+                // Darboux frame at the end whose normal is closer to the line
+                Eigen::Vector3d u = normal, other = neighbourNormal;
+                if (std::abs(normal.dot(delta)) < std::abs(neighbourNormal.dot(delta))) {
+                    u = neighbourNormal;
+                    other = normal;
+                    delta = -delta;
+                }
+                Eigen::Vector3d const v = u.cross(delta).normalized();
+                Eigen::Vector3d const w = u.cross(v);
+
+                ++histograms[                getBin(v.dot(other), -1., 1.)];
+                ++histograms[    FpfhBins  + getBin(u.dot(delta), -1., 1.)];
+                ++histograms[2 * FpfhBins  + getBin(std::atan2(w.dot(other), u.dot(other)), -M_PI, M_PI)];
+                ++nPairs;
+            } //...for neighbours
+
+            if (nPairs)
+                spfh.row(pointId) *= 100.f / nPairs;
+        } //...for points
+    });
+    return spfh;
+} //...calculateSpfhFeatures()
+
+FeaturesT
+calculateFpfhFeatures(
+    CloudConstRefT    const& cloud,
+    NormalsConstRefT  const& normals,
+    KnnIndicesT       const& neighbours,
+    KdTree::KnnDistsT const& distsSqr,
+    unsigned          const  nThreads
+) {
+    // Simplified features once per point, read by all its neighbours
+    FeaturesT const spfh = calculateSpfhFeatures(cloud, normals, neighbours, nThreads);
+
+    std::size_t const n = cloud.rows();
+    FeaturesT fpfh(n, static_cast<int>(FpfhDim));
+    parallelChunks(n, getChunkCount(n, nThreads, 1 << 12), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        Eigen::Matrix<float, 1, FpfhDim> sum;
+        for (std::size_t pointId = begin; pointId != end; ++pointId) {
+            sum.setZero();
+            for (int col = 0; col != neighbours.cols(); ++col) {
+                int const neighbourId = neighbours(pointId, col);
+                if (neighbourId >= 0 && distsSqr(pointId, col) > 0.)
+                    sum += spfh.row(neighbourId) / static_cast<float>(std::sqrt(distsSqr(pointId, col)));
+            }
+
+            // Each histogram of the neighbours to 100 again, then the own one on top
+            for (int histogram = 0; histogram != 3; ++histogram) {
+                auto segment = sum.segment<FpfhBins>(histogram * FpfhBins);
+                float const total = segment.sum();
+                if (total > 0.f)
+                    segment *= 100.f / total;
+            }
+            fpfh.row(pointId) = spfh.row(pointId) + sum;
+        } //...for points
+    });
+    return fpfh;
+} //...calculateFpfhFeatures()
+
+std::vector<int>
+matchFeatures(
+    FeaturesT const& source,
+    FeaturesT const& target,
+    unsigned  const  nThreads
+) {
+    std::size_t const n = source.rows();
+    std::vector<int> matches(n, -1);
+    if (!target.rows())
+        return matches;
+
+    //! nanoflann tree over the target descriptors, high-dimensional distance with early termination
+    typedef nanoflann::KDTreeSingleIndexAdaptor <
+        /*      Distance metric: */ nanoflann::L2_Adaptor<float, FeatureDataset>,
+        /*              Dataset: */ FeatureDataset,
+        /* Space dimensionality: */ FpfhDim
+    > FeatureIndexT;
+    FeatureDataset const dataset(target);
+    FeatureIndexT index(FpfhDim, dataset, nanoflann::KDTreeSingleIndexAdaptorParams(10));
+    index.buildIndex();
+
+    parallelChunks(n, getChunkCount(n, nThreads, 1 << 10), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            std::size_t match;
+            float       distSqr;
+            if (index.knnSearch(source.row(row).data(), 1, &match, &distSqr))
+                matches[row] = static_cast<int>(match);
+        }
+    });
+    return matches;
+} //...matchFeatures()
+
+} //...ns acq
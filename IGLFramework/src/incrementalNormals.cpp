@@ -0,0 +1,206 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#include "acq/incrementalNormals.h"
+
+#include "acq/impl/normalEstimation.hpp" // Templated functions
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+
+namespace acq {
+
+IncrementalNormals::IncrementalNormals(
+    CloudConstRefT const& cloud,
+    int            const  k,
+    float          const  maxDist,
+    unsigned       const  nThreads
+) : _k(std::max(0, k)),
+    _maxDistSqr(static_cast<double>(maxDist) * maxDist),
+    _points(cloud),
+    _reverse(cloud.rows()),
+    _tree(cloud),
+    _treeIds(cloud.rows()),
+    _pointIds(cloud.rows()),
+    _mark(cloud.rows(), 0)
+{
+    // Everything at once with the static tree, the dynamic one only serves updates
+    KdTree const cloudIndex(cloud);
+    KdTree::KnnDistsT distsSqr;
+    calculateCloudNeighbours(cloudIndex, _k, _neighbours, distsSqr, maxDist, nThreads);
+    _normals = calculateCloudNormals(cloudIndex.getPoints(), _neighbours, nThreads);
+
+    for (int pointId = 0; pointId != _points.rows(); ++pointId) {
+        _treeIds [pointId] = pointId;
+        _pointIds[pointId] = pointId;
+        for (int const neighbourId : _neighbours.row(pointId))
+            if (neighbourId >= 0)
+                _reverse[neighbourId].push_back(pointId);
+    }
+
+    // Orient everything, each component keeps the side of its first normal
+    std::vector<int> region(_points.rows());
+    for (int pointId = 0; pointId != _points.rows(); ++pointId)
+        region[pointId] = pointId;
+    std::fill(_mark.begin(), _mark.end(), 1);
+    orientRegion(region, _normals);
+} //...IncrementalNormals()
+
+template <typename _VisitorT>
+void IncrementalNormals::forEachLinked(int pointId, _VisitorT const& visit) const {
+    for (int const neighbourId : _neighbours.row(pointId))
+        if (neighbourId >= 0)
+            visit(neighbourId);
+    for (int const neighbourId : _reverse[pointId])
+        visit(neighbourId);
+} //...forEachLinked()
+
+void IncrementalNormals::updateNeighbours(int pointId) {
+    // Drop old links
+    for (int const neighbourId : _neighbours.row(pointId)) {
+        if (neighbourId < 0)
+            continue;
+        std::vector<int>& list = _reverse[neighbourId];
+        std::vector<int>::iterator const it = std::find(list.begin(), list.end(), pointId);
+        *it = list.back();
+        list.pop_back();
+    }
+
+    // Query one more, the point finds itself
+    std::vector<std::size_t> treeIds (_k + 1);
+    std::vector<double>      distsSqr(_k + 1);
+    Eigen::Vector3d const query = _points.row(pointId).transpose();
+    std::size_t const nFound = _tree.knnSearch(query.data(), _k + 1, treeIds.data(), distsSqr.data());
+
+    int* const row = _neighbours.row(pointId).data();
+    int col = 0;
+    for (std::size_t i = 0; i != nFound && col != _k; ++i) {
+        int const neighbourId = _pointIds[treeIds[i]];
+        if (neighbourId == pointId)
+            continue;
+        if (distsSqr[i] >= _maxDistSqr)
+            break;
+        row[col++] = neighbourId;
+        _reverse[neighbourId].push_back(pointId);
+    }
+    std::fill(row + col, row + _k, -1);
+} //...updateNeighbours()
+
+void IncrementalNormals::updateNormal(int pointId) {
+    int const* const row = _neighbours.row(pointId).data();
+    std::vector<int> const neighbourIds(row, std::find(row, row + _k, -1));
+    _normals.row(pointId) = calculatePointNormal(_points, pointId, neighbourIds).transpose();
+} //...updateNormal()
+
+std::size_t IncrementalNormals::update(std::vector<int> const& pointIds, CloudConstRefT const& positions) {
+    if (positions.rows() != static_cast<Eigen::Index>(pointIds.size())) {
+        std::cerr << "[IncrementalNormals::update] Position count " << positions.rows()
+                  << " does not match point count " << pointIds.size() << "\n";
+        throw new std::runtime_error("Position count mismatch");
+    }
+
+    // Affected: the moved points, and the points they were neighbours of
+    std::vector<int> affected;
+    auto markAffected = [this, &affected](int pointId) {
+        if (!_mark[pointId]) {
+            _mark[pointId] = 1;
+            affected.push_back(pointId);
+        }
+    };
+    for (std::size_t i = 0; i != pointIds.size(); ++i) {
+        int const pointId = pointIds[i];
+        markAffected(pointId);
+        for (int const neighbourId : _reverse[pointId])
+            markAffected(neighbourId);
+
+        // Reinsert at the new position
+        _tree.remove(_treeIds[pointId]);
+        _pointIds[_treeIds[pointId]] = -1;
+        _points.row(pointId) = positions.row(i);
+        _treeIds[pointId] = _tree.insert(positions.row(i));
+        _pointIds.push_back(pointId);
+    }
+
+    // And the points, whose neighbourhoods the moved points enter
+    int const nCandidates = _k + 1;
+    std::vector<std::size_t> treeIds (nCandidates);
+    std::vector<double>      distsSqr(nCandidates);
+    for (int const pointId : pointIds) {
+        Eigen::Vector3d const query = _points.row(pointId).transpose();
+        std::size_t const nFound = _tree.knnSearch(query.data(), nCandidates, treeIds.data(), distsSqr.data());
+        for (std::size_t i = 0; i != nFound; ++i) {
+            int const candidateId = _pointIds[treeIds[i]];
+            if (_mark[candidateId] || distsSqr[i] >= _maxDistSqr)
+                continue;
+            // Closer than the farthest neighbour, or room for more
+            int const farthestId = _k ? _neighbours(candidateId, _k - 1) : -1;
+            if (farthestId < 0 || distsSqr[i] < (_points.row(farthestId) - _points.row(candidateId)).squaredNorm())
+                markAffected(candidateId);
+        }
+    }
+
+    NormalsT previous(affected.size(), 3);
+    for (std::size_t i = 0; i != affected.size(); ++i) {
+        updateNeighbours(affected[i]);
+        previous.row(i) = _normals.row(affected[i]);
+    }
+    for (int const pointId : affected)
+        updateNormal(pointId);
+
+    orientRegion(affected, previous);
+    return affected.size();
+} //...update()
+
+void IncrementalNormals::orientRegion(std::vector<int> const& region, NormalsT const& previous) {
+    // _mark: 1 in the region and unvisited, 2 visited
+    std::queue<int> queue;
+    auto flipTowards = [this](int pointId, Eigen::RowVector3d const& direction) {
+        if (_normals.row(pointId).dot(direction) < 0.)
+            _normals.row(pointId) *= -1.;
+    };
+
+    // Seeds: points of the region next to points outside, voting by the normals around them
+    for (int const pointId : region) {
+        Eigen::RowVector3d outside(Eigen::RowVector3d::Zero());
+        forEachLinked(pointId, [this, &outside](int neighbourId) {
+            if (!_mark[neighbourId])
+                outside += _normals.row(neighbourId);
+        });
+        if (!outside.isZero()) {
+            flipTowards(pointId, outside);
+            _mark[pointId] = 2;
+            queue.push(pointId);
+        }
+    }
+
+    for (std::size_t i = 0; ; ++i) {
+        // Breadth-first search into the region
+        while (!queue.empty()) {
+            int const pointId = queue.front();
+            queue.pop();
+            forEachLinked(pointId, [this, pointId, &queue, &flipTowards](int neighbourId) {
+                if (_mark[neighbourId] == 1) {
+                    flipTowards(neighbourId, _normals.row(pointId));
+                    _mark[neighbourId] = 2;
+                    queue.push(neighbourId);
+                }
+            });
+        }
+
+        // Components not touching points outside, keep their previous side
+        for (; i != region.size() && _mark[region[i]] != 1; ++i) {}
+        if (i == region.size())
+            break;
+        flipTowards(region[i], previous.row(i));
+        _mark[region[i]] = 2;
+        queue.push(region[i]);
+    } //...for components
+
+    for (int const pointId : region)
+        _mark[pointId] = 0;
+} //...orientRegion()
+
+} //...ns acq
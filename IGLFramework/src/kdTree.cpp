@@ -0,0 +1,255 @@
+//
+// Created by bontius on 10/02/17.
+//
+
+#include "acq/kdTree.h"
+#include "acq/parallel.h"
+#include "acq/spatialOrder.h"
+
+#include "nanoflann/nanoflann.hpp"  // Nearest neighbour lookup in a pointcloud
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace acq {
+
+template <typename _Scalar>
+struct KdTreeT<_Scalar>::Impl {
+    //! nanoflann tree reading contiguous points from \ref PointStorageT
+    typedef nanoflann::KDTreeSingleIndexAdaptor <
+        /*      Distance metric: */ nanoflann::L2_Simple_Adaptor<Scalar, PointStorageType>,
+        /*              Dataset: */ PointStorageType,
+        /* Space dimensionality: */ PointStorageType::Dim
+    > FlannIndexT;
+
+    Impl(PointStorageType&& cloudPoints, KdTreeBuildParams const& params, Backend backend)
+        : points(std::move(cloudPoints))
+    {
+        switch (backend) {
+            case NANOFLANN:
+                flannIndex.reset(
+                    new FlannIndexT(PointStorageType::Dim, points,
+                                    nanoflann::KDTreeSingleIndexAdaptorParams(params.maxLeafs)));
+                flannIndex->buildIndex();
+                break;
+            default:
+                soaIndex.reset(new SoaKdTreeT<Scalar>(points, params));
+                break;
+        }
+    } //...Impl()
+
+    PointStorageType                    points;     //!< Row-major copy of the points, nanoflann points to this member.
+    std::unique_ptr<SoaKdTreeT<Scalar>> soaIndex;   //!< SIMD tree, if \ref SOA_SIMD.
+    std::unique_ptr<FlannIndexT>        flannIndex; //!< nanoflann tree, if \ref NANOFLANN.
+}; //...struct KdTreeT::Impl
+
+template <typename _Scalar>
+KdTreeT<_Scalar>::KdTreeT(PointStorageType&& points, int maxLeafs, Backend backend)
+    : KdTreeT(std::move(points), KdTreeBuildParams(maxLeafs), backend)
+{}
+
+template <typename _Scalar>
+KdTreeT<_Scalar>::KdTreeT(PointStorageType&& points, KdTreeBuildParams const& params, Backend backend)
+    : _impl(new Impl(std::move(points), params, backend)), _maxLeafs(params.maxLeafs), _backend(backend)
+{}
+
+template <typename _Scalar>
+KdTreeT<_Scalar>::~KdTreeT() {}
+
+template <typename _Scalar>
+std::size_t
+KdTreeT<_Scalar>::knnSearch(
+    Scalar          const* query,
+    int                    k,
+    std::size_t          * indices,
+    Scalar               * distsSqr,
+    KnnSearchParams const& params
+) const {
+    if (_impl->soaIndex)
+        return _impl->soaIndex->knnSearch(query, k, indices, distsSqr, params);
+
+    // Placeholder structure for nanoFLANN
+    nanoflann::KNNResultSet <Scalar> resultSet(k);
+    resultSet.init(indices, distsSqr);
+    _impl->flannIndex->findNeighbors(
+        /*                Output wrapper: */ resultSet,
+        /* Query point Scalar[3] pointer: */ query,
+        /*      Checks (ignored), epsilon: */ nanoflann::SearchParams(k, params.eps)
+    );
+    return resultSet.size();
+} //...KdTreeT::knnSearch()
+
+template <typename _Scalar>
+void
+KdTreeT<_Scalar>::batchKnnSearch(
+    CloudConstRefT  const& queries,
+    int                    k,
+    KnnIndicesT          & indices,
+    KnnDistsT            & distsSqr,
+    KnnSearchParams const& params,
+    unsigned               nThreads
+) const {
+    std::size_t const nQueries = queries.rows();
+    indices .setConstant(nQueries, std::max(0, k), -1);
+    distsSqr.setConstant(nQueries, std::max(0, k), std::numeric_limits<Scalar>::infinity());
+    if (k <= 0 || !nQueries)
+        return;
+
+    // Visit queries along the Z-order curve, neighbouring queries share tree paths in cache
+    PermutationT const order = calculateMortonOrder(queries, nThreads);
+
+    parallelChunks(nQueries, getChunkCount(nQueries, nThreads, 1024),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            std::vector<std::size_t> ids(k);
+            for (std::size_t i = begin; i != end; ++i) {
+                int    const row      = order(i);
+                Scalar const query[3] = { static_cast<Scalar>(queries(row, 0)),
+                                          static_cast<Scalar>(queries(row, 1)),
+                                          static_cast<Scalar>(queries(row, 2)) };
+                std::size_t const nFound = knnSearch(query, k, ids.data(), distsSqr.row(row).data(), params);
+                for (std::size_t j = 0; j != nFound; ++j)
+                    indices(row, j) = static_cast<int>(ids[j]);
+            }
+        }
+    );
+} //...KdTreeT::batchKnnSearch()
+
+template <typename _Scalar>
+void
+KdTreeT<_Scalar>::allKnnSearch(
+    int           k,
+    std::size_t * indices,
+    Scalar      * distsSqr,
+    std::size_t * counts,
+    unsigned      nThreads
+) const {
+    if (_impl->soaIndex) {
+        _impl->soaIndex->allKnnSearch(k, indices, distsSqr, counts, nThreads);
+        return;
+    }
+
+    // nanoflann: one query per point, k results each
+    std::size_t const n      = size();
+    std::size_t const stride = std::max(0, k);
+    parallelChunks(n, getChunkCount(n, nThreads, 1024), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId)
+            counts[pointId] = knnSearch(getPoints().point(pointId), k,
+                                        indices + pointId * stride, distsSqr + pointId * stride);
+    });
+} //...KdTreeT::allKnnSearch()
+
+template <typename _Scalar>
+void
+KdTreeT<_Scalar>::allKnnSearch(
+    int                                          k,
+    typename SoaKdTreeT<Scalar>::KnnSinkT const& sink,
+    unsigned                                     nThreads
+) const {
+    if (_impl->soaIndex) {
+        _impl->soaIndex->allKnnSearch(k, sink, nThreads);
+        return;
+    }
+
+    // nanoflann: one query per point
+    std::vector<std::size_t> ids(std::max(0, k));
+    std::vector<Scalar>      dists(std::max(0, k));
+    for (int pointId = 0; pointId != size() && k > 0; ++pointId)
+        sink(pointId, knnSearch(getPoints().point(pointId), k, ids.data(), dists.data()), ids.data(), dists.data());
+} //...KdTreeT::allKnnSearch()
+
+template <typename _Scalar>
+KnnRecallStats
+KdTreeT<_Scalar>::measureRecall(
+    int                    k,
+    KnnSearchParams const& params,
+    int                    nQueries
+) const {
+    typedef std::chrono::steady_clock ClockT;
+
+    KnnRecallStats stats;
+    nQueries = std::min(nQueries, size());
+    if (k <= 0 || nQueries <= 0)
+        return stats;
+
+    // Exact and approximate results of all queries, timed separately
+    std::vector<std::size_t> exactIds (nQueries * k), approxIds (nQueries * k);
+    std::vector<Scalar>      exactDists(nQueries * k), approxDists(nQueries * k);
+    std::vector<std::size_t> exactCounts(nQueries), approxCounts(nQueries);
+    std::size_t const        step = size() / nQueries;
+
+    ClockT::time_point start = ClockT::now();
+    for (int query = 0; query != nQueries; ++query)
+        exactCounts[query] = knnSearch(getPoints().point(query * step), k,
+                                       &exactIds[query * k], &exactDists[query * k]);
+    stats.exactSeconds = std::chrono::duration<double>(ClockT::now() - start).count();
+
+    start = ClockT::now();
+    for (int query = 0; query != nQueries; ++query)
+        approxCounts[query] = knnSearch(getPoints().point(query * step), k,
+                                        &approxIds[query * k], &approxDists[query * k], params);
+    stats.approxSeconds = std::chrono::duration<double>(ClockT::now() - start).count();
+
+    // Compare
+    std::size_t nExact = 0, nFound = 0;
+    double      sumRatio = 0.;
+    int         nRatios  = 0;
+    for (int query = 0; query != nQueries; ++query) {
+        std::size_t const* const exact   = &exactIds [query * k];
+        std::size_t const* const approx  = &approxIds[query * k];
+        std::size_t        const nApprox = approxCounts[query];
+        nExact += exactCounts[query];
+        for (std::size_t i = 0; i != exactCounts[query]; ++i)
+            nFound += std::find(approx, approx + nApprox, exact[i]) != approx + nApprox;
+
+        // Farthest neighbour distances, the error bound of eps applies to these
+        if (!exactCounts[query] || !nApprox)
+            continue;
+        Scalar const exactWorst  = exactDists [query * k + exactCounts[query] - 1];
+        Scalar const approxWorst = approxDists[query * k + nApprox - 1];
+        if (exactWorst > Scalar(0)) {
+            double const ratio = std::sqrt(static_cast<double>(approxWorst) / exactWorst);
+            sumRatio          += ratio;
+            stats.maxDistRatio = std::max(stats.maxDistRatio, ratio);
+            ++nRatios;
+        }
+    } //...for queries
+
+    stats.recall        = nExact  ? static_cast<double>(nFound) / nExact : 1.;
+    stats.meanDistRatio = nRatios ? sumRatio / nRatios : 1.;
+    stats.nQueries      = nQueries;
+    return stats;
+} //...KdTreeT::measureRecall()
+
+template <typename _Scalar>
+typename KdTreeT<_Scalar>::PointStorageType const& KdTreeT<_Scalar>::getPoints() const {
+    return _impl->points;
+} //...KdTreeT::getPoints()
+
+template <typename _Scalar>
+int KdTreeT<_Scalar>::size() const {
+    return _impl->points.size();
+} //...KdTreeT::size()
+
+template <typename _Scalar>
+std::size_t KdTreeT<_Scalar>::getMemoryFootprint() const {
+    return _impl->points.getMemoryFootprint()
+         + (_impl->soaIndex   ? _impl->soaIndex->getMemoryFootprint() : 0)
+         + (_impl->flannIndex ? _impl->flannIndex->usedMemory()       : 0);
+} //...KdTreeT::getMemoryFootprint()
+
+} //...ns acq
+
+//
+// Template instantiation
+//
+
+namespace acq {
+
+template class KdTreeT<float>;
+template class KdTreeT<double>;
+
+} //...ns acq
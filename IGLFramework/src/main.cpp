@@ -1,6 +1,6 @@
 #include "acq/normalEstimation.h"
 #include "acq/decoratedCloud.h"
-#include "acq/cloudManager.h"
+#include "acq/impl/cloudManager.hpp" // emplaceCloud()
 
 #include "nanogui/formhelper.h"
 #include "nanogui/screen.h"
@@ -8,45 +8,16 @@
 #include "igl/readOFF.h"
 #include "igl/viewer/Viewer.h"
 
+#include <chrono>
+#include <future>
 #include <iostream>
 
 namespace acq {
 
-/** \brief                      Re-estimate normals of cloud \p V fitting planes
- *                              to the \p kNeighbours nearest neighbours of each point.
- * \param[in ] kNeighbours      How many neighbours to use (Typiclaly: 5..15)
- * \param[in ] vertices         Input pointcloud. Nx3, where N is the number of points.
- * \param[in ] maxNeighbourDist Maximum distance between vertex and neighbour.
- * \param[out] viewer           The viewer to show the normals at.
- * \return                      The estimated normals, Nx3.
- */
-NormalsT
-recalcNormals(
-    int                 const  kNeighbours,
-    CloudT              const& vertices,
-    float               const  maxNeighbourDist
-) {
-    NeighboursT const neighbours =
-        calculateCloudNeighbours(
-            /* [in]        cloud: */ vertices,
-            /* [in] k-neighbours: */ kNeighbours,
-            /* [in]      maxDist: */ maxNeighbourDist
-        );
-
-    // Estimate normals for points in cloud vertices
-    NormalsT normals =
-        calculateCloudNormals(
-            /* [in]               Cloud: */ vertices,
-            /* [in] Lists of neighbours: */ neighbours
-        );
-
-    return normals;
-} //...recalcNormals()
-
 void setViewerNormals(
     igl::viewer::Viewer      & viewer,
-    CloudT              const& vertices,
-    NormalsT            const& normals
+    CloudConstRefT      const& vertices,
+    NormalsConstRefT    const& normals
 ) {
     // [Optional] Set viewer face normals for shading
     //viewer.data.set_normals(normals);
@@ -99,6 +70,8 @@ int main(int argc, char *argv[]) {
 
     // Store cloud so we can store normals later
     acq::CloudManager cloudManager;
+    // Normal estimation running in the background, if any
+    std::future<bool> normalsJob;
     // Read mesh from meshPath
     {
         // Pointcloud vertices, N rows x 3 columns.
@@ -114,36 +87,33 @@ int main(int argc, char *argv[]) {
             return EXIT_FAILURE;
         } //...if vertices read
 
-        // Store read vertices and faces
-        cloudManager.addCloud(acq::DecoratedCloud(V, F));
+        // Hand over read vertices and faces without copying them
+        acq::DecoratedCloud &cloud = cloudManager.emplaceCloud(std::move(V), std::move(F));
 
         // Show mesh
-        viewer.data.set_mesh(
-            cloudManager.getCloud(0).getVertices(),
-            cloudManager.getCloud(0).getFaces()
-        );
+        viewer.data.set_mesh(cloud.getVertices(), cloud.getFaces());
 
         // Calculate normals on launch
-        cloudManager.getCloud(0).setNormals(
-            acq::recalcNormals(
-                /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                /* [in]             Vertices matrix: */ cloudManager.getCloud(0).getVertices(),
-                /* [in]      max neighbour distance: */ maxNeighbourDist
-            )
+        cloud.estimateNormals(
+            /* [in]      K-neighbours for FLANN: */ kNeighbours,
+            /* [in]      max neighbour distance: */ maxNeighbourDist
         );
 
         // Update viewer
         acq::setViewerNormals(
             viewer,
-            cloudManager.getCloud(0).getVertices(),
-            cloudManager.getCloud(0).getNormals()
+            cloud.getVertices(),
+            cloud.getNormals()
         );
+
+        // Done with the reference, the cloud may be spilled from now on
+        cloudManager.releaseCloud(0);
     } //...read mesh
 
     // Extend viewer menu using a lambda function
     viewer.callback_init =
         [
-            &cloudManager, &kNeighbours, &maxNeighbourDist,
+            &cloudManager, &normalsJob, &kNeighbours, &maxNeighbourDist,
             &floatVariable, &boolVariable, &dir
         ] (igl::viewer::Viewer& viewer)
     {
@@ -165,12 +135,9 @@ int main(int argc, char *argv[]) {
                 kNeighbours = val;
 
                 // Recalculate normals for cloud and update viewer
-                cloud.setNormals(
-                    acq::recalcNormals(
-                        /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                        /* [in]             Vertices matrix: */ cloud.getVertices(),
-                        /* [in]      max neighbour distance: */ maxNeighbourDist
-                    )
+                cloud.estimateNormals(
+                    /* [in]      K-neighbours for FLANN: */ kNeighbours,
+                    /* [in]      max neighbour distance: */ maxNeighbourDist
                 );
 
                 // Update viewer
@@ -179,6 +146,9 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             }, //...setter lambda
 
             /*  Getter lambda: */ [&]() {
@@ -198,12 +168,9 @@ int main(int argc, char *argv[]) {
                 maxNeighbourDist = val;
 
                 // Recalculate normals for cloud and update viewer
-                cloud.setNormals(
-                    acq::recalcNormals(
-                        /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                        /* [in]             Vertices matrix: */ cloud.getVertices(),
-                        /* [in]      max neighbour distance: */ maxNeighbourDist
-                    )
+                cloud.estimateNormals(
+                    /* [in]      K-neighbours for FLANN: */ kNeighbours,
+                    /* [in]      max neighbour distance: */ maxNeighbourDist
                 );
 
                 // Update viewer
@@ -212,6 +179,9 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             }, //...setter lambda
 
             /*  Getter lambda: */ [&]() {
@@ -225,23 +195,20 @@ int main(int argc, char *argv[]) {
             /* displayed label: */ "Estimate normals (FLANN)",
 
             /* lambda to call: */ [&]() {
-                // store reference to current cloud (id 0 for now)
-                acq::DecoratedCloud &cloud = cloudManager.getCloud(0);
-
-                // calculate normals for cloud and update viewer
-                cloud.setNormals(
-                    acq::recalcNormals(
-                        /* [in]      k-neighbours for flann: */ kNeighbours,
-                        /* [in]             vertices matrix: */ cloud.getVertices(),
-                        /* [in]      max neighbour distance: */ maxNeighbourDist
-                    )
-                );
-
-                // update viewer
-                acq::setViewerNormals(
-                    /* [in, out] viewer to update: */ viewer,
-                    /* [in]            pointcloud: */ cloud.getVertices(),
-                    /* [in] normals of pointcloud: */ cloud.getNormals()
+                // copy parameters, the GUI may change them while the job runs
+                int   const k       = kNeighbours;
+                float const maxDist = maxNeighbourDist;
+
+                // calculate normals for cloud (id 0 for now) on a worker thread,
+                // the viewer is updated in callback_pre_draw when done
+                normalsJob = cloudManager.submitJob(
+                    /* [in] Cloud id: */ 0,
+                    /* [in]      Job: */ [k, maxDist](acq::DecoratedCloud &cloud) {
+                        cloud.estimateNormals(
+                            /* [in]      k-neighbours for flann: */ k,
+                            /* [in]      max neighbour distance: */ maxDist
+                        );
+                    }
                 );
             } //...button push lambda
         ); //...estimate normals using FLANN
@@ -256,18 +223,14 @@ int main(int argc, char *argv[]) {
 
                 // Check, if normals already exist
                 if (!cloud.hasNormals())
-                    cloud.setNormals(
-                        acq::recalcNormals(
-                            /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                            /* [in]             Vertices matrix: */ cloud.getVertices(),
-                            /* [in]      max neighbour distance: */ maxNeighbourDist
-                        )
+                    cloud.estimateNormals(
+                        /* [in]      K-neighbours for FLANN: */ kNeighbours,
+                        /* [in]      max neighbour distance: */ maxNeighbourDist
                     );
 
-                // Estimate neighbours using FLANN
-                acq::NeighboursT const neighbours =
-                    acq::calculateCloudNeighbours(
-                        /* [in]        Cloud: */ cloud.getVertices(),
+                // Neighbours using FLANN, reused, if estimated with the same parameters before
+                std::shared_ptr<acq::NeighboursT const> const neighbours =
+                    cloud.getNeighbours(
                         /* [in] k-neighbours: */ kNeighbours,
                         /* [in]      maxDist: */ maxNeighbourDist
                     );
@@ -275,7 +238,7 @@ int main(int argc, char *argv[]) {
                 // Orient normals in place using established neighbourhood
                 int nFlips =
                     acq::orientCloudNormals(
-                        /* [in    ] Lists of neighbours: */ neighbours,
+                        /* [in    ] Lists of neighbours: */ *neighbours,
                         /* [in,out]   Normals to change: */ cloud.getNormals()
                     );
                 std::cout << "nFlips: " << nFlips << "/" << cloud.getNormals().size() << "\n";
@@ -286,6 +249,9 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             } //...lambda to call on buttonclick
         ); //...addButton(orientFLANN)
 
@@ -303,25 +269,20 @@ int main(int argc, char *argv[]) {
 
                 // Check, if normals already exist
                 if (!cloud.hasNormals())
-                    cloud.setNormals(
-                        acq::recalcNormals(
-                            /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                            /* [in]             Vertices matrix: */ cloud.getVertices(),
-                            /* [in]      max neighbour distance: */ maxNeighbourDist
-                        )
+                    cloud.estimateNormals(
+                        /* [in]      K-neighbours for FLANN: */ kNeighbours,
+                        /* [in]      max neighbour distance: */ maxNeighbourDist
                     );
 
-                // Estimate neighbours using FLANN
-                acq::NeighboursT const neighbours =
-                    acq::calculateCloudNeighboursFromFaces(
-                        /* [in] Faces: */ cloud.getFaces()
-                    );
+                // Neighbours from faces, cached until the faces change
+                std::shared_ptr<acq::NeighboursT const> const neighbours =
+                    cloud.getFaceNeighbours();
 
                 // Estimate normals for points in cloud vertices
                 cloud.setNormals(
                     acq::calculateCloudNormals(
                         /* [in]               Cloud: */ cloud.getVertices(),
-                        /* [in] Lists of neighbours: */ neighbours
+                        /* [in] Lists of neighbours: */ *neighbours
                     )
                 );
 
@@ -331,6 +292,9 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             } //...button push lambda
         ); //...estimate normals from faces
 
@@ -344,12 +308,9 @@ int main(int argc, char *argv[]) {
 
                 // Check, if normals already exist
                 if (!cloud.hasNormals())
-                    cloud.setNormals(
-                        acq::recalcNormals(
-                            /* [in]      K-neighbours for FLANN: */ kNeighbours,
-                            /* [in]             Vertices matrix: */ cloud.getVertices(),
-                            /* [in]      max neighbour distance: */ maxNeighbourDist
-                        )
+                    cloud.estimateNormals(
+                        /* [in]      K-neighbours for FLANN: */ kNeighbours,
+                        /* [in]      max neighbour distance: */ maxNeighbourDist
                     );
 
                 // Orient normals in place using established neighbourhood
@@ -366,6 +327,9 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             } //...lambda to call on buttonclick
         ); //...addButton(orientFromFaces)
 
@@ -389,6 +353,35 @@ int main(int argc, char *argv[]) {
                     /* [in]            Pointcloud: */ cloud.getVertices(),
                     /* [in] Normals of Pointcloud: */ cloud.getNormals()
                 );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
+            } //...lambda to call on buttonclick
+        );
+
+        // Add a button for sorting points along a space filling curve,
+        // neighbour queries touch less memory this way, but point ids change
+        viewer.ngui->addButton(
+            /* Displayed label: */ "Sort points (Z-order)",
+            /*  Lambda to call: */ [&](){
+                // Store reference to current cloud (id 0 for now)
+                acq::DecoratedCloud &cloud = cloudManager.getCloud(0);
+
+                // Reorder points, normals and faces
+                cloud.reorderMorton();
+
+                // Update viewer, faces refer to the new point ids
+                viewer.data.clear();
+                viewer.data.set_mesh(cloud.getVertices(), cloud.getFaces());
+                if (cloud.hasNormals())
+                    acq::setViewerNormals(
+                        /* [in, out] Viewer to update: */ viewer,
+                        /* [in]            Pointcloud: */ cloud.getVertices(),
+                        /* [in] Normals of Pointcloud: */ cloud.getNormals()
+                    );
+
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             } //...lambda to call on buttonclick
         );
 
@@ -403,6 +396,8 @@ int main(int argc, char *argv[]) {
                 // Set normals to be used by viewer
                 viewer.data.set_normals(cloud.getNormals());
 
+                // Unpin, the cloud may be spilled from now on
+                cloudManager.releaseCloud(0);
             } //...lambda to call on buttonclick
         );
 
@@ -443,6 +438,31 @@ int main(int argc, char *argv[]) {
         return false;
     }; //...viewer menu
 
+    // Show results of background jobs once they are done
+    viewer.callback_pre_draw =
+        [&cloudManager, &normalsJob] (igl::viewer::Viewer& viewer)
+    {
+        // Nothing running, or still running
+        if (!normalsJob.valid() ||
+            normalsJob.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return false;
+
+        if (normalsJob.get()) {
+            // Cheap copy, channels are shared
+            acq::DecoratedCloud const cloud = cloudManager.getSnapshot(0);
+
+            // Update viewer
+            acq::setViewerNormals(
+                /* [in, out] Viewer to update: */ viewer,
+                /* [in]            Pointcloud: */ cloud.getVertices(),
+                /* [in] Normals of Pointcloud: */ cloud.getNormals()
+            );
+        } else
+            std::cerr << "Cloud changed while estimating normals, result discarded\n";
+
+        return false;
+    }; //...pre draw
+
 
     // Start viewer
     viewer.launch();
@@ -6,8 +6,6 @@
 
 #include "acq/impl/normalEstimation.hpp" // Templated functions
 
-#include "nanoflann/nanoflann.hpp"  // Nearest neighbour lookup in a pointcloud
-
 #include <queue>
 #include <set>
 #include <iostream>
@@ -16,188 +14,53 @@ namespace acq {
 
 NeighboursT
 calculateCloudNeighbours(
-    CloudT  const& cloud,
-    int     const  k,
-    float   const  maxDist,
-    int     const  maxLeafs
+    CloudConstRefT const& cloud,
+    int            const  k,
+    float          const  maxDist,
+    int            const  maxLeafs
 ) {
-    // Floating point type
-    typedef typename CloudT::Scalar Scalar;
-    // Point dimensions
-    enum { Dim = 3 };
-    // Copy-free Eigen->FLANN wrapper
-    typedef nanoflann::KDTreeEigenMatrixAdaptor <
-        /*    Eigen matrix type: */ CloudT,
-        /* Space dimensionality: */ Dim,
-        /*      Distance metric: */ nanoflann::metric_L2
-    > KdTreeWrapperT;
-
-    // Squared max distance
-    float const maxDistSqr = maxDist * maxDist;
-
-    // Safety check dimensionality
-    if (cloud.cols() != Dim) {
-        std::cerr << "Point dimension mismatch: " << cloud.cols()
-                  << " vs. " << Dim
-                  << "\n";
-        throw new std::runtime_error("Point dimension mismatch");
-    } //...check dimensionality
+    return calculateCloudNeighbours(cloud, k, maxDist, KdTreeBuildParams(maxLeafs));
+} //...calculateCloudNeighbours()
 
+NeighboursT
+calculateCloudNeighbours(
+    CloudConstRefT    const& cloud,
+    int               const  k,
+    float             const  maxDist,
+    KdTreeBuildParams const& buildParams,
+    KnnSearchParams   const& searchParams
+) {
     // Build KdTree
-    KdTreeWrapperT cloudIndex(Dim, cloud, maxLeafs);
-    cloudIndex.index->buildIndex();
-
-    // Neighbour indices
-    std::vector<size_t> neighbourIndices(k);
-    std::vector<Scalar> distsSqr(k);
-
-    // Placeholder structure for nanoFLANN
-    nanoflann::KNNResultSet <Scalar> resultSet(k);
-
-    // Associative list of neighbours: { pointId => [neighbourId_0, nId_1, ... nId_k-1] }
-    NeighboursT neighbours;
-    // For each point, store normal
-    for (int pointId = 0; pointId != cloud.rows(); ++pointId) {
-        // Initialize nearest neighhbour estimation
-        resultSet.init(&neighbourIndices[0], &distsSqr[0]);
-
-        // Make sure it's ok to expose raw data pointer of point
-        static_assert(
-            std::is_same<Scalar, double>::value,
-            "Double input assumed next. Otherwise, explicit copy is needed!"
-        );
-
-        // Find neighbours of point in "pointId"-th row
-        cloudIndex.index->findNeighbors(
-            /*                Output wrapper: */ resultSet,
-            /* Query point double[3] pointer: */ cloud.row(pointId).data(),
-            /*    How many neighbours to use: */ nanoflann::SearchParams(k)
-        );
-
-        // Filter neighbours by squared distance
-        NeighboursT::mapped_type currNeighbours;
-        for (int i = 0; i != neighbourIndices.size(); ++i) {
-            // if not same point and close enough
-            if ((neighbourIndices[i] != pointId   ) &&
-                (distsSqr        [i] <  maxDistSqr))
-                currNeighbours.insert(neighbourIndices[i]);
-        }
-
-        // Store list of neighbours
-        std::pair<NeighboursT::iterator, bool> const success =
-            neighbours.insert(
-                std::make_pair(
-                    pointId,
-                    currNeighbours
-                )
-            );
-
-        if (!success.second)
-            std::cerr << "Could not store neighbours of point " << pointId
-                      << ", already inserted?\n";
-
-    } //...for all points
-
-    // return estimated normals
-    return neighbours;
-} //...calculateCloudNormals()
+    KdTree const cloudIndex(cloud, buildParams);
+
+    return calculateCloudNeighbours(cloudIndex, k, maxDist, searchParams);
+} //...calculateCloudNeighbours()
+
+NeighboursT
+calculateCloudNeighbours(
+    CloudConstRefT   const& cloud,
+    int              const  k,
+    float            const  maxDist,
+    SpatialIndexType const  indexType
+) {
+    if (indexType == KD_TREE_INDEX)
+        return calculateCloudNeighbours(cloud, k, maxDist, KdTreeBuildParams());
+
+    // Cell size from the point density, a few points per cell
+    VoxelGrid const cloudIndex(cloud);
+
+    return calculateCloudNeighbours(cloudIndex, k, maxDist);
+} //...calculateCloudNeighbours()
 
 NormalsT
 calculateCloudNormals(
-    CloudT      const& cloud,
-    NeighboursT const& neighbours
+    CloudConstRefT const& cloud,
+    NeighboursT    const& neighbours
 ) {
-    // Output normals: N x 3
-    CloudT normals(cloud.rows(), 3);
-
-    // For each point, store normal
-    for (int pointId = 0; pointId != cloud.rows(); ++pointId) {
-        // Estimate vertex normal from neighbourhood indices and cloud
-        normals.row(pointId) =
-            calculatePointNormal(
-                /*        PointCloud: */ cloud,
-                /*      ID of vertex: */ pointId,
-                /* Ids of neighbours: */ neighbours.at(pointId)
-            );
-    } //...for all points
-
-    // Return estimated normals
-    return normals;
+    // Gather points contiguously once instead of strided reads per neighbour
+    return calculateCloudNormals(PointStorage(cloud), neighbours);
 } //...calculateCloudNormals()
 
-int
-orientCloudNormals(
-    NeighboursT const& neighbours,
-    NormalsT         & normals
-) {
-    if (!normals.size()) {
-        std::cerr << "[orientCloudNormals] No normals to work on...\n";
-        return -1;
-    }
-
-    // List of points to visit
-    std::queue<int> queue;
-    // Quick-lookup unique container of already visited points
-    std::set<int> visited;
-
-    // Count changes
-    int nFlips = 0;
-
-    while (visited.size() != normals.size()) {
-        // Traverse a connected component
-        if (queue.empty()) {
-            if (!visited.size()) {
-                // Initialize queue with one random point
-                queue.push(rand() % normals.size()); // TODO: pick point with low curvature
-            } else {
-                // Expand queue with first unvisited point
-                for (int i = 0; i != normals.size() && queue.empty(); ++i) {
-                    // if unvisited, use
-                    if (visited.find(i) == visited.end())
-                        queue.push(i); // enqueue
-                } //...for each point
-            } //...next component
-
-            // Set visited
-            visited.insert(queue.front());
-        } //...if queue empty
-
-        // While points to visit exist
-        while (!queue.empty()) {
-            // Read next point from queue
-            int const pointId = queue.front();
-            // Remove point from queue
-            queue.pop();
-
-            // Fetch neighbours
-            NeighboursT::const_iterator const iter = neighbours.find(pointId);
-            // Check, if any neighbours
-            if (iter == neighbours.end()) {
-                //std::cerr << "Could not find neighbours of point " << pointId << "\n";
-                continue;
-            }
-
-            for (int const neighbourId : iter->second) {
-                // If unvisited
-                if (visited.find(neighbourId) == visited.end()) {
-                    // Enqueue for next level
-                    queue.push(neighbourId);
-                    // Mark visited
-                    visited.insert(neighbourId);
-
-                    // Flip neighbour normal, if not same direction as precursor point
-                    if (normals.row(pointId).dot(normals.row(neighbourId)) < 0.f) {
-                        normals.row(neighbourId) *= -1.f;
-                        ++nFlips;
-                    }
-                } //...if neighbour unvisited
-            } //...for each neighbour of point
-        } //...while points in queue
-    }
-
-    return nFlips;
-} //...orientCloudNormals()
-
 } //...ns acq
 
 
@@ -218,4 +81,123 @@ calculateCloudNeighboursFromFaces(
     FacesT const& faces
 );
 
+template int
+orientCloudNormalsFromFaces(
+    FacesConstMapT const& faces,
+    NormalsT            & normals
+);
+
+template NeighboursT
+calculateCloudNeighboursFromFaces(
+    FacesConstMapT const& faces
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    KdTreeT<float>  const& cloudIndex,
+    int             const  k,
+    float           const  maxDist,
+    KnnSearchParams const& searchParams
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    KdTreeT<double> const& cloudIndex,
+    int             const  k,
+    float           const  maxDist,
+    KnnSearchParams const& searchParams
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    VoxelGridT<float> const& cloudIndex,
+    int               const  k,
+    float             const  maxDist
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    VoxelGridT<double> const& cloudIndex,
+    int                const  k,
+    float              const  maxDist
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    DynamicKdTreeT<float> const& cloudIndex,
+    int                   const  k,
+    float                 const  maxDist
+);
+
+template NeighboursT
+calculateCloudNeighbours(
+    DynamicKdTreeT<double> const& cloudIndex,
+    int                    const  k,
+    float                  const  maxDist
+);
+
+template void
+calculateCloudNeighbours(
+    KdTreeT<float>            const& cloudIndex,
+    int                       const  k,
+    KnnIndicesT                    & neighbours,
+    KdTreeT<float>::KnnDistsT      & distsSqr,
+    float                     const  maxDist,
+    unsigned                  const  nThreads
+);
+
+template void
+calculateCloudNeighbours(
+    KdTreeT<double>            const& cloudIndex,
+    int                        const  k,
+    KnnIndicesT                     & neighbours,
+    KdTreeT<double>::KnnDistsT      & distsSqr,
+    float                      const  maxDist,
+    unsigned                   const  nThreads
+);
+
+template NormalsFT
+calculateCloudNormals(
+    PointStorageT<float> const& points,
+    KnnIndicesT          const& neighbours,
+    unsigned             const  nThreads
+);
+
+template NormalsT
+calculateCloudNormals(
+    PointStorageT<double> const& points,
+    KnnIndicesT           const& neighbours,
+    unsigned              const  nThreads
+);
+
+template NormalsFT
+calculateCloudNormals(
+    PointStorageT<float> const& points,
+    NeighboursT          const& neighbours
+);
+
+template NormalsT
+calculateCloudNormals(
+    PointStorageT<double> const& points,
+    NeighboursT           const& neighbours
+);
+
+template int
+orientCloudNormals(
+    NeighboursT const& neighbours,
+    NormalsT         & normals
+);
+
+template int
+orientCloudNormals(
+    NeighboursT const& neighbours,
+    NormalsFT        & normals
+);
+
+template int
+orientCloudNormalsFromFaces(
+    FacesT    const& faces,
+    NormalsFT      & normals
+);
+
 } //...ns acq
@@ -0,0 +1,230 @@
+//
+// Created by bontius on 17/02/17.
+//
+
+#include "acq/organizedCloud.h"
+#include "acq/parallel.h"
+
+#include "Eigen/Geometry"          // cross, unitOrthogonal
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace acq {
+
+namespace {
+
+//! Sums per pixel: count, x, y, z, xx, xy, xz, yy, yz, zz.
+enum { MomentCount = 10 };
+//! Integral images of the moments, column (row * (width + 1) + col) sums the pixels above and left of it.
+typedef Eigen::Matrix<double, MomentCount, Eigen::Dynamic> IntegralT;
+
+/** \brief Complains, if \p cloud does not have one row per pixel. */
+void checkGridSize(CloudConstRefT const& cloud, int width, int height, char const* caller) {
+    if (width < 0 || height < 0 || cloud.rows() != static_cast<Eigen::Index>(width) * height) {
+        std::cerr << "[" << caller << "] Grid " << width << " x " << height
+                  << " does not match point count " << cloud.rows() << "\n";
+        throw new std::runtime_error("Grid size mismatch");
+    }
+} //...checkGridSize()
+
+/** \brief Summed area tables of the moments of the valid points, relative to \p origin. */
+IntegralT
+calculateMomentIntegrals(
+    CloudConstRefT  const& cloud,
+    int             const  width,
+    int             const  height,
+    Eigen::Vector3d const& origin,
+    unsigned        const  nThreads
+) {
+    int const stride = width + 1;
+    IntegralT integral(MomentCount, static_cast<Eigen::Index>(stride) * (height + 1));
+    integral.leftCols(stride).setZero();
+
+    // Prefix sums along pixel rows, rows are independent
+    parallelChunks(height, getChunkCount(height, nThreads, 16),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (std::size_t row = begin; row != end; ++row) {
+                Eigen::Index const first = (row + 1) * stride;
+                double sums[MomentCount] = { 0. };
+                integral.col(first).setZero();
+                for (int col = 0; col != width; ++col) {
+                    Eigen::Index const pointId = static_cast<Eigen::Index>(row) * width + col;
+                    double const x = cloud(pointId, 0) - origin(0);
+                    double const y = cloud(pointId, 1) - origin(1);
+                    double const z = cloud(pointId, 2) - origin(2);
+                    if (std::isfinite(x) && std::isfinite(y) && std::isfinite(z)) {
+                        sums[0] += 1.;
+                        sums[1] += x;     sums[2] += y;     sums[3] += z;
+                        sums[4] += x * x; sums[5] += x * y; sums[6] += x * z;
+                        sums[7] += y * y; sums[8] += y * z; sums[9] += z * z;
+                    }
+                    integral.col(first + col + 1) = Eigen::Map<Eigen::Matrix<double, MomentCount, 1> const>(sums);
+                } //...for cols
+            } //...for rows
+        });
+
+    // Then down the pixel columns, chunks of columns are independent
+    parallelChunks(stride, getChunkCount(stride, nThreads, 64),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (int row = 1; row <= height; ++row)
+                integral.middleCols(row * stride + begin, end - begin) +=
+                    integral.middleCols((row - 1) * stride + begin, end - begin);
+        });
+
+    return integral;
+} //...calculateMomentIntegrals()
+
+/** \brief Unit eigenvector of the smallest eigenvalue of a symmetric 3 x 3 matrix.
+ *
+ * Only the smallest eigenpair is needed for a normal, cheaper than a full
+ * (even direct) decomposition: the eigenvalue in closed form (trigonometric
+ * solution of the characteristic polynomial), the vector as the largest
+ * cross product of two rows of cov - lambda * I, which span its orthogonal complement.
+ */
+Eigen::Vector3d getSmallestEigenVector(Eigen::Matrix3d cov) {
+    // Shift and scale for precision
+    double const shift = cov.trace() / 3.;
+    cov.diagonal().array() -= shift;
+    double const scale = cov.cwiseAbs().maxCoeff();
+    if (scale <= 0.)
+        return Eigen::Vector3d::UnitZ();
+    cov /= scale;
+
+    // Eigenvalues of the traceless matrix are 2 sqrt(p / 3) cos(phi + 2 pi j / 3)
+    double const p    = cov.squaredNorm() / 6.;
+    double const q    = cov.determinant() / 2.;
+    double const r    = std::max(-1., std::min(1., q / (p * std::sqrt(p))));
+    double const phi  = std::acos(r) / 3.;
+    double const lambda = 2. * std::sqrt(p) * std::cos(phi + 2. * M_PI / 3.);
+
+    cov.diagonal().array() -= lambda;
+    Eigen::Vector3d const c01 = cov.row(0).cross(cov.row(1));
+    Eigen::Vector3d const c02 = cov.row(0).cross(cov.row(2));
+    Eigen::Vector3d const c12 = cov.row(1).cross(cov.row(2));
+    double const n01 = c01.squaredNorm(), n02 = c02.squaredNorm(), n12 = c12.squaredNorm();
+    if (n01 >= n02 && n01 >= n12 && n01 > 0.)
+        return c01 / std::sqrt(n01);
+    if (n02 >= n12 && n02 > 0.)
+        return c02 / std::sqrt(n02);
+    if (n12 > 0.)
+        return c12 / std::sqrt(n12);
+
+    // Two or three equal smallest eigenvalues: any vector orthogonal to a nonzero row
+    for (int row = 0; row != 3; ++row)
+        if (cov.row(row).squaredNorm() > 0.)
+            return cov.row(row).transpose().unitOrthogonal();
+    return Eigen::Vector3d::UnitZ();
+} //...getSmallestEigenVector()
+
+} //...ns anonymous
+
+KnnIndicesT
+calculateOrganizedNeighbours(
+    CloudConstRefT const& cloud,
+    int            const  width,
+    int            const  height,
+    int            const  windowRadius,
+    float          const  maxDist,
+    unsigned       const  nThreads
+) {
+    checkGridSize(cloud, width, height, "calculateOrganizedNeighbours");
+
+    int    const side       = 2 * std::max(0, windowRadius) + 1;
+    double const maxDistSqr = static_cast<double>(maxDist) * maxDist;
+    KnnIndicesT neighbours(KnnIndicesT::Constant(cloud.rows(), side * side - 1, -1));
+
+    parallelChunks(height, getChunkCount(height, nThreads, 16),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (int row = static_cast<int>(begin); row != static_cast<int>(end); ++row) {
+                int const rowLow  = std::max(0, row - windowRadius);
+                int const rowHigh = std::min(height - 1, row + windowRadius);
+                for (int col = 0; col != width; ++col) {
+                    int const pointId = row * width + col;
+                    Eigen::RowVector3d const point = cloud.row(pointId);
+                    if (!point.allFinite())
+                        continue;
+
+                    int const colLow  = std::max(0, col - windowRadius);
+                    int const colHigh = std::min(width - 1, col + windowRadius);
+                    int* const ids = neighbours.row(pointId).data();
+                    int count = 0;
+                    for (int windowRow = rowLow; windowRow <= rowHigh; ++windowRow) {
+                        for (int windowCol = colLow; windowCol <= colHigh; ++windowCol) {
+                            int const neighbourId = windowRow * width + windowCol;
+                            // Invalid pixels have a NaN distance and fail the comparison
+                            if (neighbourId != pointId &&
+                                (cloud.row(neighbourId) - point).squaredNorm() < maxDistSqr)
+                                ids[count++] = neighbourId;
+                        }
+                    } //...for window
+                } //...for cols
+            } //...for rows
+        });
+
+    return neighbours;
+} //...calculateOrganizedNeighbours()
+
+NormalsT
+calculateOrganizedNormals(
+    CloudConstRefT const& cloud,
+    int            const  width,
+    int            const  height,
+    int            const  windowRadius,
+    unsigned       const  nThreads
+) {
+    checkGridSize(cloud, width, height, "calculateOrganizedNormals");
+
+    NormalsT normals(NormalsT::Constant(cloud.rows(), 3, std::numeric_limits<double>::quiet_NaN()));
+
+    // Moments relative to a valid point, keeps the sums small for clouds far from the origin
+    Eigen::Vector3d origin(Eigen::Vector3d::Zero());
+    for (Eigen::Index pointId = 0; pointId != cloud.rows(); ++pointId)
+        if (cloud.row(pointId).allFinite()) {
+            origin = cloud.row(pointId).transpose();
+            break;
+        }
+    IntegralT const integral = calculateMomentIntegrals(cloud, width, height, origin, nThreads);
+
+    int const radius = std::max(0, windowRadius);
+    int const stride = width + 1;
+    parallelChunks(height, getChunkCount(height, nThreads, 16),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (int row = static_cast<int>(begin); row != static_cast<int>(end); ++row) {
+                // Window rows [rowLow, rowHigh) in integral coordinates
+                int const rowLow  = std::max(0, row - radius);
+                int const rowHigh = std::min(height, row + radius + 1);
+                for (int col = 0; col != width; ++col) {
+                    int const pointId = row * width + col;
+                    if (!cloud.row(pointId).allFinite())
+                        continue;
+
+                    // Sum over the window from the four corners of the integral images
+                    int const colLow  = std::max(0, col - radius);
+                    int const colHigh = std::min(width, col + radius + 1);
+                    Eigen::Matrix<double, MomentCount, 1> const sums =
+                          integral.col(rowHigh * stride + colHigh) - integral.col(rowLow * stride + colHigh)
+                        - integral.col(rowHigh * stride + colLow ) + integral.col(rowLow * stride + colLow );
+
+                    double const count = sums(0);
+                    if (count < 2.5)
+                        continue;
+
+                    Eigen::Vector3d const mean = sums.segment<3>(1) / count;
+                    Eigen::Matrix3d cov;
+                    cov << sums(4), sums(5), sums(6),
+                           sums(5), sums(7), sums(8),
+                           sums(6), sums(8), sums(9);
+                    cov = cov / count - mean * mean.transpose();
+
+                    normals.row(pointId) = getSmallestEigenVector(cov).transpose();
+                } //...for cols
+            } //...for rows
+        });
+
+    return normals;
+} //...calculateOrganizedNormals()
+
+} //...ns acq
@@ -0,0 +1,98 @@
+//
+// Created by bontius on 18/02/17.
+//
+
+#include "acq/outlierRemoval.h"
+
+#include "acq/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace acq {
+
+std::vector<char>
+findStatisticalInliers(
+    KdTree::KnnDistsT const& distsSqr,
+    double            const  stdDevMul,
+    unsigned          const  nThreads
+) {
+    std::size_t const n       = distsSqr.rows();
+    int         const nChunks = getChunkCount(n, nThreads);
+
+    // Mean neighbour distance of each point, NaN without neighbours
+    std::vector<double> meanDists(n);
+    std::vector<double> sums  (nChunks, 0.);
+    std::vector<double> counts(nChunks, 0.);
+    parallelChunks(n, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            double sum   = 0.;
+            int    count = 0;
+            for (int col = 0; col != distsSqr.cols() && std::isfinite(distsSqr(row, col)); ++col, ++count)
+                sum += std::sqrt(distsSqr(row, col));
+            meanDists[row] = count ? sum / count : std::numeric_limits<double>::quiet_NaN();
+            if (count) {
+                sums  [chunk] += meanDists[row];
+                counts[chunk] += 1.;
+            }
+        }
+    });
+    double sum = 0., count = 0.;
+    for (int chunk = 0; chunk != nChunks; ++chunk) {
+        sum   += sums  [chunk];
+        count += counts[chunk];
+    }
+    double const mean = count ? sum / count : 0.;
+
+    // Second pass for the variance, summing squares of large means would cancel
+    std::fill(sums.begin(), sums.end(), 0.);
+    parallelChunks(n, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row)
+            if (!std::isnan(meanDists[row]))
+                sums[chunk] += (meanDists[row] - mean) * (meanDists[row] - mean);
+    });
+    double variance = 0.;
+    for (int chunk = 0; chunk != nChunks; ++chunk)
+        variance += sums[chunk];
+    double const threshold = mean + stdDevMul * std::sqrt(count > 1. ? variance / (count - 1.) : 0.);
+
+    // NaN compares false, points without neighbours are dropped
+    std::vector<char> inliers(n);
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row)
+            inliers[row] = meanDists[row] <= threshold;
+    });
+    return inliers;
+} //...findStatisticalInliers()
+
+std::vector<char>
+findRadiusInliers(
+    KdTree::KnnDistsT const& distsSqr,
+    double            const  radius,
+    int               const  minNeighbours,
+    unsigned          const  nThreads
+) {
+    if (minNeighbours > distsSqr.cols()) {
+        std::cerr << "[findRadiusInliers] Need at least " << minNeighbours << " neighbours per point, got "
+                  << distsSqr.cols() << "\n";
+        throw new std::runtime_error("Too few neighbours");
+    }
+
+    std::size_t const n = distsSqr.rows();
+    std::vector<char> inliers(n, 1);
+    if (minNeighbours <= 0)
+        return inliers;
+
+    // Neighbours come closest first, enough of them, if the last one needed is close enough
+    double const radiusSqr = radius * radius;
+    parallelChunks(n, getChunkCount(n, nThreads), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row)
+            inliers[row] = distsSqr(row, minNeighbours - 1) < radiusSqr;
+    });
+    return inliers;
+} //...findRadiusInliers()
+
+} //...ns acq
@@ -0,0 +1,319 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#include "acq/registration.h"
+
+#include "acq/parallel.h"
+#include "acq/features.h"
+
+#include "Eigen/Geometry"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace acq {
+
+namespace {
+
+//! Rotation angles about x, y and z, then translation.
+typedef Eigen::Matrix<double, 6, 1> IcpUpdateT;
+//! Normal equations of the update.
+typedef Eigen::Matrix<double, 6, 6> IcpSystemT;
+
+/** \brief Normal equations of a chunk of point pairs. */
+struct IcpSums {
+    IcpSums() : lhs(IcpSystemT::Zero()), rhs(IcpUpdateT::Zero()), sumSqr(0.), count(0) {}
+
+    IcpSystemT lhs;    //!< Sum of J * J^T.
+    IcpUpdateT rhs;    //!< Sum of -J * residual.
+    double     sumSqr; //!< Sum of squared residuals.
+    int        count;  //!< Number of pairs.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct IcpSums
+
+/** \brief Rigid transform of the rotation angles and translation in \p update. */
+Eigen::Matrix4d getIncrement(IcpUpdateT const& update) {
+    Eigen::Matrix4d increment(Eigen::Matrix4d::Identity());
+    increment.topLeftCorner<3, 3>() =
+        (Eigen::AngleAxisd(update(2), Eigen::Vector3d::UnitZ()) *
+         Eigen::AngleAxisd(update(1), Eigen::Vector3d::UnitY()) *
+         Eigen::AngleAxisd(update(0), Eigen::Vector3d::UnitX())).toRotationMatrix();
+    increment.topRightCorner<3, 1>() = update.tail<3>();
+    return increment;
+} //...getIncrement()
+
+/** \brief Random number from \p seed and \p index (splitmix64), so samples do not depend on the thread drawing them. */
+inline std::uint64_t getRandom(std::uint64_t seed, std::uint64_t index) {
+    std::uint64_t x = seed + (index + 1) * 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+} //...getRandom()
+
+/** \brief Best hypothesis of a chunk of RANSAC iterations. */
+struct RansacBest {
+    RansacBest() : transform(Eigen::Matrix4d::Identity()), nInliers(0), iteration(-1), nValidSamples(0) {}
+
+    Eigen::Matrix4d transform;     //!< Transform of the sample.
+    int             nInliers;      //!< Inliers of \ref transform.
+    int             iteration;     //!< Iteration the sample was drawn in, earlier wins ties.
+    int             nValidSamples; //!< Samples of the chunk passing the edge length check.
+
+public:
+    // See https://eigen.tuxfamily.org/dox-devel/group__TopicStructHavingEigenMembers.html
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+}; //...struct RansacBest
+
+/** \brief Number of pairs (columns) of \p source and \p target closer than sqrt(\p maxDistSqr) after \p transform.
+ *
+ * \param[out] inliers Optional, receives the columns of the inlier pairs.
+ */
+int countInliers(Eigen::Matrix3Xd const& source, Eigen::Matrix3Xd const& target,
+                 Eigen::Matrix4d const& transform, double maxDistSqr, std::vector<int>* inliers = nullptr) {
+    Eigen::Matrix3d const rotation    = transform.topLeftCorner<3, 3>();
+    Eigen::Vector3d const translation = transform.topRightCorner<3, 1>();
+    if (inliers)
+        inliers->clear();
+    int nInliers = 0;
+    for (int pair = 0; pair != source.cols(); ++pair) {
+        bool const inlier = (rotation * source.col(pair) + translation - target.col(pair)).squaredNorm() < maxDistSqr;
+        nInliers += inlier;
+        if (inlier && inliers)
+            inliers->push_back(pair);
+    }
+    return nInliers;
+} //...countInliers()
+
+} //...ns anonymous
+
+IcpResult
+registerPointToPlane(
+    CloudConstRefT   const& source,
+    KdTree           const& targetTree,
+    NormalsConstRefT const& targetNormals,
+    Eigen::Matrix4d  const& initial,
+    IcpParams        const& params
+) {
+    if (targetNormals.rows() != targetTree.size()) {
+        std::cerr << "[registerPointToPlane] Normal count " << targetNormals.rows()
+                  << " does not match target point count " << targetTree.size() << "\n";
+        throw new std::runtime_error("Normal count mismatch");
+    }
+    typedef std::chrono::steady_clock ClockT;
+
+    IcpResult result;
+    result.transform = initial;
+
+    // Finite source points, subsampled from these
+    std::vector<int> sourceRows;
+    sourceRows.reserve(source.rows());
+    for (int row = 0; row != source.rows(); ++row)
+        if (source.row(row).allFinite())
+            sourceRows.push_back(row);
+
+    double const maxDistSqr = params.maxCorrespondenceDist > 0.
+                              ? params.maxCorrespondenceDist * params.maxCorrespondenceDist
+                              : std::numeric_limits<double>::infinity();
+    KdTree::PointStorageType const& targetPoints = targetTree.getPoints();
+
+    CloudT            moved;
+    KnnIndicesT       indices;
+    KdTree::KnnDistsT distsSqr;
+    for (int stride = std::max(1, params.coarsestStride); ; stride = std::max(1, stride / 4)) {
+        int const nSamples = (static_cast<int>(sourceRows.size()) + stride - 1) / stride;
+        int const nChunks  = getChunkCount(nSamples, params.nThreads, 1 << 12);
+        moved.resize(nSamples, 3);
+
+        bool levelConverged = false;
+        for (int iteration = 0; iteration < params.maxIterations && !levelConverged; ++iteration) {
+            ClockT::time_point const start = ClockT::now();
+
+            // Pair transformed samples with their closest target points
+            Eigen::Matrix3d const rotation    = result.transform.topLeftCorner<3, 3>();
+            Eigen::Vector3d const translation = result.transform.topRightCorner<3, 1>();
+            parallelChunks(nSamples, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+                for (std::size_t sample = begin; sample != end; ++sample)
+                    moved.row(sample) =
+                        (rotation * source.row(sourceRows[sample * stride]).transpose() + translation).transpose();
+            });
+            targetTree.batchKnnSearch(moved, 1, indices, distsSqr, KnnSearchParams(), params.nThreads);
+
+            // Normal equations per chunk, summed in chunk order
+            std::vector<IcpSums, Eigen::aligned_allocator<IcpSums> > chunkSums(nChunks);
+            parallelChunks(nSamples, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+                IcpSums& sums = chunkSums[chunk];
+                for (std::size_t sample = begin; sample != end; ++sample) {
+                    int const targetId = indices(sample, 0);
+                    if (targetId < 0 || distsSqr(sample, 0) > maxDistSqr)
+                        continue;
+                    Eigen::Vector3d const normal = targetNormals.row(targetId).transpose();
+                    if (!normal.allFinite())
+                        continue;
+
+                    Eigen::Vector3d const point  = moved.row(sample).transpose();
+                    Eigen::Vector3d const target = targetPoints.getPoint(targetId).cast<double>();
+                    double          const residual = (point - target).dot(normal);
+                    IcpUpdateT jacobian;
+                    jacobian << point.cross(normal), normal;
+                    sums.lhs.noalias() += jacobian * jacobian.transpose();
+                    sums.rhs           -= jacobian * residual;
+                    sums.sumSqr        += residual * residual;
+                    ++sums.count;
+                }
+            });
+            IcpSums total;
+            for (IcpSums const& sums : chunkSums) {
+                total.lhs    += sums.lhs;
+                total.rhs    += sums.rhs;
+                total.sumSqr += sums.sumSqr;
+                total.count  += sums.count;
+            }
+            if (total.count < 6) {
+                std::cerr << "[registerPointToPlane] Only " << total.count
+                          << " correspondences, stopping\n";
+                return result;
+            }
+
+            IcpUpdateT const update = total.lhs.ldlt().solve(total.rhs);
+            result.transform = getIncrement(update) * result.transform;
+            levelConverged   = update.norm() < params.minUpdate;
+
+            result.iterations.push_back(IcpIteration{
+                stride, total.count, std::sqrt(total.sumSqr / total.count),
+                std::chrono::duration<double>(ClockT::now() - start).count()});
+        } //...for iterations
+
+        if (stride == 1) {
+            result.converged = levelConverged;
+            break;
+        }
+    } //...for levels
+
+    return result;
+} //...registerPointToPlane()
+
+RansacResult
+registerRansac(
+    DecoratedCloud const& source,
+    DecoratedCloud const& target,
+    RansacParams   const& params
+) {
+    typedef std::chrono::steady_clock ClockT;
+    ClockT::time_point const start = ClockT::now();
+    RansacResult result;
+
+    // Pair points by descriptors, optionally only if they agree both ways
+    std::shared_ptr<FeaturesT const> const sourceFeatures = source.getFpfhFeatures(params.k, params.maxLeafs, params.nThreads);
+    std::shared_ptr<FeaturesT const> const targetFeatures = target.getFpfhFeatures(params.k, params.maxLeafs, params.nThreads);
+    std::vector<int> const matches = matchFeatures(*sourceFeatures, *targetFeatures, params.nThreads);
+    std::vector<int> backMatches;
+    if (params.mutualMatches)
+        backMatches = matchFeatures(*targetFeatures, *sourceFeatures, params.nThreads);
+
+    CloudConstMapT const sourcePoints = source.getVertices();
+    CloudConstMapT const targetPoints = target.getVertices();
+    std::vector<int> pairs;
+    for (int row = 0; row != static_cast<int>(matches.size()); ++row)
+        if (matches[row] >= 0 && (!params.mutualMatches || backMatches[matches[row]] == row))
+            pairs.push_back(row);
+    int const nPairs = pairs.size();
+    Eigen::Matrix3Xd sourcePairs(3, nPairs), targetPairs(3, nPairs);
+    for (int pair = 0; pair != nPairs; ++pair) {
+        sourcePairs.col(pair) = sourcePoints.row(pairs[pair]).transpose();
+        targetPairs.col(pair) = targetPoints.row(matches[pairs[pair]]).transpose();
+    }
+    result.nCorrespondences = nPairs;
+    if (nPairs < 3) {
+        std::cerr << "[registerRansac] Only " << nPairs << " correspondences, returning identity\n";
+        result.seconds = std::chrono::duration<double>(ClockT::now() - start).count();
+        return result;
+    }
+
+    // Sample in parallel, keep the best per chunk
+    double const maxDistSqr = params.inlierDist * params.inlierDist;
+    int    const nChunks    = getChunkCount(params.maxIterations, params.nThreads, 1 << 10);
+    std::vector<RansacBest, Eigen::aligned_allocator<RansacBest> > chunkBest(nChunks);
+    parallelChunks(params.maxIterations, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        RansacBest& best = chunkBest[chunk];
+        Eigen::Matrix3d sourceSample, targetSample;
+        for (std::size_t iteration = begin; iteration != end; ++iteration) {
+            int sample[3];
+            for (int i = 0; i != 3; ++i) {
+                sample[i] = getRandom(params.seed, iteration * 3 + i) % nPairs;
+                sourceSample.col(i) = sourcePairs.col(sample[i]);
+                targetSample.col(i) = targetPairs.col(sample[i]);
+            }
+
+            // Rigid transforms keep lengths, skip samples with differing edges
+            bool similar = sample[0] != sample[1] && sample[1] != sample[2] && sample[0] != sample[2];
+            for (int i = 0; i != 3 && similar; ++i) {
+                double const sourceEdge = (sourceSample.col(i) - sourceSample.col((i + 1) % 3)).norm();
+                double const targetEdge = (targetSample.col(i) - targetSample.col((i + 1) % 3)).norm();
+                similar = std::min(sourceEdge, targetEdge) > params.edgeSimilarity * std::max(sourceEdge, targetEdge);
+            }
+            if (!similar)
+                continue;
+            ++best.nValidSamples;
+
+            Eigen::Matrix4d const transform = Eigen::umeyama(sourceSample, targetSample, false);
+            int const nInliers = countInliers(sourcePairs, targetPairs, transform, maxDistSqr);
+            if (nInliers > best.nInliers) {
+                best.transform = transform;
+                best.nInliers  = nInliers;
+                best.iteration = iteration;
+            }
+        } //...for iterations
+    });
+
+    // Chunks are consecutive iterations, on ties the earlier chunk wins
+    RansacBest best;
+    for (RansacBest const& candidate : chunkBest) {
+        result.nValidSamples += candidate.nValidSamples;
+        if (candidate.nInliers > best.nInliers)
+            best = candidate;
+    }
+
+    // Refit to all inliers of the best sample
+    if (best.nInliers >= 3) {
+        // Sized by the inliers found now, not the count of the sampling pass
+        std::vector<int> inliers;
+        countInliers(sourcePairs, targetPairs, best.transform, maxDistSqr, &inliers);
+        int const nInliers = inliers.size();
+        Eigen::Matrix3Xd sourceInliers(3, nInliers), targetInliers(3, nInliers);
+        for (int inlier = 0; inlier != nInliers; ++inlier) {
+            sourceInliers.col(inlier) = sourcePairs.col(inliers[inlier]);
+            targetInliers.col(inlier) = targetPairs.col(inliers[inlier]);
+        }
+        Eigen::Matrix4d const refit = Eigen::umeyama(sourceInliers, targetInliers, false);
+        if (countInliers(sourcePairs, targetPairs, refit, maxDistSqr) >= best.nInliers)
+            best.transform = refit;
+    }
+    result.transform = best.transform;
+
+    // Statistics of the final transform
+    Eigen::Matrix3d const rotation    = result.transform.topLeftCorner<3, 3>();
+    Eigen::Vector3d const translation = result.transform.topRightCorner<3, 1>();
+    double sumSqr = 0.;
+    for (int pair = 0; pair != nPairs; ++pair) {
+        double const distSqr = (rotation * sourcePairs.col(pair) + translation - targetPairs.col(pair)).squaredNorm();
+        if (distSqr < maxDistSqr) {
+            sumSqr += distSqr;
+            ++result.nInliers;
+        }
+    }
+    result.inlierRms = result.nInliers ? std::sqrt(sumSqr / result.nInliers) : 0.;
+    result.seconds   = std::chrono::duration<double>(ClockT::now() - start).count();
+    return result;
+} //...registerRansac()
+
+} //...ns acq
@@ -0,0 +1,239 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#include "acq/segmentation.h"
+
+#include "acq/normalEstimation.h"
+#include "acq/parallel.h"
+
+#include "Eigen/Eigenvalues"
+
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace acq {
+
+namespace {
+
+//! Parent of each element, roots point to themselves.
+typedef std::vector<std::atomic<int> > ParentsT;
+
+/** \brief Root of \p id, halving the path on the way. */
+inline int findRoot(ParentsT& parents, int id) {
+    for (int parent = parents[id].load(); parent != id; parent = parents[id].load()) {
+        int grandParent = parents[parent].load();
+        // Losing the race only skips a shortcut
+        parents[id].compare_exchange_weak(parent, grandParent);
+        id = grandParent;
+    }
+    return id;
+} //...findRoot()
+
+/** \brief Unites the sets of \p a and \p b, the root with the larger id is linked under the smaller one. */
+inline void unite(ParentsT& parents, int a, int b) {
+    for (;;) {
+        a = findRoot(parents, a);
+        b = findRoot(parents, b);
+        if (a == b)
+            return;
+        if (a < b)
+            std::swap(a, b);
+        // Fails, if another thread linked a meanwhile, retry from the new roots
+        int expected = a;
+        if (parents[a].compare_exchange_strong(expected, b))
+            return;
+    }
+} //...unite()
+
+} //...ns anonymous
+
+Eigen::VectorXd
+calculateSurfaceVariation(
+    CloudConstRefT const& cloud,
+    KnnIndicesT    const& neighbours,
+    unsigned       const  nThreads
+) {
+    std::size_t const n = cloud.rows();
+    Eigen::VectorXd curvatures(n);
+    parallelChunks(n, getChunkCount(n, nThreads, 1 << 12), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId) {
+            // Moments relative to the point itself, for precision
+            Eigen::Vector3d const origin = cloud.row(pointId).transpose();
+            Eigen::Vector3d sum(Eigen::Vector3d::Zero());
+            Eigen::Matrix3d sumSqr(Eigen::Matrix3d::Zero());
+            int count = 1;
+            for (int const neighbourId : neighbours.row(pointId)) {
+                if (neighbourId < 0)
+                    continue;
+                Eigen::Vector3d const offset = cloud.row(neighbourId).transpose() - origin;
+                sum += offset;
+                sumSqr.noalias() += offset * offset.transpose();
+                ++count;
+            }
+            if (count < 3) {
+                curvatures(pointId) = 0.;
+                continue;
+            }
+
+            Eigen::Matrix3d const covariance = sumSqr / count - (sum / count) * (sum / count).transpose();
+            // Closed form, the eigenvalue ratio does not need iterative precision
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver;
+            solver.computeDirect(covariance, Eigen::EigenvaluesOnly);
+            Eigen::Vector3d const eigenValues = solver.eigenvalues();
+            double const trace = eigenValues.sum();
+            curvatures(pointId) = trace > 0. ? std::max(0., eigenValues(0)) / trace : 0.;
+        }
+    });
+    return curvatures;
+} //...calculateSurfaceVariation()
+
+SegmentsT
+segmentRegions(
+    CloudConstRefT     const& cloud,
+    NormalsConstRefT   const& normals,
+    KnnIndicesT        const& neighbours,
+    LabelsT                 & labels,
+    SegmentationParams const& params
+) {
+    if (normals.rows() != cloud.rows() || neighbours.rows() != cloud.rows()) {
+        std::cerr << "[segmentRegions] Point count " << cloud.rows() << " does not match normal count "
+                  << normals.rows() << " or neighbour count " << neighbours.rows() << "\n";
+        throw new std::runtime_error("Point count mismatch");
+    }
+
+    int         const n       = cloud.rows();
+    int         const nChunks = getChunkCount(n, params.nThreads, 1 << 12);
+    Eigen::VectorXd const curvatures = calculateSurfaceVariation(cloud, neighbours, params.nThreads);
+    std::vector<char> flat(n);
+    for (int pointId = 0; pointId != n; ++pointId)
+        flat[pointId] = curvatures(pointId) < params.maxCurvature && normals.row(pointId).allFinite();
+
+    auto isSmooth = [&normals, &params](int a, int b) {
+        return std::abs(normals.row(a).dot(normals.row(b))) >=
+               params.minNormalDot * normals.row(a).norm() * normals.row(b).norm();
+    };
+
+    // Unite flat neighbours with similar normals, each edge is looked at from both ends at most
+    ParentsT parents(n);
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId)
+            parents[pointId].store(pointId, std::memory_order_relaxed);
+    });
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId) {
+            if (!flat[pointId])
+                continue;
+            for (int const neighbourId : neighbours.row(pointId))
+                if (neighbourId >= 0 && flat[neighbourId] && isSmooth(pointId, neighbourId))
+                    unite(parents, pointId, neighbourId);
+        }
+    });
+
+    // Roots of the flat sets, curved points join their closest smooth flat neighbour
+    std::vector<int> roots(n);
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t pointId = begin; pointId != end; ++pointId) {
+            if (flat[pointId]) {
+                roots[pointId] = findRoot(parents, pointId);
+                continue;
+            }
+            roots[pointId] = pointId;
+            if (!normals.row(pointId).allFinite())
+                continue;
+            for (int const neighbourId : neighbours.row(pointId))
+                if (neighbourId >= 0 && flat[neighbourId] && isSmooth(pointId, neighbourId)) {
+                    roots[pointId] = findRoot(parents, neighbourId);
+                    break;
+                }
+        }
+    });
+
+    // Segments in order of their roots, sizes first to drop small ones
+    std::vector<int> sizes(n, 0);
+    for (int pointId = 0; pointId != n; ++pointId)
+        ++sizes[roots[pointId]];
+    std::vector<int> segmentOfRoot(n, -1);
+    int nSegments = 0;
+    for (int root = 0; root != n; ++root)
+        if (sizes[root] && sizes[root] >= params.minSegmentSize)
+            segmentOfRoot[root] = nSegments++;
+
+    // Counting sort of the points by segment, in increasing id within each
+    labels.resize(n);
+    std::vector<int> starts(nSegments + 1, 0);
+    for (int pointId = 0; pointId != n; ++pointId) {
+        labels(pointId) = segmentOfRoot[roots[pointId]];
+        if (labels(pointId) >= 0)
+            ++starts[labels(pointId) + 1];
+    }
+    for (int segment = 0; segment != nSegments; ++segment)
+        starts[segment + 1] += starts[segment];
+    std::vector<int> members(starts.back());
+    {
+        std::vector<int> offsets(starts.begin(), starts.end() - 1);
+        for (int pointId = 0; pointId != n; ++pointId)
+            if (labels(pointId) >= 0)
+                members[offsets[labels(pointId)]++] = pointId;
+    }
+
+    // Statistics per segment in parallel
+    SegmentsT segments(nSegments);
+    parallelChunks(nSegments, getChunkCount(nSegments, params.nThreads, 1 << 10),
+        [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+            for (std::size_t segmentId = begin; segmentId != end; ++segmentId) {
+                Segment& segment = segments[segmentId];
+                segment.size          = starts[segmentId + 1] - starts[segmentId];
+                segment.centroid      .setZero();
+                segment.normal        .setZero();
+                segment.meanCurvature = 0.;
+                Eigen::RowVector3d const first = normals.row(members[starts[segmentId]]);
+                for (int i = starts[segmentId]; i != starts[segmentId + 1]; ++i) {
+                    int const pointId = members[i];
+                    segment.centroid += cloud.row(pointId).transpose();
+                    if (normals.row(pointId).allFinite())
+                        segment.normal += (normals.row(pointId).dot(first) < 0. ? -1. : 1.) *
+                                          normals.row(pointId).transpose();
+                    segment.meanCurvature += curvatures(pointId);
+                }
+                segment.centroid      /= segment.size;
+                segment.normal         = segment.normal.normalized();
+                segment.meanCurvature /= segment.size;
+            }
+        }
+    );
+    return segments;
+} //...segmentRegions()
+
+SegmentsT
+segmentRegions(
+    DecoratedCloud          & cloud,
+    SegmentationParams const& params
+) {
+    std::shared_ptr<KdTree const> const tree = cloud.getKdTree();
+    KnnIndicesT       neighbours;
+    KdTree::KnnDistsT distsSqr;
+    calculateCloudNeighbours(*tree, params.k, neighbours, distsSqr,
+                             std::sqrt(std::numeric_limits<float>::max()) - 1.f, params.nThreads);
+
+    DecoratedCloud const& view = cloud;
+    NormalsT const estimated = cloud.hasNormals()
+                               ? NormalsT()
+                               : NormalsT(calculateCloudNormals(tree->getPoints(), neighbours, params.nThreads));
+
+    LabelsT labels;
+    SegmentsT const segments = segmentRegions(
+        /* [in ]     Points: */ view.getVertices(),
+        /* [in ]    Normals: */ cloud.hasNormals() ? NormalsConstRefT(view.getNormals()) : NormalsConstRefT(estimated),
+        /* [in ] Neighbours: */ neighbours,
+        /* [out]     Labels: */ labels,
+        /* [in ]    Options: */ params
+    );
+    cloud.setLabels(std::move(labels));
+    return segments;
+} //...segmentRegions()
+
+} //...ns acq
@@ -0,0 +1,361 @@
+//
+// Created by bontius on 19/02/17.
+//
+
+#include "acq/shapeDetection.h"
+
+#include "acq/normalEstimation.h"
+#include "acq/parallel.h"
+#include "acq/spatialOrder.h"
+
+#include "Eigen/Eigenvalues"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+namespace acq {
+
+namespace {
+
+//! Bits per dimension of the codes of \ref calculateMortonCodes, one octree level each.
+enum { OctreeDepth = 21 };
+//! Deepest octree level minimal sets are drawn from.
+enum { MaxSampleLevel = 10 };
+//! Fewest points of a cell to draw a minimal set from, coarser cells are taken otherwise.
+enum { MinCellPoints = 8 };
+
+/** \brief Plane through \p p, false if they are collinear. */
+bool fitPlane(Eigen::Vector3d const p[3], Primitive& plane) {
+    Eigen::Vector3d const normal = (p[1] - p[0]).cross(p[2] - p[0]);
+    double const length = normal.norm();
+    if (!(length > std::numeric_limits<double>::epsilon()))
+        return false;
+
+    plane.type      = PLANE_PRIMITIVE;
+    plane.point     = p[0];
+    plane.direction = normal / length;
+    plane.radius    = 0.;
+    return true;
+} //...fitPlane()
+
+/** \brief Cylinder through \p p with unit surface normals \p n, its axis crossing the normal lines,
+ *         false if the normals are parallel or the radius is out of range.
+ */
+bool fitCylinder(Eigen::Vector3d const p[2], Eigen::Vector3d const n[2], double minRadius, double maxRadius,
+                 Primitive& cylinder) {
+    Eigen::Vector3d const axis = n[0].cross(n[1]);
+    double const length = axis.norm();
+    if (!(length > 1e-6))
+        return false;
+
+    // Closest points of the lines p[i] + s_i * n[i], midway between them is on the axis
+    double const cosine = n[0].dot(n[1]);
+    Eigen::Vector3d const delta = p[0] - p[1];
+    double const d = n[0].dot(delta), e = n[1].dot(delta);
+    double const denominator = 1. - cosine * cosine;
+    double const s = (cosine * e - d) / denominator;
+    double const t = (e - cosine * d) / denominator;
+
+    cylinder.type      = CYLINDER_PRIMITIVE;
+    cylinder.point     = .5 * (p[0] + s * n[0] + p[1] + t * n[1]);
+    cylinder.direction = axis / length;
+    cylinder.radius    = 0.;
+    for (int i = 0; i != 2; ++i) {
+        Eigen::Vector3d const offset = p[i] - cylinder.point;
+        cylinder.radius += .5 * (offset - offset.dot(cylinder.direction) * cylinder.direction).norm();
+    }
+    return cylinder.radius > minRadius && cylinder.radius < maxRadius;
+} //...fitCylinder()
+
+/** \brief Least squares fit of a shape of the type of \p shape to the points \p ids.
+ *
+ * Planes: through the centroid, normal to the direction of least variance.
+ * Cylinders: axis orthogonal to the normals (least variance of the normals),
+ * then a circle (Kasa) through the points projected along it.
+ */
+Primitive refitPrimitive(Primitive const& shape, Eigen::Matrix3Xd const& points, Eigen::Matrix3Xd const& normals,
+                         std::vector<int> const& ids) {
+    Eigen::Vector3d centroid(Eigen::Vector3d::Zero());
+    for (int const id : ids)
+        centroid += points.col(id);
+    centroid /= ids.size();
+
+    Primitive refit = shape;
+    Eigen::Matrix3d scatter(Eigen::Matrix3d::Zero());
+    if (shape.type == PLANE_PRIMITIVE) {
+        for (int const id : ids) {
+            Eigen::Vector3d const offset = points.col(id) - centroid;
+            scatter.noalias() += offset * offset.transpose();
+        }
+        refit.point     = centroid;
+        refit.direction = Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(scatter).eigenvectors().col(0);
+        return refit;
+    }
+
+    for (int const id : ids)
+        scatter.noalias() += normals.col(id) * normals.col(id).transpose();
+    refit.direction = Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d>(scatter).eigenvectors().col(0);
+
+    // Circle x^2 + y^2 = 2 a x + 2 b y + c in a plane orthogonal to the axis, around the centroid
+    Eigen::Vector3d const u = refit.direction.unitOrthogonal();
+    Eigen::Vector3d const v = refit.direction.cross(u);
+    Eigen::Matrix3d lhs(Eigen::Matrix3d::Zero());
+    Eigen::Vector3d rhs(Eigen::Vector3d::Zero());
+    for (int const id : ids) {
+        Eigen::Vector3d const offset = points.col(id) - centroid;
+        Eigen::Vector3d const row(2. * offset.dot(u), 2. * offset.dot(v), 1.);
+        double const lengthSqr = .25 * (row(0) * row(0) + row(1) * row(1));
+        lhs.noalias() += row * row.transpose();
+        rhs           += row * lengthSqr;
+    }
+    Eigen::Vector3d const circle = lhs.ldlt().solve(rhs);
+    refit.point  = centroid + circle(0) * u + circle(1) * v;
+    refit.radius = std::sqrt(std::max(0., circle(2) + circle(0) * circle(0) + circle(1) * circle(1)));
+    return refit;
+} //...refitPrimitive()
+
+/** \brief Check, if \p point with unit normal \p normal lies on \p shape. */
+inline bool isCompatible(Primitive const& shape, Eigen::Vector3d const& point, Eigen::Vector3d const& normal,
+                         ShapeDetectionParams const& params) {
+    return shape.getDistance(point) < params.epsilon &&
+           std::abs(shape.getNormal(point).dot(normal)) >= params.minNormalDot;
+} //...isCompatible()
+
+} //...ns anonymous
+
+double Primitive::getDistance(Eigen::Vector3d const& query) const {
+    Eigen::Vector3d const offset = query - point;
+    if (type == PLANE_PRIMITIVE)
+        return std::abs(offset.dot(direction));
+    return std::abs((offset - offset.dot(direction) * direction).norm() - radius);
+} //...Primitive::getDistance()
+
+Eigen::Vector3d Primitive::getNormal(Eigen::Vector3d const& query) const {
+    if (type == PLANE_PRIMITIVE)
+        return direction;
+    Eigen::Vector3d const offset = query - point;
+    return (offset - offset.dot(direction) * direction).normalized();
+} //...Primitive::getNormal()
+
+PrimitivesT
+detectPrimitives(
+    CloudConstRefT       const& cloud,
+    NormalsConstRefT     const& normals,
+    LabelsT                   & labels,
+    ShapeDetectionParams const& params
+) {
+    if (normals.rows() != cloud.rows()) {
+        std::cerr << "[detectPrimitives] Normal count " << normals.rows()
+                  << " does not match point count " << cloud.rows() << "\n";
+        throw new std::runtime_error("Normal count mismatch");
+    }
+    labels.setConstant(cloud.rows(), -1);
+    PrimitivesT shapes;
+
+    // Points with finite coordinates and normals, column-wise for the scoring loops
+    std::vector<int> rows;
+    for (int row = 0; row != cloud.rows(); ++row)
+        if (cloud.row(row).allFinite() && normals.row(row).allFinite() && !normals.row(row).isZero())
+            rows.push_back(row);
+    int const nPoints = rows.size();
+    CloudT finitePoints(nPoints, 3);
+    Eigen::Matrix3Xd points(3, nPoints), unitNormals(3, nPoints);
+    for (int id = 0; id != nPoints; ++id) {
+        finitePoints.row(id)  = cloud.row(rows[id]);
+        points.col(id)        = cloud.row(rows[id]).transpose();
+        unitNormals.col(id)   = normals.row(rows[id]).transpose().normalized();
+    }
+    if (nPoints < std::max(3, params.minSupport))
+        return shapes;
+
+    // Implicit octree: along the Z-order curve, cells are ranges of codes with a common prefix
+    std::vector<std::uint64_t> codes = calculateMortonCodes(finitePoints, params.nThreads);
+    PermutationT const order = sortKeys(codes, 3 * OctreeDepth, params.nThreads);
+    std::vector<int> positions(nPoints);
+    for (int position = 0; position != nPoints; ++position)
+        positions[order(position)] = position;
+    auto getCell = [&codes, &positions](int id, int level, int& begin, int& end) {
+        int           const shift  = 3 * (OctreeDepth - level);
+        std::uint64_t const prefix = codes[positions[id]] >> shift;
+        begin = std::lower_bound(codes.begin(), codes.end(), prefix << shift) - codes.begin();
+        end   = std::lower_bound(codes.begin() + begin, codes.end(), (prefix + 1) << shift) - codes.begin();
+    };
+
+    double const maxRadius = params.maxRadius > 0.
+                             ? params.maxRadius
+                             : (finitePoints.colwise().maxCoeff() - finitePoints.colwise().minCoeff()).norm();
+
+    // Unassigned points in random order, any prefix is a random subset
+    std::vector<int> remaining(nPoints);
+    std::iota(remaining.begin(), remaining.end(), 0);
+    std::shuffle(remaining.begin(), remaining.end(), std::mt19937(params.seed));
+    std::vector<char> assigned(nPoints, 0);
+
+    int const nTypes      = 2;
+    int const nCandidates = params.samplesPerRound * nTypes;
+    PrimitivesT      candidates(nCandidates);
+    std::vector<int> scores    (nCandidates);
+    std::vector<char> inliers, refitInliers;
+
+    // Marks the inliers of shape among the remaining points in parallel, returns their number
+    auto evaluate = [&](Primitive const& shape, std::vector<char>& isInlier) {
+        std::size_t const nRemaining = remaining.size();
+        int         const nChunks    = getChunkCount(nRemaining, params.nThreads, 1 << 12);
+        std::vector<int> counts(nChunks, 0);
+        isInlier.resize(nRemaining);
+        parallelChunks(nRemaining, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i != end; ++i) {
+                int const id = remaining[i];
+                isInlier[i] = isCompatible(shape, points.col(id), unitNormals.col(id), params);
+                counts[chunk] += isInlier[i];
+            }
+        });
+        return std::accumulate(counts.begin(), counts.end(), 0);
+    };
+
+    for (int round = 0, failedRounds = 0;
+         static_cast<int>(remaining.size()) >= params.minSupport && failedRounds < params.maxFailedRounds;
+         ++round) {
+        int const nSubset = std::min<int>(params.scoreSubset, remaining.size());
+
+        // Draw minimal sets from octree cells, and score their candidates on the subset
+        parallelChunks(params.samplesPerRound, getChunkCount(params.samplesPerRound, params.nThreads, 1),
+            [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+                for (std::size_t sample = begin; sample != end; ++sample) {
+                    std::seed_seq seeds{ params.seed, static_cast<unsigned>(round), static_cast<unsigned>(sample) };
+                    std::mt19937  random(seeds);
+                    for (int type = 0; type != nTypes; ++type)
+                        scores[sample * nTypes + type] = -1;
+
+                    // First point anywhere, the others from a cell around it
+                    int ids[3] = { remaining[random() % remaining.size()], -1, -1 };
+                    int cellBegin, cellEnd;
+                    int level = 1 + random() % MaxSampleLevel;
+                    for (getCell(ids[0], level, cellBegin, cellEnd);
+                         level > 0 && cellEnd - cellBegin < MinCellPoints;
+                         getCell(ids[0], --level, cellBegin, cellEnd)) {}
+                    for (int i = 1, tries = 0; i != 3 && tries != 32; ++tries) {
+                        int const id = order(cellBegin + random() % (cellEnd - cellBegin));
+                        if (!assigned[id] && id != ids[0] && id != ids[1])
+                            ids[i++] = id;
+                    }
+                    if (ids[2] < 0)
+                        continue;
+
+                    Eigen::Vector3d p[3], n[3];
+                    for (int i = 0; i != 3; ++i) {
+                        p[i] = points     .col(ids[i]);
+                        n[i] = unitNormals.col(ids[i]);
+                    }
+
+                    // Cheap checks on the minimal set first
+                    Primitive* const plane    = &candidates[sample * nTypes + PLANE_PRIMITIVE];
+                    Primitive* const cylinder = &candidates[sample * nTypes + CYLINDER_PRIMITIVE];
+                    bool valid[nTypes] = {
+                        params.detectPlanes && fitPlane(p, *plane),
+                        params.detectCylinders && fitCylinder(p, n, params.epsilon, maxRadius, *cylinder)
+                    };
+                    for (int i = 0; i != 3; ++i) {
+                        valid[PLANE_PRIMITIVE] = valid[PLANE_PRIMITIVE] &&
+                                                 std::abs(plane->direction.dot(n[i])) >= params.minNormalDot;
+                        valid[CYLINDER_PRIMITIVE] = valid[CYLINDER_PRIMITIVE] &&
+                                                    isCompatible(*cylinder, p[i], n[i], params);
+                    }
+
+                    for (int type = 0; type != nTypes; ++type) {
+                        if (!valid[type])
+                            continue;
+                        Primitive const& candidate = candidates[sample * nTypes + type];
+                        int score = 0;
+                        for (int i = 0; i != nSubset; ++i)
+                            score += isCompatible(candidate, points.col(remaining[i]), unitNormals.col(remaining[i]),
+                                                  params);
+                        scores[sample * nTypes + type] = score;
+                    }
+                } //...for samples
+            }
+        );
+
+        // Best candidate, if it promises enough inliers among all remaining points
+        int const best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+        if (scores[best] < 0 ||
+            static_cast<double>(scores[best]) * remaining.size() / nSubset < params.minSupport) {
+            ++failedRounds;
+            continue;
+        }
+        Primitive shape = candidates[best];
+        shape.nInliers = evaluate(shape, inliers);
+        if (shape.nInliers < params.minSupport) {
+            ++failedRounds;
+            continue;
+        }
+
+        // Least squares fits to the inliers, while they explain more points
+        for (int iteration = 0; iteration != 3; ++iteration) {
+            std::vector<int> ids;
+            ids.reserve(shape.nInliers);
+            for (std::size_t i = 0; i != remaining.size(); ++i)
+                if (inliers[i])
+                    ids.push_back(remaining[i]);
+            Primitive refit = refitPrimitive(shape, points, unitNormals, ids);
+            if (shape.type == CYLINDER_PRIMITIVE && !(refit.radius > params.epsilon && refit.radius < maxRadius))
+                break;
+            refit.nInliers = evaluate(refit, refitInliers);
+            if (refit.nInliers <= shape.nInliers)
+                break;
+            shape = refit;
+            inliers.swap(refitInliers);
+        } //...for refits
+
+        // Accept, label and stop sampling the inliers
+        int const label = shapes.size();
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i != remaining.size(); ++i) {
+            int const id = remaining[i];
+            if (inliers[i]) {
+                labels(rows[id]) = label;
+                assigned[id]     = 1;
+            } else
+                remaining[kept++] = id;
+        }
+        remaining.resize(kept);
+        shapes.push_back(shape);
+        failedRounds = 0;
+    } //...for rounds
+
+    return shapes;
+} //...detectPrimitives()
+
+PrimitivesT
+detectPrimitives(
+    DecoratedCloud            & cloud,
+    ShapeDetectionParams const& params
+) {
+    DecoratedCloud const& view = cloud;
+    NormalsT estimated;
+    if (!cloud.hasNormals()) {
+        std::shared_ptr<KdTree const> const tree = cloud.getKdTree();
+        KnnIndicesT       neighbours;
+        KdTree::KnnDistsT distsSqr;
+        calculateCloudNeighbours(*tree, params.normalK, neighbours, distsSqr,
+                                 std::sqrt(std::numeric_limits<float>::max()) - 1.f, params.nThreads);
+        estimated = calculateCloudNormals(tree->getPoints(), neighbours, params.nThreads);
+    }
+
+    LabelsT labels;
+    PrimitivesT const shapes = detectPrimitives(
+        /* [in ]  Points: */ view.getVertices(),
+        /* [in ] Normals: */ cloud.hasNormals() ? NormalsConstRefT(view.getNormals()) : NormalsConstRefT(estimated),
+        /* [out]  Labels: */ labels,
+        /* [in ] Options: */ params
+    );
+    cloud.setLabels(std::move(labels));
+    return shapes;
+} //...detectPrimitives()
+
+} //...ns acq
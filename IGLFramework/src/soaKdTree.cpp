@@ -0,0 +1,625 @@
+//
+// Created by bontius on 13/02/17.
+//
+
+#include "acq/soaKdTree.h"
+#include "acq/parallel.h"
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <random>
+#include <thread>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define ACQ_SIMD_DISPATCH 1
+#   include <immintrin.h>
+#else
+#   define ACQ_SIMD_DISPATCH 0
+#endif
+
+namespace acq {
+
+namespace {
+
+//! Widest SIMD lane count used (16 floats), kernels may read and write this far past a leaf.
+enum { SimdPadding = 16 };
+//! Largest leaf size with the leaf distance buffer on the stack.
+enum { MaxStackLeafs = 64 };
+//! Smallest subtree built in a task of its own.
+enum { ParallelMinPoints = 1 << 15 };
+
+//
+// Leaf distance kernels
+//
+
+template <typename _Scalar>
+void leafDistsSqrScalar(
+    _Scalar const* x, _Scalar const* y, _Scalar const* z,
+    int n, _Scalar const* query, _Scalar* distsSqr
+) {
+    for (int i = 0; i < n; ++i) {
+        _Scalar const dx = x[i] - query[0];
+        _Scalar const dy = y[i] - query[1];
+        _Scalar const dz = z[i] - query[2];
+        distsSqr[i] = dx * dx + dy * dy + dz * dz;
+    }
+} //...leafDistsSqrScalar()
+
+#if ACQ_SIMD_DISPATCH
+__attribute__((target("avx2,fma")))
+void leafDistsSqrAvx2(
+    double const* x, double const* y, double const* z,
+    int n, double const* query, double* distsSqr
+) {
+    __m256d const qx = _mm256_set1_pd(query[0]);
+    __m256d const qy = _mm256_set1_pd(query[1]);
+    __m256d const qz = _mm256_set1_pd(query[2]);
+    for (int i = 0; i < n; i += 4) {
+        __m256d const dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), qx);
+        __m256d const dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), qy);
+        __m256d const dz = _mm256_sub_pd(_mm256_loadu_pd(z + i), qz);
+        __m256d d = _mm256_mul_pd(dx, dx);
+        d = _mm256_fmadd_pd(dy, dy, d);
+        d = _mm256_fmadd_pd(dz, dz, d);
+        _mm256_storeu_pd(distsSqr + i, d);
+    }
+} //...leafDistsSqrAvx2()
+
+__attribute__((target("avx2,fma")))
+void leafDistsSqrAvx2(
+    float const* x, float const* y, float const* z,
+    int n, float const* query, float* distsSqr
+) {
+    __m256 const qx = _mm256_set1_ps(query[0]);
+    __m256 const qy = _mm256_set1_ps(query[1]);
+    __m256 const qz = _mm256_set1_ps(query[2]);
+    for (int i = 0; i < n; i += 8) {
+        __m256 const dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), qx);
+        __m256 const dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), qy);
+        __m256 const dz = _mm256_sub_ps(_mm256_loadu_ps(z + i), qz);
+        __m256 d = _mm256_mul_ps(dx, dx);
+        d = _mm256_fmadd_ps(dy, dy, d);
+        d = _mm256_fmadd_ps(dz, dz, d);
+        _mm256_storeu_ps(distsSqr + i, d);
+    }
+} //...leafDistsSqrAvx2()
+
+__attribute__((target("avx512f")))
+void leafDistsSqrAvx512(
+    double const* x, double const* y, double const* z,
+    int n, double const* query, double* distsSqr
+) {
+    __m512d const qx = _mm512_set1_pd(query[0]);
+    __m512d const qy = _mm512_set1_pd(query[1]);
+    __m512d const qz = _mm512_set1_pd(query[2]);
+    for (int i = 0; i < n; i += 8) {
+        __m512d const dx = _mm512_sub_pd(_mm512_loadu_pd(x + i), qx);
+        __m512d const dy = _mm512_sub_pd(_mm512_loadu_pd(y + i), qy);
+        __m512d const dz = _mm512_sub_pd(_mm512_loadu_pd(z + i), qz);
+        __m512d d = _mm512_mul_pd(dx, dx);
+        d = _mm512_fmadd_pd(dy, dy, d);
+        d = _mm512_fmadd_pd(dz, dz, d);
+        _mm512_storeu_pd(distsSqr + i, d);
+    }
+} //...leafDistsSqrAvx512()
+
+__attribute__((target("avx512f")))
+void leafDistsSqrAvx512(
+    float const* x, float const* y, float const* z,
+    int n, float const* query, float* distsSqr
+) {
+    __m512 const qx = _mm512_set1_ps(query[0]);
+    __m512 const qy = _mm512_set1_ps(query[1]);
+    __m512 const qz = _mm512_set1_ps(query[2]);
+    for (int i = 0; i < n; i += 16) {
+        __m512 const dx = _mm512_sub_ps(_mm512_loadu_ps(x + i), qx);
+        __m512 const dy = _mm512_sub_ps(_mm512_loadu_ps(y + i), qy);
+        __m512 const dz = _mm512_sub_ps(_mm512_loadu_ps(z + i), qz);
+        __m512 d = _mm512_mul_ps(dx, dx);
+        d = _mm512_fmadd_ps(dy, dy, d);
+        d = _mm512_fmadd_ps(dz, dz, d);
+        _mm512_storeu_ps(distsSqr + i, d);
+    }
+} //...leafDistsSqrAvx512()
+#endif // ACQ_SIMD_DISPATCH
+
+/** \brief Kernel for \p level, which has to be supported by the CPU. */
+template <typename _Scalar>
+typename SoaKdTreeT<_Scalar>::LeafKernelT getLeafKernel(SimdLevel level) {
+#if ACQ_SIMD_DISPATCH
+    switch (level) {
+        case SIMD_AVX512: return &leafDistsSqrAvx512;
+        case SIMD_AVX2:   return &leafDistsSqrAvx2;
+        default:          break;
+    }
+#endif
+    return &leafDistsSqrScalar<_Scalar>;
+} //...getLeafKernel()
+
+} //...ns anonymous
+
+SimdLevel detectSimdLevel() {
+#if ACQ_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+#endif
+    return SIMD_SCALAR;
+} //...detectSimdLevel()
+
+char const* getSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_AVX512: return "avx512";
+        case SIMD_AVX2:   return "avx2";
+        default:          return "scalar";
+    }
+} //...getSimdLevelName()
+
+//
+// SoaKdTreeT
+//
+
+template <typename _Scalar>
+SoaKdTreeT<_Scalar>::SoaKdTreeT()
+    : _maxLeafs(10), _simdLevel(detectSimdLevel()), _kernel(getLeafKernel<Scalar>(_simdLevel))
+{
+    std::fill(_bboxLow,  _bboxLow  + Dim, Scalar(0));
+    std::fill(_bboxHigh, _bboxHigh + Dim, Scalar(0));
+}
+
+template <typename _Scalar>
+SoaKdTreeT<_Scalar>::SoaKdTreeT(PointStorageT<Scalar> const& points, int maxLeafs)
+    : SoaKdTreeT()
+{
+    build(points, maxLeafs);
+}
+
+template <typename _Scalar>
+SoaKdTreeT<_Scalar>::SoaKdTreeT(PointStorageT<Scalar> const& points, KdTreeBuildParams const& params)
+    : SoaKdTreeT()
+{
+    build(points, params);
+}
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::setSimdLevel(SimdLevel level) {
+    _simdLevel = std::min(level, detectSimdLevel());
+    _kernel    = getLeafKernel<Scalar>(_simdLevel);
+} //...SoaKdTreeT::setSimdLevel()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::build(PointStorageT<Scalar> const& points, int maxLeafs) {
+    build(points, KdTreeBuildParams(maxLeafs));
+} //...SoaKdTreeT::build()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::build(PointStorageT<Scalar> const& points, KdTreeBuildParams const& params) {
+    _maxLeafs = std::max(1, params.maxLeafs);
+    _nodes.clear();
+    _nodes.reserve(2 * (points.size() / _maxLeafs + 1));
+
+    // Bounding box
+    for (int d = 0; d != Dim; ++d) {
+        _bboxLow [d] = points.size() ?  std::numeric_limits<Scalar>::max() : Scalar(0);
+        _bboxHigh[d] = points.size() ? -std::numeric_limits<Scalar>::max() : Scalar(0);
+    }
+    for (int pointId = 0; pointId != points.size(); ++pointId) {
+        Scalar const* const point = points.point(pointId);
+        for (int d = 0; d != Dim; ++d) {
+            _bboxLow [d] = std::min(_bboxLow [d], point[d]);
+            _bboxHigh[d] = std::max(_bboxHigh[d], point[d]);
+        }
+    } //...for points
+
+    // Fork subtrees on the top levels, until there are about 2 tasks per thread
+    unsigned const nThreads  = params.nThreads ? params.nThreads
+                                               : std::max(1u, std::thread::hardware_concurrency());
+    int            forkDepth = 0;
+    if (nThreads > 1)
+        while ((1u << forkDepth) < 2 * nThreads)
+            ++forkDepth;
+
+    // Split recursively, reordering ids
+    std::vector<int> ids(points.size());
+    for (int i = 0; i != points.size(); ++i)
+        ids[i] = i;
+    if (points.size())
+        buildLevel(_nodes, ids, 0, points.size(), points, _bboxLow, _bboxHigh, params.medianSamples, forkDepth);
+
+    // Gather coordinates in tree order, padding is zero and never reported
+    _soa.setZero(points.size() + SimdPadding, Dim);
+    _ids.resize(points.size());
+    for (int i = 0; i != points.size(); ++i) {
+        _soa.row(i) = points.getPoint(ids[i]).transpose();
+        _ids[i]     = ids[i];
+    }
+} //...SoaKdTreeT::build()
+
+template <typename _Scalar>
+int SoaKdTreeT<_Scalar>::splitRange(
+    std::vector<int>            & ids,
+    int                    const  begin,
+    int                    const  end,
+    PointStorageT<Scalar>  const& points,
+    int                    const  dim,
+    int                    const  medianSamples
+) const {
+    auto const coordinate = [&points, dim](int id) { return points.point(id)[dim]; };
+
+    // Approximate median from a random sample, one partitioning pass instead of nth_element
+    if (medianSamples > 0 && end - begin > 2 * medianSamples) {
+        std::minstd_rand                   rng(static_cast<unsigned>(begin) * 2654435761u + end);
+        std::uniform_int_distribution<int> pick(begin, end - 1);
+        std::vector<Scalar>                sample(medianSamples);
+        for (Scalar& value : sample)
+            value = coordinate(ids[pick(rng)]);
+        std::nth_element(sample.begin(), sample.begin() + medianSamples / 2, sample.end());
+        Scalar const splitValue = sample[medianSamples / 2];
+
+        int const mid = static_cast<int>(
+            std::partition(
+                ids.begin() + begin, ids.begin() + end,
+                [&coordinate, splitValue](int id) { return coordinate(id) < splitValue; }
+            ) - ids.begin());
+        // Unusable, if all points fell to one side (e.g. many equal coordinates)
+        if (mid != begin && mid != end)
+            return mid;
+    } //...if sampled median
+
+    // Exact median
+    int const mid = begin + (end - begin) / 2;
+    std::nth_element(
+        ids.begin() + begin, ids.begin() + mid, ids.begin() + end,
+        [&coordinate](int a, int b) { return coordinate(a) < coordinate(b); }
+    );
+    return mid;
+} //...SoaKdTreeT::splitRange()
+
+template <typename _Scalar>
+int SoaKdTreeT<_Scalar>::buildLevel(
+    std::vector<Node>           & nodes,
+    std::vector<int>            & ids,
+    int                    const  begin,
+    int                    const  end,
+    PointStorageT<Scalar>  const& points,
+    Scalar                 const* cellLow,
+    Scalar                 const* cellHigh,
+    int                    const  medianSamples,
+    int                    const  forkDepth
+) const {
+    int const nodeId = static_cast<int>(nodes.size());
+    nodes.push_back(Node());
+    Node node;
+    node.child[0] = node.child[1] = -1;
+    node.begin    = begin;
+    node.end      = end;
+    node.dim      = 0;
+    node.divLow   = node.divHigh = Scalar(0);
+
+    if (end - begin > _maxLeafs) {
+        // Split dimension: largest extent of the cell, no pass over the points needed
+        for (int d = 1; d != Dim; ++d)
+            if (cellHigh[d] - cellLow[d] > cellHigh[node.dim] - cellLow[node.dim])
+                node.dim = d;
+
+        // Partition, then record the gap between the children
+        int const dim = node.dim;
+        int const mid = splitRange(ids, begin, end, points, dim, medianSamples);
+        node.divLow  = -std::numeric_limits<Scalar>::max();
+        node.divHigh =  std::numeric_limits<Scalar>::max();
+        for (int i = begin; i != mid; ++i)
+            node.divLow  = std::max(node.divLow,  points.point(ids[i])[dim]);
+        for (int i = mid; i != end; ++i)
+            node.divHigh = std::min(node.divHigh, points.point(ids[i])[dim]);
+
+        // Cells of the children, shrunk to the points on each side of the gap
+        Scalar leftHigh[Dim], rightLow[Dim];
+        std::copy(cellHigh, cellHigh + Dim, leftHigh);
+        std::copy(cellLow,  cellLow  + Dim, rightLow);
+        leftHigh[dim] = node.divLow;
+        rightLow[dim] = node.divHigh;
+
+        if (forkDepth > 0 && end - begin > ParallelMinPoints) {
+            // Right subtree in its own task and node list, appended afterwards. std::async instead of
+            // the ThreadPool, since parents block on their children, which could starve a fixed pool.
+            std::vector<Node> rightNodes;
+            std::future<int> right = std::async(
+                std::launch::async,
+                [&]() { return buildLevel(rightNodes, ids, mid, end, points, rightLow, cellHigh, medianSamples, forkDepth - 1); }
+            );
+            node.child[0] = buildLevel(nodes, ids, begin, mid, points, cellLow, leftHigh, medianSamples, forkDepth - 1);
+            right.get();
+
+            int const offset = static_cast<int>(nodes.size());
+            for (Node rightNode : rightNodes) {
+                if (rightNode.child[0] >= 0) {
+                    rightNode.child[0] += offset;
+                    rightNode.child[1] += offset;
+                }
+                nodes.push_back(rightNode);
+            }
+            node.child[1] = offset;
+        } else {
+            node.child[0] = buildLevel(nodes, ids, begin, mid, points, cellLow,  leftHigh, medianSamples, 0);
+            node.child[1] = buildLevel(nodes, ids, mid,   end, points, rightLow, cellHigh, medianSamples, 0);
+        } //...if fork
+    } //...if inner node
+
+    nodes[nodeId] = node;
+    return nodeId;
+} //...SoaKdTreeT::buildLevel()
+
+template <typename _Scalar>
+std::size_t
+SoaKdTreeT<_Scalar>::knnSearch(
+    Scalar          const* query,
+    int                    k,
+    std::size_t          * indices,
+    Scalar               * distsSqr,
+    KnnSearchParams const& params
+) const {
+    KnnResult result(k, indices, distsSqr);
+    if (k <= 0)
+        return 0;
+
+    knnSearch(query, result, nullptr, params);
+    return result.count;
+} //...SoaKdTreeT::knnSearch()
+
+template <typename _Scalar>
+void
+SoaKdTreeT<_Scalar>::knnSearch(
+    Scalar            const* query,
+    KnnResult              & result,
+    std::vector<bool> const* removed,
+    KnnSearchParams   const& params
+) const {
+    if (_nodes.empty())
+        return;
+
+    // Distance of query to the bounding box, per dimension
+    Scalar cellDistsSqr[Dim];
+    Scalar minDistSqr = 0;
+    for (int d = 0; d != Dim; ++d) {
+        cellDistsSqr[d] = 0;
+        if (query[d] < _bboxLow[d])
+            cellDistsSqr[d] = (_bboxLow[d] - query[d]) * (_bboxLow[d] - query[d]);
+        else if (query[d] > _bboxHigh[d])
+            cellDistsSqr[d] = (query[d] - _bboxHigh[d]) * (query[d] - _bboxHigh[d]);
+        minDistSqr += cellDistsSqr[d];
+    }
+    // Whole tree farther than the neighbours found so far
+    if (minDistSqr > result.worst())
+        return;
+
+    // Leaf distances, kernels fill whole SIMD vectors, on the stack for usual leaf sizes
+    Scalar              stackDistsSqr[MaxStackLeafs + SimdPadding];
+    std::vector<Scalar> heapDistsSqr;
+    Scalar*             leafDistsSqr = stackDistsSqr;
+    if (_maxLeafs > MaxStackLeafs) {
+        heapDistsSqr.resize(_maxLeafs + SimdPadding);
+        leafDistsSqr = heapDistsSqr.data();
+    }
+
+    SearchContext context = {
+        result, query, cellDistsSqr, leafDistsSqr, removed,
+        /* pruneScale: */ (1 + Scalar(std::max(0.f, params.eps))) * (1 + Scalar(std::max(0.f, params.eps))),
+        /* leavesLeft: */ params.maxLeafVisits > 0 ? params.maxLeafVisits : std::numeric_limits<int>::max()
+    };
+    searchLevel(context, 0, minDistSqr);
+} //...SoaKdTreeT::knnSearch()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::relabel(std::vector<std::size_t> const& labels) {
+    for (std::size_t& id : _ids)
+        id = labels[id];
+} //...SoaKdTreeT::relabel()
+
+template <typename _Scalar>
+void
+SoaKdTreeT<_Scalar>::allKnnSearch(
+    int           k,
+    std::size_t * indices,
+    Scalar      * distsSqr,
+    std::size_t * counts,
+    unsigned      nThreads
+) const {
+    allKnnSearch(k,
+        [indices, distsSqr, counts, k](std::size_t pointId, std::size_t count,
+                                       std::size_t const* ids, Scalar const* dists) {
+            std::copy(ids,   ids   + count, indices  + pointId * k);
+            std::copy(dists, dists + count, distsSqr + pointId * k);
+            counts[pointId] = count;
+        },
+        nThreads);
+} //...SoaKdTreeT::allKnnSearch()
+
+template <typename _Scalar>
+void
+SoaKdTreeT<_Scalar>::allKnnSearch(
+    int             k,
+    KnnSinkT const& sink,
+    unsigned        nThreads
+) const {
+    if (k <= 0)
+        return;
+
+    // Leaves in tree order, neighbouring leaves are close in space
+    std::vector<int> leaves;
+    for (int nodeId = 0; nodeId != static_cast<int>(_nodes.size()); ++nodeId)
+        if (_nodes[nodeId].child[0] < 0)
+            leaves.push_back(nodeId);
+
+    parallelChunks(leaves.size(), getChunkCount(leaves.size(), nThreads, 64),
+        [&](int /*chunk*/, std::size_t first, std::size_t last) {
+            Scalar              stackDistsSqr[MaxStackLeafs + SimdPadding];
+            std::vector<Scalar> heapDistsSqr;
+            Scalar*             leafDistsSqr = stackDistsSqr;
+            if (_maxLeafs > MaxStackLeafs) {
+                heapDistsSqr.resize(_maxLeafs + SimdPadding);
+                leafDistsSqr = heapDistsSqr.data();
+            }
+            // Neighbours of the points of one leaf, reused for all leaves of the chunk
+            std::vector<std::size_t> batchIds  (_maxLeafs * k);
+            std::vector<Scalar>      batchDists(_maxLeafs * k);
+            std::vector<KnnResult>   results;
+
+            for (std::size_t leaf = first; leaf != last; ++leaf) {
+                Node const& node = _nodes[leaves[leaf]];
+
+                results.clear();
+                for (int i = 0; i != node.end - node.begin; ++i)
+                    results.push_back(KnnResult(k, &batchIds[i * k], &batchDists[i * k]));
+
+                BatchContext context(results, node.begin, leaves[leaf], leafDistsSqr);
+                for (int d = 0; d != Dim; ++d) {
+                    Scalar const* const coords = _soa.col(d).data() + node.begin;
+                    context.boxLow [d] = *std::min_element(coords, coords + (node.end - node.begin));
+                    context.boxHigh[d] = *std::max_element(coords, coords + (node.end - node.begin));
+                }
+
+                // Own leaf first, its points bound the search tightly from the start
+                scanLeafBatch(context, leaves[leaf]);
+                searchLevelBatch(context, 0, Scalar(0));
+
+                for (int i = node.begin; i != node.end; ++i) {
+                    KnnResult const& result = results[i - node.begin];
+                    sink(_ids[i], result.count, result.indices, result.distsSqr);
+                }
+            } //...for leaves
+        }
+    );
+} //...SoaKdTreeT::allKnnSearch()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::scanLeafBatch(BatchContext& context, int nodeId) const {
+    Node const& node = _nodes[nodeId];
+    int  const  n    = node.end - node.begin;
+    context.bound    = Scalar(0);
+    for (std::size_t query = 0; query != context.results.size(); ++query) {
+        KnnResult& result = context.results[query];
+        Scalar const queryPoint[Dim] = {
+            _soa(context.begin + query, 0), _soa(context.begin + query, 1), _soa(context.begin + query, 2) };
+        _kernel(
+            /* [in]  x: */ _soa.col(0).data() + node.begin,
+            /* [in]  y: */ _soa.col(1).data() + node.begin,
+            /* [in]  z: */ _soa.col(2).data() + node.begin,
+            /* [in]  n: */ n,
+            /* [in]  q: */ queryPoint,
+            /* [out] d: */ context.leafDistsSqr
+        );
+        for (int i = 0; i != n; ++i)
+            if (result.accepts(context.leafDistsSqr[i], _ids[node.begin + i]))
+                result.add(context.leafDistsSqr[i], _ids[node.begin + i]);
+        context.bound = std::max(context.bound, result.worst());
+    } //...for queries
+} //...SoaKdTreeT::scanLeafBatch()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::searchLevelBatch(
+    BatchContext& context,
+    int           nodeId,
+    Scalar        minDistSqr
+) const {
+    Node const& node = _nodes[nodeId];
+    if (node.child[0] < 0) {
+        if (nodeId != context.skipNodeId)
+            scanLeafBatch(context, nodeId);
+        return;
+    }
+
+    // Distances of the query box to the two sides of the split
+    int    const dim        = node.dim;
+    Scalar const leftGap    = std::max(Scalar(0), context.boxLow[dim] - node.divLow);
+    Scalar const rightGap   = std::max(Scalar(0), node.divHigh - context.boxHigh[dim]);
+    Scalar const oldDistSqr = context.cellDistsSqr[dim];
+    Scalar const childDistsSqr[2] = {
+        minDistSqr + leftGap  * leftGap  - oldDistSqr,
+        minDistSqr + rightGap * rightGap - oldDistSqr };
+
+    // Closer child first, the other one, if still closer than the worst neighbour of any query
+    int const first = childDistsSqr[1] < childDistsSqr[0] ? 1 : 0;
+    for (int side = first, visited = 0; visited != 2; side = 1 - side, ++visited) {
+        if (childDistsSqr[side] > context.bound)
+            continue;
+        Scalar const gap = side ? rightGap : leftGap;
+        context.cellDistsSqr[dim] = gap * gap;
+        searchLevelBatch(context, node.child[side], childDistsSqr[side]);
+    }
+    context.cellDistsSqr[dim] = oldDistSqr;
+} //...SoaKdTreeT::searchLevelBatch()
+
+template <typename _Scalar>
+void SoaKdTreeT<_Scalar>::searchLevel(
+    SearchContext& context,
+    int            nodeId,
+    Scalar         minDistSqr
+) const {
+    Node   const& node   = _nodes[nodeId];
+    KnnResult   & result = context.result;
+
+    // Leaf: distances to all points at once, then keep the close ones
+    if (node.child[0] < 0) {
+        int const n = node.end - node.begin;
+        _kernel(
+            /* [in]  x: */ _soa.col(0).data() + node.begin,
+            /* [in]  y: */ _soa.col(1).data() + node.begin,
+            /* [in]  z: */ _soa.col(2).data() + node.begin,
+            /* [in]  n: */ n,
+            /* [in]  q: */ context.query,
+            /* [out] d: */ context.leafDistsSqr
+        );
+        Scalar            const* const leafDistsSqr = context.leafDistsSqr;
+        std::vector<bool> const* const removed      = context.removed;
+        for (int i = 0; i != n; ++i)
+            if (result.accepts(leafDistsSqr[i], _ids[node.begin + i]) && !(removed && (*removed)[_ids[node.begin + i]]))
+                result.add(leafDistsSqr[i], _ids[node.begin + i]);
+        --context.leavesLeft;
+        return;
+    } //...if leaf
+
+    // Visit the child containing the query first
+    int    const dim   = node.dim;
+    Scalar const diff1 = context.query[dim] - node.divLow;
+    Scalar const diff2 = context.query[dim] - node.divHigh;
+    int          bestChild, otherChild;
+    Scalar       cutDistSqr;
+    if (diff1 + diff2 < 0) {
+        bestChild  = node.child[0];
+        otherChild = node.child[1];
+        cutDistSqr = diff2 * diff2;
+    } else {
+        bestChild  = node.child[1];
+        otherChild = node.child[0];
+        cutDistSqr = diff1 * diff1;
+    }
+    searchLevel(context, bestChild, minDistSqr);
+
+    // Visit the other child, if its cell may still contain (sufficiently) closer points,
+    // and the leaf budget is not spent
+    if (context.leavesLeft <= 0 && result.full())
+        return;
+    Scalar* const cellDistsSqr   = context.cellDistsSqr;
+    Scalar  const oldCellDistSqr = cellDistsSqr[dim];
+    minDistSqr        += cutDistSqr - oldCellDistSqr;
+    cellDistsSqr[dim]  = cutDistSqr;
+    if (minDistSqr * context.pruneScale <= result.worst())
+        searchLevel(context, otherChild, minDistSqr);
+    cellDistsSqr[dim]  = oldCellDistSqr;
+} //...SoaKdTreeT::searchLevel()
+
+} //...ns acq
+
+//
+// Template instantiation
+//
+
+namespace acq {
+
+template class SoaKdTreeT<float>;
+template class SoaKdTreeT<double>;
+
+} //...ns acq
@@ -0,0 +1,239 @@
+//
+// Created by bontius on 14/02/17.
+//
+
+#include "acq/spatialOrder.h"
+
+#include "acq/impl/spatialOrder.hpp" // Templated functions
+#include "acq/parallel.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace acq {
+
+namespace {
+
+//! Bits per dimension of a Morton code, 3 x 21 = 63 bits.
+enum { MortonBits = 21 };
+//! Bits sorted per radix sort pass.
+enum { RadixBits = 11 };
+//! Buckets per radix sort pass.
+enum { RadixSize = 1 << RadixBits };
+
+/** \brief Spreads the lower 21 bits of \p x to every third bit. */
+inline std::uint64_t spreadBits3(std::uint64_t x) {
+    x &= 0x1fffffull;
+    x = (x | x << 32) & 0x001f00000000ffffull;
+    x = (x | x << 16) & 0x001f0000ff0000ffull;
+    x = (x | x <<  8) & 0x100f00f00f00f00full;
+    x = (x | x <<  4) & 0x10c30c30c30c30c3ull;
+    x = (x | x <<  2) & 0x1249249249249249ull;
+    return x;
+} //...spreadBits3()
+
+} //...ns anonymous
+
+std::vector<std::uint64_t>
+calculateMortonCodes(
+    CloudConstRefT const& cloud,
+    unsigned       const  nThreads
+) {
+    std::vector<std::uint64_t> codes(cloud.rows());
+    if (!cloud.rows())
+        return codes;
+
+    // Bounding box of the finite points, per chunk, missing pixels of depth frames are NaN
+    int const nChunks = getChunkCount(codes.size(), nThreads);
+    std::vector<Eigen::RowVector3d> lows (nChunks, Eigen::RowVector3d::Constant( std::numeric_limits<double>::infinity()));
+    std::vector<Eigen::RowVector3d> highs(nChunks, Eigen::RowVector3d::Constant(-std::numeric_limits<double>::infinity()));
+    parallelChunks(codes.size(), nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row)
+            if (cloud.row(row).allFinite()) {
+                lows [chunk] = lows [chunk].cwiseMin(cloud.row(row));
+                highs[chunk] = highs[chunk].cwiseMax(cloud.row(row));
+            }
+    });
+    Eigen::RowVector3d low = lows.front(), high = highs.front();
+    for (int chunk = 1; chunk != nChunks; ++chunk) {
+        low  = low .cwiseMin(lows [chunk]);
+        high = high.cwiseMax(highs[chunk]);
+    }
+
+    // Quantize over the bounding box, same scale in all dimensions keeps cells cubic
+    double const extent = (high - low).maxCoeff();
+    double const scale  = extent > 0. ? ((1u << MortonBits) - 1) / extent : 0.;
+
+    parallelChunks(codes.size(), nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t row = begin; row != end; ++row) {
+            // Above all codes of finite points, so they sort last
+            if (!cloud.row(row).allFinite()) {
+                codes[row] = std::numeric_limits<std::uint64_t>::max();
+                continue;
+            }
+            std::uint64_t code = 0;
+            for (int d = 0; d != 3; ++d) {
+                std::uint64_t const cell =
+                    static_cast<std::uint64_t>((cloud(row, d) - low(d)) * scale);
+                code |= spreadBits3(cell) << d;
+            }
+            codes[row] = code;
+        }
+    });
+    return codes;
+} //...calculateMortonCodes()
+
+std::uint64_t
+calculateMortonCode(
+    std::uint32_t const x,
+    std::uint32_t const y,
+    std::uint32_t const z
+) {
+    return spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+} //...calculateMortonCode()
+
+PermutationT
+sortKeys(
+    std::vector<std::uint64_t>      & keys,
+    int                        const  keyBits,
+    unsigned                   const  nThreads
+) {
+    std::size_t const n = keys.size();
+    std::vector<int> values(n);
+    for (std::size_t i = 0; i != n; ++i)
+        values[i] = static_cast<int>(i);
+
+    // LSD radix sort: per pass every chunk counts its digits, a prefix sum over
+    // (digit, chunk) gives each chunk its output ranges, then chunks scatter.
+    int const nChunks = getChunkCount(n, nThreads);
+    std::vector<std::uint64_t> keysOut(n);
+    std::vector<int>           valuesOut(n);
+    std::vector<std::size_t>   offsets(nChunks * RadixSize);
+    for (int shift = 0; shift < keyBits; shift += RadixBits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallelChunks(n, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            std::size_t* const histogram = &offsets[chunk * RadixSize];
+            for (std::size_t i = begin; i != end; ++i)
+                ++histogram[(keys[i] >> shift) & (RadixSize - 1)];
+        });
+
+        std::size_t sum = 0;
+        for (int digit = 0; digit != RadixSize; ++digit)
+            for (int chunk = 0; chunk != nChunks; ++chunk) {
+                std::size_t const count = offsets[chunk * RadixSize + digit];
+                offsets[chunk * RadixSize + digit] = sum;
+                sum += count;
+            }
+
+        parallelChunks(n, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            std::size_t* const offset = &offsets[chunk * RadixSize];
+            for (std::size_t i = begin; i != end; ++i) {
+                std::size_t const target = offset[(keys[i] >> shift) & (RadixSize - 1)]++;
+                keysOut  [target] = keys  [i];
+                valuesOut[target] = values[i];
+            }
+        });
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    } //...for radix passes
+
+    return Eigen::Map<PermutationT const>(values.data(), values.size());
+} //...sortKeys()
+
+PermutationT
+calculateMortonOrder(
+    CloudConstRefT const& cloud,
+    unsigned       const  nThreads
+) {
+    std::vector<std::uint64_t> keys = calculateMortonCodes(cloud, nThreads);
+    // All 64 bits for the codes of non-finite points, same number of passes as 63
+    return sortKeys(keys, 64, nThreads);
+} //...calculateMortonOrder()
+
+PermutationT
+invertPermutation(
+    PermutationT const& order
+) {
+    PermutationT inverse(order.size());
+    for (int i = 0; i != order.size(); ++i)
+        inverse(order(i)) = i;
+    return inverse;
+} //...invertPermutation()
+
+FacesT
+remapFaces(
+    FacesConstMapT const& faces,
+    PermutationT   const& order
+) {
+    PermutationT const newIds = invertPermutation(order);
+    FacesT remapped(faces.rows(), faces.cols());
+    for (int row = 0; row != faces.rows(); ++row)
+        for (int col = 0; col != faces.cols(); ++col)
+            remapped(row, col) = newIds(faces(row, col));
+    return remapped;
+} //...remapFaces()
+
+NeighboursT
+remapNeighbours(
+    NeighboursT  const& neighbours,
+    PermutationT const& newIds
+) {
+    NeighboursT remapped;
+    for (NeighboursT::value_type const& entry : neighbours) {
+        NeighboursT::mapped_type& list = remapped[newIds(entry.first)];
+        for (std::size_t const neighbourId : entry.second)
+            list.insert(newIds(neighbourId));
+    }
+    return remapped;
+} //...remapNeighbours()
+
+} //...ns acq
+
+
+//
+// Template instantiation
+//
+
+namespace acq {
+
+template CloudT
+permuteRows(
+    CloudT       const& matrix,
+    PermutationT const& order
+);
+
+template FacesT
+permuteRows(
+    FacesT       const& matrix,
+    PermutationT const& order
+);
+
+template CloudT
+restoreRows(
+    CloudT       const& matrix,
+    PermutationT const& order
+);
+
+template FacesT
+restoreRows(
+    FacesT       const& matrix,
+    PermutationT const& order
+);
+
+template CloudT
+restoreRows(
+    CloudT       const& matrix,
+    PermutationT const& order,
+    int                 originalCount,
+    CloudT::Scalar      fillValue
+);
+
+template FacesT
+restoreRows(
+    FacesT       const& matrix,
+    PermutationT const& order,
+    int                 originalCount,
+    FacesT::Scalar      fillValue
+);
+
+} //...ns acq
@@ -0,0 +1,50 @@
+//
+// Created by bontius on 06/02/17.
+//
+
+#include "acq/impl/threadPool.hpp"
+
+#include <algorithm>
+
+namespace acq {
+
+ThreadPool::ThreadPool(unsigned nThreads)
+    : _stop(false)
+{
+    if (!nThreads)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    _workers.reserve(nThreads);
+    for (unsigned i = 0; i != nThreads; ++i)
+        _workers.emplace_back(&ThreadPool::work, this);
+} //...ThreadPool::ThreadPool()
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wakeUp.notify_all();
+
+    for (std::thread &worker : _workers)
+        worker.join();
+} //...ThreadPool::~ThreadPool()
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wakeUp.wait(lock, [this]() { return _stop || !_tasks.empty(); });
+            // Exit only when stopped and nothing left to do
+            if (_tasks.empty())
+                return;
+            task = std::move(_tasks.front());
+            _tasks.pop();
+        }
+        // Run outside the lock, exceptions end up in the task's future
+        task();
+    }
+} //...ThreadPool::work()
+
+} //...ns acq
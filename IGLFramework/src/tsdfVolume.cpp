@@ -0,0 +1,462 @@
+//
+// Created by bontius on 17/02/17.
+//
+
+#include "acq/tsdfVolume.h"
+#include "acq/normalEstimation.h"
+#include "acq/organizedCloud.h"
+#include "acq/parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace acq {
+
+namespace {
+
+//! Bits per dimension of a block key, 3 x 21 = 63 bits.
+enum { BlockKeyBits = 21 };
+//! Points whose updates are computed and applied together, bounds the sample memory.
+enum { PointBatchSize = 1 << 16 };
+//! Default truncation distance in voxels.
+enum { DefaultTruncationVoxels = 4 };
+//! Neighbours to estimate normals of unorganized frames from.
+enum { FrameNeighbourCount = 10 };
+//! Half pixel window to estimate normals of organized frames from.
+enum { FrameWindowRadius = 2 };
+
+/** \brief Flips \p normals to face \p sensorOrigin. */
+void orientTowards(CloudConstRefT const& points, NormalsT& normals, Eigen::Vector3d const& sensorOrigin) {
+    for (int row = 0; row != points.rows(); ++row)
+        if (normals.row(row).dot(sensorOrigin.transpose() - points.row(row)) < 0.)
+            normals.row(row) *= -1.;
+} //...orientTowards()
+
+/** \brief Voxel index of local coordinates in a block, x fastest. */
+inline int getVoxelIndex(int x, int y, int z) {
+    return x | (y << TsdfVolume::BlockBits) | (z << (2 * TsdfVolume::BlockBits));
+} //...getVoxelIndex()
+
+/** \brief Index in a 3 x 3 x 3 neighbour table of the block containing local coordinates in [-8, 16). */
+inline int getNeighbourIndex(int x, int y, int z) {
+    return ((x >> TsdfVolume::BlockBits) + 1)
+         + ((y >> TsdfVolume::BlockBits) + 1) * 3
+         + ((z >> TsdfVolume::BlockBits) + 1) * 9;
+} //...getNeighbourIndex()
+
+//! Corner pairs of the 12 edges of a cell, corner i at offset (i & 1, i >> 1 & 1, i >> 2).
+int const CellEdges[12][2] = {
+    {0, 1}, {2, 3}, {4, 5}, {6, 7},
+    {0, 2}, {1, 3}, {4, 6}, {5, 7},
+    {0, 4}, {1, 5}, {2, 6}, {3, 7}
+};
+
+} //...ns anonymous
+
+TsdfVolume::TsdfVolume(double voxelSize, double truncation, float maxWeight)
+    : _voxelSize(voxelSize),
+      _truncation(truncation > 0. ? truncation : DefaultTruncationVoxels * voxelSize),
+      _maxWeight(maxWeight)
+{
+    if (!(voxelSize > 0.)) {
+        std::cerr << "[TsdfVolume::TsdfVolume] Voxel size has to be positive, got " << voxelSize << "\n";
+        throw new std::runtime_error("Invalid voxel size");
+    }
+} //...TsdfVolume()
+
+TsdfVolume::BlockKeyT
+TsdfVolume::getBlockKey(BlockCoordT const& block) {
+    // Offset to unsigned, coordinates are within +-2^20
+    BlockKeyT const offset = BlockKeyT(1) << (BlockKeyBits - 1);
+    BlockKeyT const mask   = (BlockKeyT(1) << BlockKeyBits) - 1;
+    return  ((static_cast<BlockKeyT>(block(0)) + offset) & mask)
+         | (((static_cast<BlockKeyT>(block(1)) + offset) & mask) <<      BlockKeyBits)
+         | (((static_cast<BlockKeyT>(block(2)) + offset) & mask) << (2 * BlockKeyBits));
+} //...getBlockKey()
+
+int TsdfVolume::findBlock(BlockKeyT key) const {
+    std::unordered_map<BlockKeyT, int>::const_iterator const it = _blockIds.find(key);
+    return it == _blockIds.end() ? -1 : it->second;
+} //...findBlock()
+
+void TsdfVolume::getNeighbourBlocks(int blockId, int neighbours[27]) const {
+    BlockCoordT const& center = _blockCoords[blockId];
+    for (int z = -1; z <= 1; ++z)
+        for (int y = -1; y <= 1; ++y)
+            for (int x = -1; x <= 1; ++x)
+                neighbours[(x + 1) + (y + 1) * 3 + (z + 1) * 9] =
+                    (x || y || z) ? findBlock(getBlockKey(center + BlockCoordT(x, y, z))) : blockId;
+} //...getNeighbourBlocks()
+
+void TsdfVolume::clear() {
+    _blocks.clear();
+    _blockCoords.clear();
+    _blockIds.clear();
+    _batchIds.clear();
+} //...clear()
+
+void TsdfVolume::integrate(CloudConstRefT const& points, NormalsConstRefT const& normals, unsigned nThreads) {
+    if (normals.rows() != points.rows()) {
+        std::cerr << "[TsdfVolume::integrate] Normal count " << normals.rows()
+                  << " does not match point count " << points.rows() << "\n";
+        throw new std::runtime_error("Normal count mismatch");
+    }
+
+    double const invVoxelSize = 1. / _voxelSize;
+    // Truncation in voxels
+    double const reach = _truncation * invVoxelSize;
+
+    for (std::size_t batchBegin = 0; batchBegin < static_cast<std::size_t>(points.rows()); batchBegin += PointBatchSize) {
+        std::size_t const batchSize = std::min<std::size_t>(PointBatchSize, points.rows() - batchBegin);
+        int         const nChunks   = getChunkCount(batchSize, nThreads, 1024);
+
+        // Voxel updates of each chunk of points, keyed by block
+        std::vector<std::vector<Sample> > samples(nChunks);
+        parallelChunks(batchSize, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+            std::vector<Sample>& chunkSamples = samples[chunk];
+            chunkSamples.reserve((end - begin) * 4 * (4 * static_cast<std::size_t>(reach) + 2));
+            for (std::size_t row = batchBegin + begin; row != batchBegin + end; ++row) {
+                // In voxel units
+                Eigen::Vector3d const point = points.row(row).transpose() * invVoxelSize;
+                Eigen::Vector3d const dir   = normals.row(row).transpose().normalized();
+                // Zero and non-finite normals fail the comparison
+                if (!point.allFinite() || !(dir.squaredNorm() > 0.5))
+                    continue;
+
+                // Step slab by slab along the major axis of the line, and splat
+                // to the 2 x 2 voxels around it in each slab, so that parallel
+                // lines of neighbouring points leave no voxel between them out.
+                int major;
+                dir.cwiseAbs().maxCoeff(&major);
+                int const u = (major + 1) % 3, v = (major + 2) % 3;
+                double const extent = reach * std::abs(dir(major));
+                int const low  = static_cast<int>(std::ceil (point(major) - extent - 0.5));
+                int const high = static_cast<int>(std::floor(point(major) + extent - 0.5));
+                for (int slab = low; slab <= high; ++slab) {
+                    // Crossing of the line with the plane of the slab's voxel centers
+                    Eigen::Vector3d const crossing = point + ((slab + 0.5 - point(major)) / dir(major)) * dir;
+                    double const lowU = std::floor(crossing(u) - 0.5);
+                    double const lowV = std::floor(crossing(v) - 0.5);
+                    double const fracU = crossing(u) - 0.5 - lowU;
+                    double const fracV = crossing(v) - 0.5 - lowV;
+
+                    for (int corner = 0; corner != 4; ++corner) {
+                        int const du = corner & 1, dv = corner >> 1;
+                        double const weight = (du ? fracU : 1. - fracU) * (dv ? fracV : 1. - fracV);
+                        if (weight < 1e-3)
+                            continue;
+
+                        Eigen::Vector3i voxel;
+                        voxel(major) = slab;
+                        voxel(u)     = static_cast<int>(lowU) + du;
+                        voxel(v)     = static_cast<int>(lowV) + dv;
+
+                        // Signed distance of the voxel center from the tangent plane
+                        double const distance = dir.dot((voxel.cast<double>().array() + 0.5 - point.array()).matrix()) / reach;
+                        Sample sample;
+                        sample.block  = getBlockKey(BlockCoordT(voxel(0) >> BlockBits, voxel(1) >> BlockBits, voxel(2) >> BlockBits));
+                        sample.voxel  = getVoxelIndex(voxel(0) & (BlockSide - 1), voxel(1) & (BlockSide - 1), voxel(2) & (BlockSide - 1));
+                        sample.tsdf   = static_cast<float>(std::max(-1., std::min(1., distance)));
+                        sample.weight = static_cast<float>(weight);
+                        chunkSamples.push_back(sample);
+                    } //...for splat corners
+                } //...for slabs
+            } //...for points
+        });
+
+        // Allocate missing blocks, replace keys by dense ids of the blocks
+        // the batch touches, so sorting and updating cost nothing for the others.
+        // Consecutive samples mostly share their block, look those up once.
+        std::vector<int> batchBlocks; // Block index of each batch id
+        BlockKeyT lastKey   = ~BlockKeyT(0);
+        int       lastBlock = -1;
+        for (std::vector<Sample>& chunkSamples : samples) {
+            for (Sample& sample : chunkSamples) {
+                if (sample.block != lastKey) {
+                    lastKey = sample.block;
+                    std::pair<std::unordered_map<BlockKeyT, int>::iterator, bool> const inserted =
+                        _blockIds.emplace(lastKey, static_cast<int>(_blocks.size()));
+                    if (inserted.second) {
+                        // Unpack the coordinates from the key
+                        BlockKeyT const mask   = (BlockKeyT(1) << BlockKeyBits) - 1;
+                        int       const offset = 1 << (BlockKeyBits - 1);
+                        _blockCoords.emplace_back(static_cast<int>( lastKey                      & mask) - offset,
+                                                  static_cast<int>((lastKey >>      BlockKeyBits) & mask) - offset,
+                                                  static_cast<int>((lastKey >> (2 * BlockKeyBits)) & mask) - offset);
+                        _blocks.emplace_back();
+                        std::fill(_blocks.back().tsdf,   _blocks.back().tsdf   + BlockVoxels, 1.f);
+                        std::fill(_blocks.back().weight, _blocks.back().weight + BlockVoxels, 0.f);
+                        _batchIds.push_back(-1);
+                    }
+                    int const blockId = inserted.first->second;
+                    if (_batchIds[blockId] < 0) {
+                        _batchIds[blockId] = static_cast<int>(batchBlocks.size());
+                        batchBlocks.push_back(blockId);
+                    }
+                    lastBlock = _batchIds[blockId];
+                }
+                sample.block = lastBlock;
+            } //...for samples
+        } //...for chunks
+
+        for (int const blockId : batchBlocks)
+            _batchIds[blockId] = -1;
+
+        // Counting sort by batch id: per chunk histograms, a prefix sum over
+        // (block, chunk) gives each chunk its output ranges, then chunks scatter.
+        std::size_t const nBlocks = batchBlocks.size();
+        std::vector<std::size_t> offsets(nChunks * nBlocks, 0);
+        parallelChunks(nChunks, nChunks, [&](int chunk, std::size_t, std::size_t) {
+            std::size_t* const histogram = &offsets[chunk * nBlocks];
+            for (Sample const& sample : samples[chunk])
+                ++histogram[sample.block];
+        });
+        std::vector<std::size_t> blockStart(nBlocks + 1);
+        std::size_t sum = 0;
+        for (std::size_t block = 0; block != nBlocks; ++block) {
+            blockStart[block] = sum;
+            for (int chunk = 0; chunk != nChunks; ++chunk) {
+                std::size_t const count = offsets[chunk * nBlocks + block];
+                offsets[chunk * nBlocks + block] = sum;
+                sum += count;
+            }
+        }
+        blockStart[nBlocks] = sum;
+
+        std::vector<Sample> sorted(sum);
+        parallelChunks(nChunks, nChunks, [&](int chunk, std::size_t, std::size_t) {
+            std::size_t* const offset = &offsets[chunk * nBlocks];
+            for (Sample const& sample : samples[chunk])
+                sorted[offset[sample.block]++] = sample;
+        });
+        samples.clear();
+
+        // Blocks are independent, update their voxels with running averages
+        parallelChunks(nBlocks, getChunkCount(nBlocks, nThreads, 64),
+            [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+                for (std::size_t blockId = begin; blockId != end; ++blockId) {
+                    Block& block = _blocks[batchBlocks[blockId]];
+                    for (std::size_t i = blockStart[blockId]; i != blockStart[blockId + 1]; ++i) {
+                        Sample const& sample = sorted[i];
+                        float& tsdf   = block.tsdf  [sample.voxel];
+                        float& weight = block.weight[sample.voxel];
+                        tsdf   = (tsdf * weight + sample.tsdf * sample.weight) / (weight + sample.weight);
+                        weight = std::min(weight + sample.weight, _maxWeight);
+                    }
+                } //...for blocks
+            });
+    } //...for batches
+} //...integrate()
+
+void TsdfVolume::integrateFrame(CloudConstRefT const& points, Eigen::Vector3d const& sensorOrigin, unsigned nThreads) {
+    // Distances along the viewing rays get the wrong sign beside surfaces seen
+    // at grazing angles, use the tangent planes of the points instead.
+    std::vector<int> finiteRows;
+    finiteRows.reserve(points.rows());
+    for (int row = 0; row != points.rows(); ++row)
+        if (points.row(row).allFinite())
+            finiteRows.push_back(row);
+    CloudT finite(finiteRows.size(), 3);
+    for (std::size_t i = 0; i != finiteRows.size(); ++i)
+        finite.row(i) = points.row(finiteRows[i]);
+    if (finite.rows() <= FrameNeighbourCount)
+        return;
+
+    KdTree const cloudIndex(finite);
+    KnnIndicesT      neighbours;
+    KdTree::KnnDistsT distsSqr;
+    calculateCloudNeighbours(cloudIndex, FrameNeighbourCount, neighbours, distsSqr,
+                             std::sqrt(std::numeric_limits<float>::max()) - 1.f, nThreads);
+    NormalsT normals = calculateCloudNormals(cloudIndex.getPoints(), neighbours, nThreads);
+    orientTowards(finite, normals, sensorOrigin);
+
+    integrate(finite, normals, nThreads);
+} //...integrateFrame()
+
+void TsdfVolume::integrate(DecoratedCloud const& cloud, unsigned nThreads) {
+    if (cloud.hasNormals())
+        integrate(cloud.getVertices(), cloud.getNormals(), nThreads);
+    else if (cloud.isOrganized()) {
+        // Pixel windows are cheaper than a kd-tree, invalid pixels get non-finite normals and are skipped
+        NormalsT normals = calculateOrganizedNormals(cloud.getVertices(), cloud.getGridWidth(), cloud.getGridHeight(),
+                                                     FrameWindowRadius, nThreads);
+        orientTowards(cloud.getVertices(), normals, Eigen::Vector3d::Zero());
+        integrate(cloud.getVertices(), normals, nThreads);
+    } else
+        integrateFrame(cloud.getVertices(), Eigen::Vector3d::Zero(), nThreads);
+} //...integrate()
+
+DecoratedCloud TsdfVolume::extractMesh(unsigned nThreads) const {
+    std::size_t const nBlocks = _blocks.size();
+    int         const nChunks = getChunkCount(nBlocks, nThreads, 64);
+
+    // Vertex of each cell (by its minimum voxel) local to its block, -1 if none
+    std::vector<int> cellVertex(nBlocks * BlockVoxels, -1);
+    std::vector<int> blockVertexCount(nBlocks, 0);
+    std::vector<std::vector<double> > chunkVertices(nChunks), chunkNormals(nChunks);
+
+    // Vertices, in block order, so chunks can be concatenated
+    parallelChunks(nBlocks, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        std::vector<double>& vertices = chunkVertices[chunk];
+        std::vector<double>& normals  = chunkNormals [chunk];
+        int neighbours[27];
+        for (std::size_t blockId = begin; blockId != end; ++blockId) {
+            getNeighbourBlocks(static_cast<int>(blockId), neighbours);
+            Eigen::Vector3d const blockOrigin = _blockCoords[blockId].cast<double>() * BlockSide;
+            int* const blockCells = &cellVertex[blockId * BlockVoxels];
+            int        count      = 0;
+            for (int z = 0; z != BlockSide; ++z)
+                for (int y = 0; y != BlockSide; ++y)
+                    for (int x = 0; x != BlockSide; ++x) {
+                        // Corners of the cell, all have to be observed
+                        float values[8];
+                        int   inside = 0;
+                        bool  observed = true;
+                        for (int corner = 0; corner != 8 && observed; ++corner) {
+                            int const cx = x + (corner & 1), cy = y + (corner >> 1 & 1), cz = z + (corner >> 2);
+                            int const neighbour = neighbours[getNeighbourIndex(cx, cy, cz)];
+                            if (neighbour < 0) {
+                                observed = false;
+                                break;
+                            }
+                            int const voxel = getVoxelIndex(cx & (BlockSide - 1), cy & (BlockSide - 1), cz & (BlockSide - 1));
+                            observed       = _blocks[neighbour].weight[voxel] > 0.f;
+                            values[corner] = _blocks[neighbour].tsdf  [voxel];
+                            inside        += values[corner] < 0.f;
+                        }
+                        if (!observed || !inside || inside == 8)
+                            continue;
+
+                        // Mean of the zero crossings along the edges
+                        Eigen::Vector3d position(Eigen::Vector3d::Zero());
+                        int nCrossings = 0;
+                        for (int const (&edge)[2] : CellEdges) {
+                            float const a = values[edge[0]], b = values[edge[1]];
+                            if ((a < 0.f) == (b < 0.f))
+                                continue;
+                            double const t = a / (a - b);
+                            Eigen::Vector3d const from(edge[0] & 1, edge[0] >> 1 & 1, edge[0] >> 2);
+                            Eigen::Vector3d const to  (edge[1] & 1, edge[1] >> 1 & 1, edge[1] >> 2);
+                            position += from + t * (to - from);
+                            ++nCrossings;
+                        }
+                        position /= nCrossings;
+
+                        // Distance gradient over the cell, points outwards
+                        Eigen::Vector3d gradient(Eigen::Vector3d::Zero());
+                        for (int corner = 0; corner != 8; ++corner)
+                            gradient += values[corner] * Eigen::Vector3d((corner & 1) ? 1. : -1.,
+                                                                         (corner >> 1 & 1) ? 1. : -1.,
+                                                                         (corner >> 2) ? 1. : -1.);
+                        gradient.normalize();
+
+                        // Voxel centers are at (index + 0.5) * voxelSize
+                        Eigen::Vector3d const world =
+                            (blockOrigin + Eigen::Vector3d(x, y, z) + position).array() * _voxelSize + 0.5 * _voxelSize;
+                        vertices.insert(vertices.end(), world.data(), world.data() + 3);
+                        normals .insert(normals .end(), gradient.data(), gradient.data() + 3);
+                        blockCells[getVoxelIndex(x, y, z)] = count++;
+                    } //...for cells
+            blockVertexCount[blockId] = count;
+        } //...for blocks
+    });
+
+    // Global id of the first vertex of each block
+    std::vector<int> blockVertexStart(nBlocks + 1, 0);
+    for (std::size_t blockId = 0; blockId != nBlocks; ++blockId)
+        blockVertexStart[blockId + 1] = blockVertexStart[blockId] + blockVertexCount[blockId];
+
+    // Two triangles per voxel edge with a sign change, connecting the 4 cells around it
+    std::vector<std::vector<int> > chunkFaces(nChunks);
+    parallelChunks(nBlocks, nChunks, [&](int chunk, std::size_t begin, std::size_t end) {
+        std::vector<int>& faces = chunkFaces[chunk];
+        int neighbours[27];
+        for (std::size_t blockId = begin; blockId != end; ++blockId) {
+            getNeighbourBlocks(static_cast<int>(blockId), neighbours);
+            Block const& block = _blocks[blockId];
+
+            auto getCellVertex = [&](int x, int y, int z) -> int {
+                int const neighbour = neighbours[getNeighbourIndex(x, y, z)];
+                if (neighbour < 0)
+                    return -1;
+                int const local = cellVertex[neighbour * BlockVoxels +
+                                             getVoxelIndex(x & (BlockSide - 1), y & (BlockSide - 1), z & (BlockSide - 1))];
+                return local < 0 ? -1 : blockVertexStart[neighbour] + local;
+            };
+
+            for (int z = 0; z != BlockSide; ++z)
+                for (int y = 0; y != BlockSide; ++y)
+                    for (int x = 0; x != BlockSide; ++x) {
+                        int const voxel = getVoxelIndex(x, y, z);
+                        if (!(block.weight[voxel] > 0.f))
+                            continue;
+                        bool const inside = block.tsdf[voxel] < 0.f;
+
+                        int const coords[3] = { x, y, z };
+                        for (int axis = 0; axis != 3; ++axis) {
+                            // Other end of the edge
+                            int next[3] = { x, y, z };
+                            ++next[axis];
+                            int const neighbour = neighbours[getNeighbourIndex(next[0], next[1], next[2])];
+                            if (neighbour < 0)
+                                continue;
+                            int const nextVoxel = getVoxelIndex(next[0] & (BlockSide - 1), next[1] & (BlockSide - 1), next[2] & (BlockSide - 1));
+                            if (!(_blocks[neighbour].weight[nextVoxel] > 0.f) ||
+                                (_blocks[neighbour].tsdf[nextVoxel] < 0.f) == inside)
+                                continue;
+
+                            // Cells sharing the edge, around it counter-clockwise seen along the axis
+                            int const u = (axis + 1) % 3, v = (axis + 2) % 3;
+                            int cell[4][3];
+                            for (int i = 0; i != 4; ++i)
+                                std::copy(coords, coords + 3, cell[i]);
+                            --cell[1][u];
+                            --cell[2][u]; --cell[2][v];
+                            --cell[3][v];
+                            int ids[4];
+                            bool complete = true;
+                            for (int i = 0; i != 4 && complete; ++i)
+                                complete = (ids[i] = getCellVertex(cell[i][0], cell[i][1], cell[i][2])) >= 0;
+                            if (!complete)
+                                continue;
+
+                            // Facing outwards, the positive end of the edge
+                            if (inside)
+                                faces.insert(faces.end(), { ids[0], ids[1], ids[2], ids[0], ids[2], ids[3] });
+                            else
+                                faces.insert(faces.end(), { ids[0], ids[2], ids[1], ids[0], ids[3], ids[2] });
+                        } //...for axes
+                    } //...for voxels
+        } //...for blocks
+    });
+
+    // Concatenate chunks
+    int const nVertices = blockVertexStart[nBlocks];
+    std::size_t nFaceIds = 0;
+    for (std::vector<int> const& faces : chunkFaces)
+        nFaceIds += faces.size();
+
+    CloudT   vertices(nVertices, 3);
+    NormalsT normals (nVertices, 3);
+    FacesT   faces   (nFaceIds / 3, 3);
+    int vertexRow = 0, faceRow = 0;
+    for (int chunk = 0; chunk != nChunks; ++chunk) {
+        int const nChunkVertices = static_cast<int>(chunkVertices[chunk].size() / 3);
+        typedef Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> RowsT;
+        vertices.middleRows(vertexRow, nChunkVertices) = Eigen::Map<RowsT const>(chunkVertices[chunk].data(), nChunkVertices, 3);
+        normals .middleRows(vertexRow, nChunkVertices) = Eigen::Map<RowsT const>(chunkNormals [chunk].data(), nChunkVertices, 3);
+        vertexRow += nChunkVertices;
+
+        int const nChunkFaces = static_cast<int>(chunkFaces[chunk].size() / 3);
+        faces.middleRows(faceRow, nChunkFaces) =
+            Eigen::Map<Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> const>(chunkFaces[chunk].data(), nChunkFaces, 3);
+        faceRow += nChunkFaces;
+    }
+
+    return DecoratedCloud(std::move(vertices), std::move(faces), std::move(normals));
+} //...extractMesh()
+
+} //...ns acq
@@ -0,0 +1,284 @@
+//
+// Created by bontius on 15/02/17.
+//
+
+#include "acq/voxelGrid.h"
+#include "acq/parallel.h"
+#include "acq/spatialOrder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace acq {
+
+namespace {
+
+//! Bits per dimension of a cell key, 3 x 21 = 63 bits.
+enum { CellKeyBits = 21 };
+//! Largest cell count along an axis.
+enum { MaxCellCount = (1 << CellKeyBits) - 1 };
+//! Bits of cell coordinates within a block of cells hashed together.
+enum { BlockBits = 2 };
+//! Mask of cell coordinates within a block.
+enum { BlockMask = (1 << BlockBits) - 1 };
+//! Points per cell aimed for, when the cell size is chosen automatically.
+enum { TargetPointsPerCell = 32 };
+
+} //...ns anonymous
+
+template <typename _Scalar>
+VoxelGridT<_Scalar>::VoxelGridT(PointStorageType&& points, Scalar cellSize, unsigned nThreads)
+    : _points(std::move(points)), _cellSize(cellSize)
+{
+    std::size_t const n = _points.size();
+    if (!n) {
+        _origin.setZero();
+        _cellCount.setZero();
+        _bucketStart.assign(2, 0);
+        return;
+    }
+
+    // Bounding box of the finite points, others are not indexed
+    std::vector<char> finite(n);
+    std::size_t       nFinite = 0;
+    Eigen::Matrix<Scalar, Dim, 1> high;
+    for (std::size_t i = 0; i != n; ++i) {
+        if (!(finite[i] = _points.getPoint(i).allFinite()))
+            continue;
+        if (!nFinite++)
+            _origin = high = _points.getPoint(i);
+        _origin = _origin.cwiseMin(_points.getPoint(i));
+        high    = high   .cwiseMax(_points.getPoint(i));
+    }
+    if (!nFinite) {
+        _origin.setZero();
+        _cellCount.setZero();
+        _bucketStart.assign(2, 0);
+        return;
+    }
+    Eigen::Matrix<Scalar, Dim, 1> const extent = high - _origin;
+
+    if (!(_cellSize > Scalar(0))) {
+        // Scanned clouds sample surfaces: assume the points cover an area
+        // spanned by the two largest extents of the bounding box.
+        Eigen::Matrix<Scalar, Dim, 1> sorted = extent;
+        std::sort(sorted.data(), sorted.data() + Dim);
+        Scalar const area = std::max(sorted(2) * sorted(1), sorted(2) * sorted(2) / Scalar(nFinite));
+        _cellSize = std::sqrt(area * TargetPointsPerCell / Scalar(nFinite));
+        if (!(_cellSize > Scalar(0)))
+            _cellSize = Scalar(1);
+    }
+    // Cell coordinates have to fit the keys
+    _cellSize = std::max(_cellSize, extent.maxCoeff() / Scalar(MaxCellCount - 1));
+    for (int d = 0; d != Dim; ++d)
+        _cellCount(d) = static_cast<int>(extent(d) / _cellSize) + 1;
+
+    // Power of two number of buckets, at least one per point
+    int bucketBits = 0;
+    while ((std::size_t(1) << bucketBits) < nFinite)
+        ++bucketBits;
+    std::size_t const nBuckets = std::size_t(1) << bucketBits;
+    _bucketStart.resize(nBuckets + 1);
+
+    // Radix sort by bucket, fixed size histograms keep temporary memory linear.
+    // Non-finite points go to bucket nBuckets, past all real ones, and are dropped.
+    int const nChunks = getChunkCount(n, nThreads);
+    std::vector<std::uint64_t> buckets(n);
+    parallelChunks(n, nChunks, [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i != end; ++i)
+            buckets[i] = finite[i] ? getBucket(getCell(_points.point(i))) : nBuckets;
+    });
+    int const sortBits = bucketBits + (nFinite != n);
+    PermutationT const order = sortKeys(buckets, std::max(1, sortBits), nThreads);
+
+    // Buckets start where the sorted bucket ids change, empty ones where the next one starts
+    parallelChunks(nFinite, getChunkCount(nFinite, nThreads), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i != end; ++i) {
+            std::size_t const first = i ? buckets[i - 1] + 1 : 0;
+            for (std::size_t bucket = first; bucket <= buckets[i]; ++bucket)
+                _bucketStart[bucket] = i;
+        }
+    });
+    for (std::size_t bucket = buckets[nFinite - 1] + 1; bucket <= nBuckets; ++bucket)
+        _bucketStart[bucket] = nFinite;
+
+    _soa.resize(nFinite, Dim);
+    _ids.resize(nFinite);
+    _keys.resize(nFinite);
+    parallelChunks(nFinite, getChunkCount(nFinite, nThreads), [&](int /*chunk*/, std::size_t begin, std::size_t end) {
+        for (std::size_t target = begin; target != end; ++target) {
+            std::size_t   const i     = order(target);
+            Scalar const* const point = _points.point(i);
+            _soa.row(target) << point[0], point[1], point[2];
+            _ids [target] = i;
+            _keys[target] = getCellKey(getCell(point));
+        }
+    });
+} //...VoxelGridT()
+
+template <typename _Scalar>
+typename VoxelGridT<_Scalar>::CellT
+VoxelGridT<_Scalar>::getCell(Scalar const* point) const {
+    CellT cell;
+    for (int d = 0; d != Dim; ++d) {
+        // Clamp far away queries before converting to int
+        Scalar const coord = std::floor((point[d] - _origin(d)) / _cellSize);
+        cell(d) = static_cast<int>(std::max(Scalar(-MaxCellCount), std::min(coord, Scalar(2 * MaxCellCount))));
+    }
+    return cell;
+} //...getCell()
+
+template <typename _Scalar>
+std::uint64_t
+VoxelGridT<_Scalar>::getCellKey(CellT const& cell) {
+    return  static_cast<std::uint64_t>(cell(0))
+         | (static_cast<std::uint64_t>(cell(1)) <<      CellKeyBits)
+         | (static_cast<std::uint64_t>(cell(2)) << (2 * CellKeyBits));
+} //...getCellKey()
+
+template <typename _Scalar>
+std::size_t
+VoxelGridT<_Scalar>::getBucket(CellT const& cell) const {
+    // Blocks of 4 x 4 x 4 cells are hashed (Teschner et al., "Optimized Spatial Hashing
+    // for Collision Detection of Deformable Objects") to 64 consecutive buckets,
+    // so that neighbouring cells are mostly close in memory.
+    std::uint64_t const hash = (static_cast<std::uint64_t>(cell(0) >> BlockBits) * 73856093u)
+                             ^ (static_cast<std::uint64_t>(cell(1) >> BlockBits) * 19349663u)
+                             ^ (static_cast<std::uint64_t>(cell(2) >> BlockBits) * 83492791u);
+    std::size_t const local =  (cell(0) & BlockMask)
+                            | ((cell(1) & BlockMask) <<      BlockBits)
+                            | ((cell(2) & BlockMask) << (2 * BlockBits));
+    return static_cast<std::size_t>((hash << (3 * BlockBits)) | local) & (_bucketStart.size() - 2);
+} //...getBucket()
+
+template <typename _Scalar>
+typename VoxelGridT<_Scalar>::Scalar
+VoxelGridT<_Scalar>::getCellDistSqr(CellT const& cell, Scalar const* point) const {
+    Scalar distSqr(0);
+    for (int d = 0; d != Dim; ++d) {
+        Scalar const low = _origin(d) + cell(d) * _cellSize;
+        Scalar const gap = std::max(low - point[d], point[d] - (low + _cellSize));
+        if (gap > Scalar(0))
+            distSqr += gap * gap;
+    }
+    return distSqr;
+} //...getCellDistSqr()
+
+template <typename _Scalar>
+template <typename _VisitorT>
+void
+VoxelGridT<_Scalar>::scanCell(CellT const& cell, Scalar const* query, _VisitorT& visit) const {
+    std::size_t   const bucket = getBucket(cell);
+    std::uint64_t const key    = getCellKey(cell);
+    Scalar const* const x      = _soa.col(0).data();
+    Scalar const* const y      = _soa.col(1).data();
+    Scalar const* const z      = _soa.col(2).data();
+    for (int i = _bucketStart[bucket]; i != _bucketStart[bucket + 1]; ++i) {
+        // Other cell hashed to the same bucket
+        if (_keys[i] != key)
+            continue;
+        Scalar const dx = x[i] - query[0];
+        Scalar const dy = y[i] - query[1];
+        Scalar const dz = z[i] - query[2];
+        visit(_ids[i], dx * dx + dy * dy + dz * dz);
+    }
+} //...scanCell()
+
+template <typename _Scalar>
+std::size_t
+VoxelGridT<_Scalar>::knnSearch(
+    Scalar const* query,
+    int           k,
+    std::size_t * indices,
+    Scalar      * distsSqr
+) const {
+    KnnResultT<Scalar> result(k, indices, distsSqr);
+    if (_ids.empty() || k <= 0)
+        return 0;
+
+    auto visit = [&result](std::size_t index, Scalar distSqr) {
+        if (result.accepts(distSqr, index))
+            result.add(distSqr, index);
+    };
+
+    CellT const center = getCell(query);
+    // Shells needed to reach every cell of the grid
+    int const maxRadius = std::max(center.maxCoeff(), (_cellCount - CellT::Ones() - center).maxCoeff());
+    for (int radius = 0; radius <= maxRadius; ++radius) {
+        // Cells at Chebyshev distance "radius" from the center, inside the grid
+        CellT const low  = (center - CellT::Constant(radius)).cwiseMax(CellT::Zero());
+        CellT const high = (center + CellT::Constant(radius)).cwiseMin(_cellCount - CellT::Ones());
+        CellT cell;
+        for (cell(0) = low(0); cell(0) <= high(0); ++cell(0)) {
+            bool const onX = std::abs(cell(0) - center(0)) == radius;
+            for (cell(1) = low(1); cell(1) <= high(1); ++cell(1)) {
+                bool const onXY = onX || std::abs(cell(1) - center(1)) == radius;
+                // Inside the shell only the two z faces are on it
+                int const zStep = onXY ? 1 : 2 * radius;
+                for (cell(2) = onXY ? low(2) : center(2) - radius; cell(2) <= high(2); cell(2) += zStep) {
+                    if (cell(2) >= low(2) && getCellDistSqr(cell, query) <= result.worst())
+                        scanCell(cell, query, visit);
+                }
+            }
+        }
+
+        // Unvisited points are outside the scanned cube of cells
+        if (result.full()) {
+            Scalar gap = std::numeric_limits<Scalar>::max();
+            for (int d = 0; d != Dim; ++d) {
+                Scalar const cubeLow = _origin(d) + (center(d) - radius) * _cellSize;
+                gap = std::min(gap, query[d] - cubeLow);
+                gap = std::min(gap, cubeLow + (2 * radius + 1) * _cellSize - query[d]);
+            }
+            if (gap >= Scalar(0) && result.worst() < gap * gap)
+                break;
+        }
+    } //...for shells
+
+    return result.count;
+} //...knnSearch()
+
+template <typename _Scalar>
+std::size_t
+VoxelGridT<_Scalar>::radiusSearch(
+    Scalar                                  const* query,
+    Scalar                                  const  radius,
+    std::vector<std::pair<std::size_t, Scalar> > & matches
+) const {
+    matches.clear();
+    if (_ids.empty() || radius < Scalar(0))
+        return 0;
+
+    Scalar const radiusSqr = radius * radius;
+    auto visit = [&matches, radiusSqr](std::size_t index, Scalar distSqr) {
+        if (distSqr <= radiusSqr)
+            matches.emplace_back(index, distSqr);
+    };
+
+    Scalar const lowPoint [Dim] = { query[0] - radius, query[1] - radius, query[2] - radius };
+    Scalar const highPoint[Dim] = { query[0] + radius, query[1] + radius, query[2] + radius };
+    CellT const low  = getCell(lowPoint ).cwiseMax(CellT::Zero());
+    CellT const high = getCell(highPoint).cwiseMin(_cellCount - CellT::Ones());
+    CellT cell;
+    for (cell(0) = low(0); cell(0) <= high(0); ++cell(0))
+        for (cell(1) = low(1); cell(1) <= high(1); ++cell(1))
+            for (cell(2) = low(2); cell(2) <= high(2); ++cell(2))
+                scanCell(cell, query, visit);
+
+    return matches.size();
+} //...radiusSearch()
+
+} //...ns acq
+
+//
+// Template instantiation
+//
+
+namespace acq {
+
+template class VoxelGridT<float>;
+template class VoxelGridT<double>;
+
+} //...ns acq